@@ -45,6 +45,27 @@ static unsigned int bzip2_count = 0;
 static unsigned int bsc_count = 0;
 static unsigned int ppmd_count = 0;
 static unsigned int lz4_count = 0;
+static unsigned int zstd_count = 0;
+
+/*
+ * Running per-codec statistics for throughput targeted codec selection, kept
+ * separately for binary and text data and indexed by the ADAPT_COMPRESS_* id.
+ * Counts are halved once a codec has seen ADAPT_STATS_WINDOW bytes of a class
+ * so that the estimates follow changes in the data.
+ */
+#define	ADAPT_NCLASS		2
+#define	ADAPT_NCODECS		(ADAPT_COMPRESS_ZSTD + 1)
+#define	ADAPT_STATS_WINDOW	(256ULL * 1024 * 1024)
+
+struct codec_stats {
+	uint64_t in, out;
+	double msec;
+	int trying;
+};
+
+static struct codec_stats cstats[ADAPT_NCLASS][ADAPT_NCODECS];
+static pthread_mutex_t cstats_lock = PTHREAD_MUTEX_INITIALIZER;
+static double target_bpms = 0;
 
 extern int lzma_compress(void *src, uint64_t srclen, void *dst,
 	uint64_t *destlen, int level, uchar_t chdr, int btype, void *data);
@@ -82,7 +103,6 @@ extern int lz4_init(void **data, int *level, int nthreads, uint64_t chunksize,
 extern int lz4_deinit(void **data);
 
 extern int ppmd_alloc(void *data);
-extern void ppmd_free(void *data);
 extern int ppmd_state_init(void **data, int *level, int alloc);
 
 extern int lz4_buf_extra(uint64_t buflen);
@@ -93,6 +113,7 @@ struct adapt_data {
 	void *ppmd_data;
 	void *bsc_data;
 	void *lz4_data;
+	void *zstd_data;
 	int adapt_mode;
 	analyzer_ctx_t *actx;
 };
@@ -104,17 +125,150 @@ adapt_set_analyzer_ctx(void *data, analyzer_ctx_t *actx)
 	adat->actx = actx;
 }
 
+/*
+ * Set the aggregate throughput target in bytes per second. The target is split
+ * evenly across the nworkers chunk threads which compress in parallel. A zero
+ * speed disables throughput targeting.
+ */
+void
+adapt_set_target_speed(uint64_t speed, int nworkers)
+{
+	pthread_mutex_lock(&cstats_lock);
+	memset(cstats, 0, sizeof (cstats));
+	if (speed > 0 && nworkers > 0)
+		target_bpms = (double)speed / (double)nworkers / 1000.0;
+	else
+		target_bpms = 0;
+	pthread_mutex_unlock(&cstats_lock);
+}
+
+static int
+codec_avail(struct adapt_data *adat, int codec)
+{
+	switch (codec) {
+	case ADAPT_COMPRESS_LZ4:
+		return (adat->lz4_data != NULL);
+	case ADAPT_COMPRESS_BZIP2:
+		return (1);
+	case ADAPT_COMPRESS_PPMD:
+		return (adat->ppmd_data != NULL);
+	case ADAPT_COMPRESS_LZMA:
+		return (adat->lzma_data != NULL);
+	case ADAPT_COMPRESS_BSC:
+#ifdef ENABLE_PC_LIBBSC
+		return (adat->bsc_data != NULL);
+#else
+		return (0);
+#endif
+	case ADAPT_COMPRESS_ZSTD:
+		return (adat->zstd_data != NULL);
+	}
+	return (0);
+}
+
+/*
+ * Pick the codec with the best observed ratio among those whose observed
+ * speed meets the per-thread target. Codecs not yet measured for this class
+ * of data are tried first, fastest ones first, one chunk at a time. If no
+ * codec is fast enough the fastest one is used.
+ */
+static int
+adapt_pick_codec(struct adapt_data *adat, int cls)
+{
+	static const int order[] = {ADAPT_COMPRESS_LZ4, ADAPT_COMPRESS_ZSTD,
+	    ADAPT_COMPRESS_BZIP2, ADAPT_COMPRESS_BSC, ADAPT_COMPRESS_PPMD, ADAPT_COMPRESS_LZMA};
+	struct codec_stats *cs;
+	double ratio, best_ratio, speed, best_speed;
+	int i, codec, best, fastest;
+
+	best = -1;
+	fastest = ADAPT_COMPRESS_LZ4;
+	best_ratio = 2.0;
+	best_speed = -1.0;
+	pthread_mutex_lock(&cstats_lock);
+	for (i = 0; i < sizeof (order) / sizeof (order[0]); i++) {
+		codec = order[i];
+		if (!codec_avail(adat, codec))
+			continue;
+		cs = &cstats[cls][codec];
+		if (cs->in == 0) {
+			if (cs->trying)
+				continue;
+			cs->trying = 1;
+			best = codec;
+			break;
+		}
+		ratio = (double)cs->out / (double)cs->in;
+		speed = (cs->msec > 0 ? (double)cs->in / cs->msec : target_bpms * 2);
+		if (speed > best_speed) {
+			best_speed = speed;
+			fastest = codec;
+		}
+		if (speed >= target_bpms && ratio < best_ratio) {
+			best_ratio = ratio;
+			best = codec;
+		}
+	}
+	pthread_mutex_unlock(&cstats_lock);
+	if (best == -1)
+		best = fastest;
+	return (best);
+}
+
+static void
+adapt_update_stats(int cls, int codec, uint64_t in, uint64_t out, double msec)
+{
+	struct codec_stats *cs;
+
+	pthread_mutex_lock(&cstats_lock);
+	cs = &cstats[cls][codec];
+	cs->in += in;
+	cs->out += out;
+	cs->msec += msec;
+	cs->trying = 0;
+	if (cs->in > ADAPT_STATS_WINDOW) {
+		cs->in >>= 1;
+		cs->out >>= 1;
+		cs->msec /= 2;
+	}
+	pthread_mutex_unlock(&cstats_lock);
+}
+
 void
 adapt_stats(int show)
 {
+	if (show && target_bpms > 0) {
+		static const char *names[] = {"", "LZMA", "BZIP2", "PPMd", "LIBBSC", "LZ4",
+		    "ZSTD"};
+		int cls, codec;
+
+		log_msg(LOG_INFO, 0, "Throughput target: %.2f MB/s per thread",
+		    target_bpms * 1000 / (1024 * 1024));
+		for (cls = 0; cls < ADAPT_NCLASS; cls++) {
+			for (codec = 1; codec < ADAPT_NCODECS; codec++) {
+				struct codec_stats *cs = &cstats[cls][codec];
+
+				if (cs->in == 0 || cs->msec <= 0)
+					continue;
+				log_msg(LOG_INFO, 0, "	%s %s: %.2f MB/s, ratio %.2f%%",
+				    cls ? "Text" : "Binary", names[codec],
+				    (double)cs->in / cs->msec * 1000 / (1024 * 1024),
+				    (double)cs->out / (double)cs->in * 100);
+			}
+		}
+	}
 	if (show) {
-		if (bzip2_count > 0 || bsc_count > 0 || ppmd_count > 0 || lzma_count > 0) {
+		if (bzip2_count > 0 || bsc_count > 0 || ppmd_count > 0 || lzma_count > 0 ||
+		    zstd_count > 0) {
 			log_msg(LOG_INFO, 0, "Adaptive mode stats:");
 			log_msg(LOG_INFO, 0, "	BZIP2 chunk count: %u", bzip2_count);
 			log_msg(LOG_INFO, 0, "	LIBBSC chunk count: %u", bsc_count);
 			log_msg(LOG_INFO, 0, "	PPMd chunk count: %u", ppmd_count);
 			log_msg(LOG_INFO, 0, "	LZMA chunk count: %u", lzma_count);
 			log_msg(LOG_INFO, 0, "	LZ4 chunk count: %u", lz4_count);
+#ifdef ENABLE_PC_ZSTD
+			log_msg(LOG_INFO, 0, "	ZSTD chunk count: %u", zstd_count);
+#endif
 		} else {
 			log_msg(LOG_INFO, 0, "\n");
 		}
@@ -124,6 +278,7 @@ adapt_stats(int show)
 	bsc_count = 0;
 	ppmd_count = 0;
 	lz4_count = 0;
+	zstd_count = 0;
 }
 
 void
@@ -139,6 +294,10 @@ adapt_props(algo_props_t *data, int level, uint64_t chunksize)
 	ext2 = libbsc_buf_extra(chunksize);
 	if (ext2 > ext1) ext1 = ext2;
 #endif
+#ifdef ENABLE_PC_ZSTD
+	ext2 = zstd_buf_extra(chunksize);
+	if (ext2 > ext1) ext1 = ext2;
+#endif
 
 	data->buf_extra = ext1;
 }
@@ -164,6 +323,16 @@ adapt_init(void **data, int *level, int nthreads, uint64_t chunksize,
 			rv = lz4_init(&(adat->lz4_data), &lv, nthreads, chunksize, file_version, op);
 		adat->lzma_data = NULL;
 		adat->bsc_data = NULL;
+		adat->zstd_data = NULL;
+#ifdef ENABLE_PC_ZSTD
+		/*
+		 * Zstd handles binary data in place of Bzip2 and incompressible data in
+		 * place of LZ4. The level is passed per call.
+		 */
+		lv = *level;
+		if (rv == 0)
+			rv = zstd_init(&(adat->zstd_data), &lv, nthreads, chunksize, file_version, op);
+#endif
 		*data = adat;
 		if (*level > 9) *level = 9;
 	}
@@ -172,6 +341,7 @@ adapt_init(void **data, int *level, int nthreads, uint64_t chunksize,
 	ppmd_count = 0;
 	bsc_count = 0;
 	lz4_count = 0;
+	zstd_count = 0;
 	return (rv);
 }
 
@@ -206,6 +376,16 @@ adapt2_init(void **data, int *level, int nthreads, uint64_t chunksize,
 		lv = 1;
 		if (rv == 0)
 			rv = lz4_init(&(adat->lz4_data), &lv, nthreads, chunksize, file_version, op);
+		adat->zstd_data = NULL;
+#ifdef ENABLE_PC_ZSTD
+		/*
+		 * Zstd is only used for incompressible data here, LZMA stays the binary
+		 * codec.
+		 */
+		lv = *level;
+		if (rv == 0)
+			rv = zstd_init(&(adat->zstd_data), &lv, nthreads, chunksize, file_version, op);
+#endif
 		*data = adat;
 		if (*level > 9) *level = 9;
 	}
@@ -214,6 +394,7 @@ adapt2_init(void **data, int *level, int nthreads, uint64_t chunksize,
 	ppmd_count = 0;
 	bsc_count = 0;
 	lz4_count = 0;
+	zstd_count = 0;
 	return (rv);
 }
 
@@ -229,6 +410,10 @@ adapt_deinit(void **data)
 			rv += lzma_deinit(&(adat->lzma_data));
 		if (adat->lz4_data)
 			rv += lz4_deinit(&(adat->lz4_data));
+#ifdef ENABLE_PC_ZSTD
+		if (adat->zstd_data)
+			rv += zstd_deinit(&(adat->zstd_data));
+#endif
 		slab_free(NULL, adat);
 		*data = NULL;
 	}
@@ -250,12 +435,75 @@ is_bsc_type(int btype)
 	    (mtype & TYPE_TEXT && stype != TYPE_MARKUP));
 }
 
+/*
+ * Compress with the given codec and return its ADAPT_COMPRESS_* id on success.
+ */
+static int
+adapt_run_codec(struct adapt_data *adat, int codec, void *src, uint64_t srclen, void *dst,
+	uint64_t *dstlen, int level, uchar_t chdr, int btype)
+{
+	int rv;
+
+	switch (codec) {
+	case ADAPT_COMPRESS_LZ4:
+		rv = lz4_compress(src, srclen, dst, dstlen, level, chdr, btype, adat->lz4_data);
+		if (rv < 0)
+			return (rv);
+		lz4_count++;
+		break;
+
+	case ADAPT_COMPRESS_LZMA:
+		rv = lzma_compress(src, srclen, dst, dstlen, level, chdr, btype, adat->lzma_data);
+		if (rv < 0)
+			return (rv);
+		lzma_count++;
+		break;
+
+	case ADAPT_COMPRESS_BZIP2:
+		rv = bzip2_compress(src, srclen, dst, dstlen, level, chdr, btype, NULL);
+		if (rv < 0)
+			return (rv);
+		bzip2_count++;
+		break;
+
+#ifdef ENABLE_PC_LIBBSC
+	case ADAPT_COMPRESS_BSC:
+		rv = libbsc_compress(src, srclen, dst, dstlen, level, chdr, btype, adat->bsc_data);
+		if (rv < 0)
+			return (rv);
+		bsc_count++;
+		break;
+#endif
+
+#ifdef ENABLE_PC_ZSTD
+	case ADAPT_COMPRESS_ZSTD:
+		rv = zstd_compress(src, srclen, dst, dstlen, level, chdr, btype, adat->zstd_data);
+		if (rv < 0)
+			return (rv);
+		zstd_count++;
+		break;
+#endif
+
+	default:
+		codec = ADAPT_COMPRESS_PPMD;
+		rv = ppmd_alloc(adat->ppmd_data);
+		if (rv < 0)
+			return (rv);
+		rv = ppmd_compress(src, srclen, dst, dstlen, level, chdr, btype, adat->ppmd_data);
+		if (rv < 0)
+			return (rv);
+		ppmd_count++;
+		break;
+	}
+	return (codec);
+}
+
 int
 adapt_compress(void *src, uint64_t srclen, void *dst,
 	uint64_t *dstlen, int level, uchar_t chdr, int btype, void *data)
 {
 	struct adapt_data *adat = (struct adapt_data *)(data);
-	int rv = 0, bsc_type = 0;
+	int rv = 0, bsc_type = 0, noise = 0, codec;
 	int stype = PC_SUBTYPE(btype);
 	analyzer_ctx_t actx;
 
@@ -265,6 +513,11 @@ adapt_compress(void *src, uint64_t srclen, void *dst,
 			analyze_buffer(src, srclen, &actx);
 			adat->actx = &actx;
 		}
+		/*
+		 * The analyzer histogram gives the order-0 entropy for free. Data
+		 * close to 8 bits per byte is handled like other incompressible data.
+		 */
+		noise = (adat->actx->entropy >= ENTROPY_LIMIT);
 		if (adat->adapt_mode == 2) {
 			btype = adat->actx->forty_pct.btype;
 
@@ -276,61 +529,60 @@ adapt_compress(void *src, uint64_t srclen, void *dst,
 	/* Reset analyzer context for subsequent calls. */
 	adat->actx = NULL;
 
+	/*
+	 * With a throughput target the codec is chosen from the running statistics
+	 * instead of the fixed type table. Incompressible data still goes to the
+	 * fast fallback codec.
+	 */
+	if (target_bpms > 0 && !is_incompressible(btype) && !noise) {
+		double strt, en;
+		int cls;
+
+		cls = (PC_TYPE(btype) & TYPE_TEXT) ? 1 : 0;
+		codec = adapt_pick_codec(adat, cls);
+		strt = get_wtime_millis();
+		rv = adapt_run_codec(adat, codec, src, srclen, dst, dstlen, level, chdr, btype);
+		en = get_wtime_millis();
+		adapt_update_stats(cls, codec, srclen, (rv < 0 ? srclen : *dstlen), en - strt);
+		return (rv);
+	}
+
 	/*
 	 * Use PPMd if some percentage of source is 7-bit textual bytes, otherwise
 	 * use Bzip2 or LZMA. For totally incompressible data we always use LZ4. There
 	 * is no point trying to compress such data, like Jpegs. However some archive headers
 	 * and zero paddings can exist which LZ4 can easily take care of very fast.
+	 * When Zstd is present it takes the place of LZ4 at its fastest level, and
+	 * of Bzip2 for binary data in adapt mode.
 	 */
 #ifdef ENABLE_PC_LIBBSC
 	bsc_type = is_bsc_type(btype);
 #endif
-	if (is_incompressible(btype) && !bsc_type) {
-		rv = lz4_compress(src, srclen, dst, dstlen, level, chdr, btype, adat->lz4_data);
-		if (rv < 0)
-			return (rv);
-		rv = ADAPT_COMPRESS_LZ4;
-		lz4_count++;
+	if ((is_incompressible(btype) || noise) && !bsc_type) {
+		if (adat->zstd_data) {
+			codec = ADAPT_COMPRESS_ZSTD;
+			level = 1;
+		} else {
+			codec = ADAPT_COMPRESS_LZ4;
+		}
 
 	} else if (adat->adapt_mode == 2 && PC_TYPE(btype) & TYPE_BINARY && !bsc_type) {
-		rv = lzma_compress(src, srclen, dst, dstlen, level, chdr, btype, adat->lzma_data);
-		if (rv < 0)
-			return (rv);
-		rv = ADAPT_COMPRESS_LZMA;
-		lzma_count++;
+		codec = ADAPT_COMPRESS_LZMA;
 
 	} else if (adat->adapt_mode == 1 && PC_TYPE(btype) & TYPE_BINARY && !bsc_type) {
-		rv = bzip2_compress(src, srclen, dst, dstlen, level, chdr, btype, NULL);
-		if (rv < 0)
-			return (rv);
-		rv = ADAPT_COMPRESS_BZIP2;
-		bzip2_count++;
+		if (adat->zstd_data)
+			codec = ADAPT_COMPRESS_ZSTD;
+		else
+			codec = ADAPT_COMPRESS_BZIP2;
+
+	} else if (adat->bsc_data && bsc_type) {
+		codec = ADAPT_COMPRESS_BSC;
 
 	} else {
-#ifdef ENABLE_PC_LIBBSC
-		if (adat->bsc_data && bsc_type) {
-			rv = libbsc_compress(src, srclen, dst, dstlen, level, chdr, btype, adat->bsc_data);
-			if (rv < 0)
-				return (rv);
-			rv = ADAPT_COMPRESS_BSC;
-			bsc_count++;
-		} else {
-#endif
-			rv = ppmd_alloc(adat->ppmd_data);
-			if (rv < 0)
-				return (rv);
-			rv = ppmd_compress(src, srclen, dst, dstlen, level, chdr, btype, adat->ppmd_data);
-			ppmd_free(adat->ppmd_data);
-			if (rv < 0)
-				return (rv);
-			rv = ADAPT_COMPRESS_PPMD;
-			ppmd_count++;
-#ifdef ENABLE_PC_LIBBSC
-		}
-#endif
+		codec = ADAPT_COMPRESS_PPMD;
 	}
 
-	return (rv);
+	return (adapt_run_codec(adat, codec, src, srclen, dst, dstlen, level, chdr, btype));
 }
 
 int
@@ -356,9 +608,8 @@ adapt_decompress(void *src, uint64_t srclen, void *dst,
 		rv = ppmd_alloc(adat->ppmd_data);
 		if (rv < 0)
 			return (rv);
-		rv = ppmd_decompress(src, srclen, dst, dstlen, level, chdr, btype, adat->ppmd_data);
-		ppmd_free(adat->ppmd_data);
-		return (rv);
+		return (ppmd_decompress(src, srclen, dst, dstlen, level, chdr, btype,
+		    adat->ppmd_data));
 
 	} else if (cmp_flags == ADAPT_COMPRESS_BSC) {
 #ifdef ENABLE_PC_LIBBSC
@@ -368,6 +619,14 @@ adapt_decompress(void *src, uint64_t srclen, void *dst,
 		return (-1);
 #endif
 
+	} else if (cmp_flags == ADAPT_COMPRESS_ZSTD) {
+#ifdef ENABLE_PC_ZSTD
+		return (zstd_decompress(src, srclen, dst, dstlen, level, chdr, btype, adat->zstd_data));
+#else
+		log_msg(LOG_ERR, 0, "Cannot decompress chunk. Zstd support not present.\n");
+		return (-1);
+#endif
+
 	} else {
 		log_msg(LOG_ERR, 0, "Unrecognized compression mode: %d, file corrupt.\n", cmp_flags);
 	}
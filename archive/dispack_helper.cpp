@@ -136,8 +136,7 @@ cmp_E89:
 	// Apply an E8E9 filter this does not put the DISPACK_MAGIC into the
 	// file header. So, when decoding, that is detected and E8E9 decode
 	// is applied.
-	memcpy(*out_buf, inData, len);
-	if (Forward_E89(*out_buf, len) != 0)
+	if (Forward_E89_copy(inData, *out_buf, len) != 0)
 		return (0);
 	return (len);
 }
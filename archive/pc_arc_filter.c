@@ -45,6 +45,8 @@ struct scratch_buffer {
 	size_t in_bufflen;
 };
 
+static uint64_t mem_budget = FILTER_MEM_BUDGET_MIN;
+
 #ifndef _MPLV2_LICENSE_
 extern size_t packjpg_filter_process(uchar_t *in_buf, size_t len, uchar_t **out_buf);
 ssize_t packjpg_filter(struct filter_info *fi, void *filter_private);
@@ -65,17 +67,48 @@ size_t dispack_filter_encode(uchar_t *inData, size_t len, uchar_t **out_buf);
 size_t dispack_filter_decode(uchar_t *inData, size_t len, uchar_t **out_buf);
 ssize_t dispack_filter(struct filter_info *fi, void *filter_private);
 
+/*
+ * All filters share one scratch buffer. Filters run one entry at a time in
+ * the archiver thread, so the buffer is simply reused from entry to entry.
+ */
+static struct scratch_buffer *
+scratch_create(void)
+{
+	struct scratch_buffer *sdat;
+
+	sdat = (struct scratch_buffer *)malloc(sizeof (struct scratch_buffer));
+	sdat->in_buff = NULL;
+	sdat->in_bufflen = 0;
+	return (sdat);
+}
+
 void
 add_filters_by_type(struct type_data *typetab, struct filter_flags *ff)
 {
 	struct scratch_buffer *sdat = NULL;
 	int slot;
+
+	if (ff->enable_packjpg || ff->enable_wavpack) {
+		my_sysinfo msys_info;
+
+		get_sys_limits(&msys_info);
+		mem_budget = msys_info.freeram / FILTER_MEM_BUDGET_FRAC;
+		if (mem_budget > FILTER_MEM_BUDGET_MAX)
+			mem_budget = FILTER_MEM_BUDGET_MAX;
+
+		/*
+		 * The minimum is only used if it leaves at least half of free RAM.
+		 * Below that the budget, and the file size limits derived from it,
+		 * scale down with free RAM instead of the filters being disabled.
+		 */
+		if (mem_budget < FILTER_MEM_BUDGET_MIN &&
+		    msys_info.freeram >= FILTER_MEM_BUDGET_MIN * 2)
+			mem_budget = FILTER_MEM_BUDGET_MIN;
+	}
 #ifndef _MPLV2_LICENSE_
 
 	if (ff->enable_packjpg) {
-		sdat = (struct scratch_buffer *)malloc(sizeof (struct scratch_buffer));
-		sdat->in_buff = NULL;
-		sdat->in_bufflen = 0;
+		sdat = scratch_create();
 
 		slot = TYPE_JPEG >> 3;
 		typetab[slot].filter_private = sdat;
@@ -98,11 +131,8 @@ add_filters_by_type(struct type_data *typetab, struct filter_flags *ff)
 #endif
 
 	if (ff->exe_preprocess) {
-		if (!sdat) {
-			sdat = (struct scratch_buffer *)malloc(sizeof (struct scratch_buffer));
-			sdat->in_buff = NULL;
-			sdat->in_bufflen = 0;
-		}
+		if (!sdat)
+			sdat = scratch_create();
 		slot = TYPE_EXE32_PE >> 3;
 		typetab[slot].filter_private = sdat;
 		typetab[slot].filter_func = dispack_filter;
@@ -112,11 +142,8 @@ add_filters_by_type(struct type_data *typetab, struct filter_flags *ff)
 
 #ifdef _ENABLE_WAVPACK_
 	if (ff->enable_wavpack) {
-		if (!sdat) {
-			sdat = (struct scratch_buffer *)malloc(sizeof (struct scratch_buffer));
-			sdat->in_buff = NULL;
-			sdat->in_bufflen = -1;
-		}
+		if (!sdat)
+			sdat = scratch_create();
 
 		slot = TYPE_WAV >> 3;
 		typetab[slot].filter_private = sdat;
@@ -142,16 +169,49 @@ type_tag_from_filter_name(struct type_data *typetab, const char *fname, size_t l
     }
     return (TYPE_UNKNOWN);
 }
+
+/*
+ * Memory the filters may use, derived from free RAM when they are set up.
+ */
+uint64_t
+filter_mem_budget(void)
+{
+	return (mem_budget);
+}
+
+/*
+ * Make the scratch buffer at least len bytes. It only grows, in steps of
+ * HELPER_DEF_BUFSIZ, unless it has grown too big to keep in which case it
+ * is shrunk back on the next smaller request.
+ */
 static void
 ensure_buffer(struct scratch_buffer *sdat, uint64_t len)
 {
-	if (sdat->in_bufflen < len) {
-		if (sdat->in_buff) free(sdat->in_buff);
-		sdat->in_bufflen = len;
-		sdat->in_buff = malloc(sdat->in_bufflen);
+	if (sdat->in_bufflen < len || (sdat->in_bufflen > FILTER_SCRATCH_KEEP(mem_budget) &&
+	    len < sdat->in_bufflen)) {
+		free(sdat->in_buff);
+		len = (len + HELPER_DEF_BUFSIZ - 1) / HELPER_DEF_BUFSIZ * HELPER_DEF_BUFSIZ;
+		sdat->in_buff = malloc(len);
+		sdat->in_bufflen = (sdat->in_buff != NULL ? len : 0);
 	}
 }
 
+/*
+ * Pass the raw entry data read into the scratch buffer through as the filter
+ * output. Used when decoding is not possible. The buffer is handed over to
+ * the caller instead of being copied and a new one is set up on next use.
+ */
+static ssize_t
+scratch_passthru(struct filter_info *fi, struct scratch_buffer *sdat, uint64_t len)
+{
+	fi->fout->output_type = FILTER_OUTPUT_MEM;
+	fi->fout->out = sdat->in_buff;
+	fi->fout->out_size = len;
+	sdat->in_buff = NULL;
+	sdat->in_bufflen = 0;
+	return (FILTER_RETURN_SOFT_ERROR);
+}
+
 /*
  * Copy current entry data from the archive being extracted into the given buffer.
  */
@@ -192,10 +252,15 @@ packjpg_filter(struct filter_info *fi, void *filter_private)
 
 	len = archive_entry_size(fi->entry);
 	len1 = len;
-	if (len > PJG_FILE_SIZE_LIMIT) // Bork on massive JPEGs
-		return (FILTER_RETURN_SKIP);
 
 	if (fi->compressing) {
+		/*
+		 * Skip JPEGs whose packJPG working set would exceed the memory
+		 * budget. Filtered entries are always decoded regardless of size.
+		 */
+		if (len * PJG_MEM_FACTOR > mem_budget)
+			return (FILTER_RETURN_SKIP);
+
 		mapbuf = mmap(NULL, len, PROT_READ, MAP_SHARED, fi->fd, 0);
 		if (mapbuf == NULL) {
 			log_msg(LOG_ERR, 1, "Mmap failed in packJPG filter.");
@@ -245,13 +310,7 @@ packjpg_filter(struct filter_info *fi, void *filter_private)
 		 * version number. We also check if it is supported.
 		 */
 		if (mapbuf[0] != 'J' || mapbuf[1] != 'S' || !pjg_version_supported(mapbuf[2])) {
-			uint8_t *out = malloc(len);
-
-			memcpy(out, sdat->in_buff, len);
-			fi->fout->output_type = FILTER_OUTPUT_MEM;
-			fi->fout->out = out;
-			fi->fout->out_size = len;
-			return (FILTER_RETURN_SOFT_ERROR);
+			return (scratch_passthru(fi, sdat, len));
 		}
 	}
 
@@ -285,13 +344,7 @@ packjpg_filter(struct filter_info *fi, void *filter_private)
 		 * archive extraction.
 		 */
 		free(out);
-		out = malloc(len);
-		memcpy(out, sdat->in_buff, len);
-
-		fi->fout->output_type = FILTER_OUTPUT_MEM;
-		fi->fout->out = out;
-		fi->fout->out_size = len;
-		return (FILTER_RETURN_SOFT_ERROR);
+		return (scratch_passthru(fi, sdat, len1));
 	}
 
 	fi->fout->output_type = FILTER_OUTPUT_MEM;
@@ -309,10 +362,11 @@ packpnm_filter(struct filter_info *fi, void *filter_private)
 
 	len = archive_entry_size(fi->entry);
 	len1 = len;
-	if (len > PJG_FILE_SIZE_LIMIT) // Bork on massive JPEGs
-		return (FILTER_RETURN_SKIP);
 
 	if (fi->compressing) {
+		if (len * PPNM_MEM_FACTOR > mem_budget)
+			return (FILTER_RETURN_SKIP);
+
 		mapbuf = mmap(NULL, len, PROT_READ, MAP_SHARED, fi->fd, 0);
 		if (mapbuf == NULL) {
 			log_msg(LOG_ERR, 1, "Mmap failed in packPNM filter.");
@@ -356,13 +410,7 @@ packpnm_filter(struct filter_info *fi, void *filter_private)
 		 * Write the raw data and skip.
 		 */
 		if (identify_pnm_type(mapbuf, len - 8) != 2) {
-			uint8_t *out = malloc(len);
-
-			memcpy(out, sdat->in_buff, len);
-			fi->fout->output_type = FILTER_OUTPUT_MEM;
-			fi->fout->out = out;
-			fi->fout->out_size = len;
-			return (FILTER_RETURN_SOFT_ERROR);
+			return (scratch_passthru(fi, sdat, len));
 		}
 	}
 
@@ -396,13 +444,7 @@ packpnm_filter(struct filter_info *fi, void *filter_private)
 		 * archive extraction.
 		 */
 		free(out);
-		out = malloc(len);
-		memcpy(out, sdat->in_buff, len);
-
-		fi->fout->output_type = FILTER_OUTPUT_MEM;
-		fi->fout->out = out;
-		fi->fout->out_size = len;
-		return (FILTER_RETURN_SOFT_ERROR);
+		return (scratch_passthru(fi, sdat, len1));
 	}
 
 	fi->fout->output_type = FILTER_OUTPUT_MEM;
@@ -472,13 +514,7 @@ wavpack_filter(struct filter_info *fi, void *filter_private)
 		 */
 		wpkstr = (char *)mapbuf;
 		if (strncmp(wpkstr, "wvpk", 4) != 0) {
-			uint8_t *out = malloc(len);
-
-			memcpy(out, sdat->in_buff, len);
-			fi->fout->output_type = FILTER_OUTPUT_MEM;
-			fi->fout->out = out;
-			fi->fout->out_size = len;
-			return (FILTER_RETURN_SOFT_ERROR);
+			return (scratch_passthru(fi, sdat, len));
 		}
 	}
 
@@ -512,13 +548,7 @@ wavpack_filter(struct filter_info *fi, void *filter_private)
 		 * archive extraction.
 		 */
 		free(out);
-		out = malloc(len);
-		memcpy(out, sdat->in_buff, len);
-
-		fi->fout->output_type = FILTER_OUTPUT_MEM;
-		fi->fout->out = out;
-		fi->fout->out_size = len;
-		return (FILTER_RETURN_SOFT_ERROR);
+		return (scratch_passthru(fi, sdat, len1));
 	}
 
 	fi->fout->output_type = FILTER_OUTPUT_MEM;
@@ -606,13 +636,7 @@ dispack_filter(struct filter_info *fi, void *filter_private)
 		 * archive extraction.
 		 */
 		free(out);
-		out = malloc(len);
-		memcpy(out, sdat->in_buff, len);
-
-		fi->fout->output_type = FILTER_OUTPUT_MEM;
-		fi->fout->out = out;
-		fi->fout->out_size = len;
-		return (FILTER_RETURN_SOFT_ERROR);
+		return (scratch_passthru(fi, sdat, len1));
 	}
 
 	fi->fout->output_type = FILTER_OUTPUT_MEM;
@@ -49,13 +49,27 @@ extern "C" {
 #define WVPK_FILE_SIZE_LIMIT    (18 * 1024 * 1024)
 
 /*
- * The biggest scratch buffer reqd by filter routines.
- * Currently this is the WavPack filter buffer.
+ * Memory budget for the filter routines. It is a fraction of the free RAM
+ * when filters are set up, clamped to the given range. The minimum allows
+ * for the WavPack filter buffer and the JPEG sizes handled previously. It
+ * is only applied if at least twice the minimum is free, otherwise the
+ * budget and the size limits derived from it are scaled down with free RAM.
+ * Scratch buffers bigger than a quarter of the budget are not kept around
+ * for reuse.
  */
-#define	FILTER_SCRATCH_SIZE_MAX	WVPK_FILE_SIZE_LIMIT
+#define	FILTER_MEM_BUDGET_MIN	(128ULL * 1024 * 1024)
+#define	FILTER_MEM_BUDGET_MAX	(2048ULL * 1024 * 1024)
+#define	FILTER_MEM_BUDGET_FRAC	(8)
+#define	FILTER_SCRATCH_KEEP(b)	((b) / 4)
 
 #ifndef _MPLV2_LICENSE_
-#	define  PJG_FILE_SIZE_LIMIT     (8 * 1024 * 1024)
+/*
+ * Approximate working memory needed by packJPG and packPNM per byte of
+ * input. PackJPG holds the DCT coefficients of the whole image while
+ * packPNM works line by line.
+ */
+#	define  PJG_MEM_FACTOR          (12)
+#	define  PPNM_MEM_FACTOR         (2)
 #	define  PJG_APPVERSION1         (25)
 #	define  PJG_APPVERSION2         (25)
 #endif
@@ -104,6 +118,7 @@ struct type_data {
 };
 
 void add_filters_by_type(struct type_data *typetab, struct filter_flags *ff);
+uint64_t filter_mem_budget(void);
 int  type_tag_from_filter_name(struct type_data *typetab, const char *fname,
     size_t len);
 
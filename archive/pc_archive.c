@@ -49,6 +49,7 @@
 #include <phash/extensions.h>
 #include <phash/standard.h>
 #include "archive/pc_archive.h"
+#include "archive/pc_sniff.h"
 #include "meta_stream.h"
 
 #undef _FEATURES_H
@@ -103,11 +104,29 @@ static struct arc_list_state {
 	int srt_pos;
 } a_state;
 
+/*
+ * Per-type accumulation lanes. Small members whose type is known from the
+ * extension are not archived right away. Their paths are parked in a lane
+ * for that type and the whole lane is archived in one go once it holds about
+ * a chunk worth of data. This avoids short chunks being cut at every type
+ * change in a stream of small mixed files. Lanes change the member order, so
+ * they are only used when members are being sorted anyway.
+ */
+#define	ARC_LANES		16
+#define	ARC_LANE_PATHBUF	(1024 * 1024)
+#define	ARC_LANE_MEMBER_FRAC	4
+
+struct arc_lane {
+	int typ;
+	uint64_t datalen;
+	uint32_t pathlen;
+	uchar_t *paths;
+};
+
 pthread_mutex_t nftw_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static int detect_type_by_ext(const char *path, int pathlen);
 static int detect_type_from_ext(const char *ext, int len);
-static int detect_type_by_data(uchar_t *buf, size_t len);
 
 /*
  * Archive writer callback routines for archive creation operation.
@@ -1069,6 +1088,29 @@ write_header(struct archive *arc, struct archive_entry *entry)
 	return (0);
 }
 
+/*
+ * Write a segment of a container file, tagging each run of embedded content with
+ * its own type. The archive writer splits chunks where the type changes, so the
+ * adaptive compressor sees the correct type for each embedded file.
+ */
+static ssize_t
+write_container_data(pc_ctx_t *pctx, struct archive *arc, sniff_state_t *st,
+    uchar_t *src, size_t len)
+{
+	size_t pos, rlen;
+	ssize_t wrtn;
+
+	pos = 0;
+	while (pos < len) {
+		pctx->ctype = sniff_next_run(st, src + pos, len - pos, &rlen);
+		wrtn = archive_write_data(arc, src + pos, rlen);
+		if (wrtn < (ssize_t)rlen)
+			return (wrtn < 0 ? wrtn : (ssize_t)(pos + wrtn));
+		pos += rlen;
+	}
+	return (pos);
+}
+
 /*
  * Routines to archive members and write the file data to the callback. Portions of
  * the following code is adapted from some of the Libarchive bsdtar code.
@@ -1079,13 +1121,15 @@ copy_file_data(pc_ctx_t *pctx, struct archive *arc, struct archive_entry *entry,
 	size_t sz, offset, len;
 	ssize_t bytes_to_write;
 	uchar_t *mapbuf;
-	int rv, fd, typ1;
+	int rv, fd, typ1, scan;
 	const char *fpath;
 	filter_output_t fout;
+	sniff_state_t sst;
 
 	typ1 = typ;
 	offset = 0;
 	rv = 0;
+	scan = -1;
 	sz = archive_entry_size(entry);
 	bytes_to_write = sz;
 	fpath = archive_entry_sourcepath(entry);
@@ -1171,7 +1215,7 @@ do_map:
 		wlen = len;
 
 		if (typ == TYPE_UNKNOWN) {
-			pctx->ctype = detect_type_by_data(src, len);
+			pctx->ctype = sniff_type(src, len);
 			typ = pctx->ctype;
 			if (typ != TYPE_UNKNOWN) {
 				if (typetab[(typ >> 3)].filter_func != NULL) {
@@ -1233,13 +1277,26 @@ do_map:
 				}
 			}
 		}
-		typ = TYPE_COMPRESSED; // Need to avoid calling detect_type_by_data subsequently.
+		typ = TYPE_COMPRESSED; // Need to avoid calling sniff_type subsequently.
+
+		/*
+		 * Large files that look like containers are scanned for embedded
+		 * content as they are written out.
+		 */
+		if (scan == -1) {
+			scan = (sz >= SNIFF_CONTAINER_MIN && sniff_is_container(pctx->ctype));
+			if (scan)
+				sniff_state_init(&sst, pctx->ctype);
+		}
 
 		/*
 		 * Write the entire mmap-ed buffer. Since we are writing to the compressor
 		 * stage there is no need for blocking.
 		 */
-		wrtn = archive_write_data(arc, src, wlen);
+		if (scan)
+			wrtn = write_container_data(pctx, arc, &sst, src, wlen);
+		else
+			wrtn = archive_write_data(arc, src, wlen);
 		if (wrtn < (ssize_t)wlen) {
 			/* Write failed; this is bad */
 			log_msg(LOG_ERR, 0, "Data write error: %s", archive_error_string(arc));
@@ -1271,6 +1328,219 @@ write_entry(pc_ctx_t *pctx, struct archive *arc, struct archive_entry *entry, in
 	return (0);
 }
 
+static int archive_path(pc_ctx_t *pctx, struct archive *arc, struct archive *ard,
+    struct archive_entry_linkresolver *resolver, struct archive_entry **entryp,
+    struct arc_lane *lanes, char *fpath, int fpathlen, char *bnchars, int *warn,
+    uint32_t *ctr);
+
+/*
+ * Archive all the members parked in a lane, in the order they were added.
+ */
+static int
+lane_flush(pc_ctx_t *pctx, struct archive *arc, struct archive *ard,
+    struct archive_entry_linkresolver *resolver, struct archive_entry **entryp,
+    struct arc_lane *lane, int *warn, uint32_t *ctr)
+{
+	char fpath[PATH_MAX], *bnchars;
+	uint32_t pos;
+	short namelen;
+	int n;
+
+	pos = 0;
+	while (pos < lane->pathlen) {
+		memcpy(&namelen, lane->paths + pos, sizeof (namelen));
+		pos += sizeof (namelen);
+		memcpy(fpath, lane->paths + pos, namelen);
+		fpath[namelen] = '\0';
+		pos += namelen;
+
+		n = namelen-1;
+		while (fpath[n] == '/' && n > 0) n--;
+		while (fpath[n] != '/' && fpath[n] != '\\' && n > 0) n--;
+		bnchars = &fpath[n+1];
+
+		if (archive_path(pctx, arc, ard, resolver, entryp, NULL, fpath, namelen,
+		    bnchars, warn, ctr) == -1)
+			return (-1);
+	}
+	lane->typ = TYPE_UNKNOWN;
+	lane->pathlen = 0;
+	lane->datalen = 0;
+	return (0);
+}
+
+/*
+ * Park a small member on the lane for its type. Returns 1 if the member was
+ * taken by a lane, 0 if it has to be archived right away and -1 on error.
+ */
+static int
+lane_add(pc_ctx_t *pctx, struct archive *arc, struct archive *ard,
+    struct archive_entry_linkresolver *resolver, struct archive_entry **entryp,
+    struct arc_lane *lanes, int typ, const char *fpath, int fpathlen, int *warn,
+    uint32_t *ctr)
+{
+	struct arc_lane *lane;
+	uint64_t sz;
+	short namelen;
+	int i;
+
+	/*
+	 * Hardlinked members are left alone so that the link target is always
+	 * archived ahead of the links.
+	 */
+	sz = archive_entry_size(*entryp);
+	if (archive_entry_filetype(*entryp) != AE_IFREG || archive_entry_nlink(*entryp) > 1 ||
+	    sz == 0 || sz > pctx->chunksize / ARC_LANE_MEMBER_FRAC)
+		return (0);
+
+	lane = NULL;
+	for (i = 0; i < ARC_LANES; i++) {
+		if (lanes[i].typ == typ) {
+			lane = &lanes[i];
+			break;
+		}
+		if (lanes[i].typ == TYPE_UNKNOWN && lane == NULL)
+			lane = &lanes[i];
+	}
+	if (lane == NULL)
+		return (0);
+
+	if (lane->paths == NULL) {
+		lane->paths = (uchar_t *)malloc(ARC_LANE_PATHBUF);
+		if (lane->paths == NULL)
+			return (0);
+	}
+	archive_entry_clear(*entryp);
+
+	/*
+	 * Entries are stored the same way as in the pathlist file: a 2-byte
+	 * length followed by the pathname.
+	 */
+	if (lane->pathlen + sizeof (namelen) + fpathlen > ARC_LANE_PATHBUF) {
+		if (lane_flush(pctx, arc, ard, resolver, entryp, lane, warn, ctr) == -1)
+			return (-1);
+	}
+	lane->typ = typ;
+	namelen = fpathlen;
+	memcpy(lane->paths + lane->pathlen, &namelen, sizeof (namelen));
+	lane->pathlen += sizeof (namelen);
+	memcpy(lane->paths + lane->pathlen, fpath, fpathlen);
+	lane->pathlen += fpathlen;
+	lane->datalen += sz;
+
+	if (lane->datalen >= pctx->chunksize) {
+		if (lane_flush(pctx, arc, ard, resolver, entryp, lane, warn, ctr) == -1)
+			return (-1);
+	}
+	return (1);
+}
+
+/*
+ * Archive one pathname from the members list. If lanes is not NULL then small
+ * members with a known type are handed over to the lane for that type. Returns
+ * -1 if archiving has to be aborted.
+ */
+static int
+archive_path(pc_ctx_t *pctx, struct archive *arc, struct archive *ard,
+    struct archive_entry_linkresolver *resolver, struct archive_entry **entryp,
+    struct arc_lane *lanes, char *fpath, int fpathlen, char *bnchars, int *warn,
+    uint32_t *ctr)
+{
+	struct archive_entry *entry, *spare_entry, *ent;
+	char *name;
+	int typ, rv;
+
+	entry = *entryp;
+	archive_entry_copy_sourcepath(entry, fpath);
+	if (archive_read_disk_entry_from_file(ard, entry, -1, NULL) != ARCHIVE_OK) {
+		log_msg(LOG_WARN, 1, "archive_read_disk_entry_from_file:\n  %s",
+		    archive_error_string(ard));
+		archive_entry_clear(entry);
+		return (0);
+	}
+
+	typ = TYPE_UNKNOWN;
+	if (archive_entry_filetype(entry) == AE_IFREG) {
+		if ((typ = detect_type_by_ext(fpath, fpathlen)) != TYPE_UNKNOWN) {
+			if (lanes != NULL) {
+				rv = lane_add(pctx, arc, ard, resolver, entryp, lanes, typ,
+				    fpath, fpathlen, warn, ctr);
+				if (rv != 0)
+					return (rv == 1 ? 0 : -1);
+			}
+			pctx->ctype = typ;
+		}
+	}
+
+	/*
+	 * Strip leading '/' or '../' or '/../' from member name.
+	 */
+	name = fpath;
+	while (name[0] == '/' || name[0] == '\\') {
+		if (*warn) {
+			log_msg(LOG_WARN, 0, "Converting absolute paths.");
+			*warn = 0;
+		}
+		if (name[1] == '.' && name[2] == '.' && (name[3] == '/' || name[3] == '\\')) {
+			name += 3; /* /.. is removed here and / is removed next. */
+		} else {
+			name += 1;
+		}
+	}
+
+#ifndef	__APPLE__
+	/*
+	 * Workaround for libarchive weirdness on Non MAC OS X platforms. The files
+	 * with names matching pattern: ._* are MAC OS X resource forks which contain
+	 * extended attributes, ACLs etc. They should be handled accordingly on MAC
+	 * platforms and treated as normal files on others. For some reason beyond me
+	 * libarchive refuses to extract these files on Linux, no matter what I try.
+	 * Bug?
+	 * 
+	 * In this case the file basename is changed and a custom flag is set to
+	 * indicate extraction to change it back.
+	 */
+	if (bnchars[0] == '.' && bnchars[1] == '_' && archive_entry_filetype(entry) == AE_IFREG) {
+		char *pos = strstr(name, "._");
+		char name[] = "@.", value[] = "m";
+		if (pos) {
+			*pos = '|';
+			archive_entry_xattr_add_entry(entry, name, value, strlen(value));
+		}
+	}
+#endif
+
+	if (name != archive_entry_pathname(entry))
+		archive_entry_copy_pathname(entry, name);
+
+	if (archive_entry_filetype(entry) != AE_IFREG) {
+		archive_entry_set_size(entry, 0);
+	} else {
+		archive_entry_set_size(entry, archive_entry_size(entry));
+	}
+	log_msg(LOG_VERBOSE, 0, "%5d/%d %8" PRIu64 " %s", *ctr, pctx->archive_members_count,
+	    archive_entry_size(entry), name);
+
+	archive_entry_linkify(resolver, &entry, &spare_entry);
+	ent = entry;
+	while (ent != NULL) {
+		if (write_entry(pctx, arc, ent, typ) != 0) {
+			log_msg(LOG_WARN, 1, "Error archiving entry: %s\n%s",
+			    archive_entry_pathname(entry),
+			    archive_error_string(ard));
+			*entryp = entry;
+			return (-1);
+		}
+		ent = spare_entry;
+		spare_entry = NULL;
+	}
+	archive_write_finish_entry(arc);
+	archive_entry_clear(entry);
+	*entryp = entry;
+	(*ctr)++;
+	return (0);
+}
+
 /*
  * Thread function. Archive members and write to pipe. The dispatcher thread
  * reads from the other end and compresses.
@@ -1278,13 +1548,14 @@ write_entry(pc_ctx_t *pctx, struct archive *arc, struct archive_entry *entry, in
 static void *
 archiver_thread_func(void *dat) {
 	pc_ctx_t *pctx = (pc_ctx_t *)dat;
-	char fpath[PATH_MAX], *name, *bnchars = NULL; // Silence compiler
+	char fpath[PATH_MAX], *bnchars = NULL; // Silence compiler
 	int warn, rbytes, fpathlen = 0; // Silence compiler
 	uint32_t ctr;
-	struct archive_entry *entry, *spare_entry, *ent;
+	struct archive_entry *entry;
 	struct archive *arc, *ard;
 	struct archive_entry_linkresolver *resolver;
-	int readdisk_flags;
+	struct arc_lane *lanes;
+	int readdisk_flags, i;
 
 	warn = 1;
 	entry = archive_entry_new();
@@ -1296,6 +1567,14 @@ archiver_thread_func(void *dat) {
 		log_msg(LOG_WARN, 0, "Cannot create link resolver, hardlinks will be duplicated.");
 	}
 
+	/*
+	 * Lanes are only an optimization. Members are archived in list order
+	 * if sorting is disabled or lanes cannot be allocated.
+	 */
+	lanes = NULL;
+	if (pctx->enable_archive_sort)
+		lanes = (struct arc_lane *)calloc(ARC_LANES, sizeof (struct arc_lane));
+
 	ctr = 1;
 	readdisk_flags = ARCHIVE_READDISK_NO_TRAVERSE_MOUNTS;
 	readdisk_flags |= ARCHIVE_READDISK_HONOR_NODUMP;
@@ -1309,90 +1588,31 @@ archiver_thread_func(void *dat) {
 	 * Read next path entry from list file. read_next_path() also handles sorted reading.
 	 */
 	while ((rbytes = read_next_path(pctx, fpath, &bnchars, &fpathlen)) != 0) {
-		int typ;
-
 		if (rbytes == -1) break;
-		archive_entry_copy_sourcepath(entry, fpath);
-		if (archive_read_disk_entry_from_file(ard, entry, -1, NULL) != ARCHIVE_OK) {
-			log_msg(LOG_WARN, 1, "archive_read_disk_entry_from_file:\n  %s",
-			    archive_error_string(ard));
-			archive_entry_clear(entry);
-			continue;
-		}
-
-		typ = TYPE_UNKNOWN;
-		if (archive_entry_filetype(entry) == AE_IFREG) {
-			if ((typ = detect_type_by_ext(fpath, fpathlen)) != TYPE_UNKNOWN)
-				pctx->ctype = typ;
-		}
-
-		/*
-		 * Strip leading '/' or '../' or '/../' from member name.
-		 */
-		name = fpath;
-		while (name[0] == '/' || name[0] == '\\') {
-			if (warn) {
-				log_msg(LOG_WARN, 0, "Converting absolute paths.");
-				warn = 0;
-			}
-			if (name[1] == '.' && name[2] == '.' && (name[3] == '/' || name[3] == '\\')) {
-				name += 3; /* /.. is removed here and / is removed next. */
-			} else {
-				name += 1;
-			}
-		}
-
-#ifndef	__APPLE__
-		/*
-		 * Workaround for libarchive weirdness on Non MAC OS X platforms. The files
-		 * with names matching pattern: ._* are MAC OS X resource forks which contain
-		 * extended attributes, ACLs etc. They should be handled accordingly on MAC
-		 * platforms and treated as normal files on others. For some reason beyond me
-		 * libarchive refuses to extract these files on Linux, no matter what I try.
-		 * Bug?
-		 * 
-		 * In this case the file basename is changed and a custom flag is set to
-		 * indicate extraction to change it back.
-		 */
-		if (bnchars[0] == '.' && bnchars[1] == '_' && archive_entry_filetype(entry) == AE_IFREG) {
-			char *pos = strstr(name, "._");
-			char name[] = "@.", value[] = "m";
-			if (pos) {
-				*pos = '|';
-				archive_entry_xattr_add_entry(entry, name, value, strlen(value));
-			}
-		}
-#endif
-
-		if (name != archive_entry_pathname(entry))
-			archive_entry_copy_pathname(entry, name);
+		if (archive_path(pctx, arc, ard, resolver, &entry, lanes, fpath, fpathlen,
+		    bnchars, &warn, &ctr) == -1)
+			goto done;
+	}
 
-		if (archive_entry_filetype(entry) != AE_IFREG) {
-			archive_entry_set_size(entry, 0);
-		} else {
-			archive_entry_set_size(entry, archive_entry_size(entry));
-		}
-		log_msg(LOG_VERBOSE, 0, "%5d/%d %8" PRIu64 " %s", ctr, pctx->archive_members_count,
-		    archive_entry_size(entry), name);
-
-		archive_entry_linkify(resolver, &entry, &spare_entry);
-		ent = entry;
-		while (ent != NULL) {
-			if (write_entry(pctx, arc, ent, typ) != 0) {
-				log_msg(LOG_WARN, 1, "Error archiving entry: %s\n%s",
-				    archive_entry_pathname(entry),
-				    archive_error_string(ard));
+	/*
+	 * Archive whatever is still left in the lanes.
+	 */
+	if (lanes) {
+		for (i = 0; i < ARC_LANES; i++) {
+			if (lanes[i].pathlen == 0)
+				continue;
+			if (lane_flush(pctx, arc, ard, resolver, &entry, &lanes[i],
+			    &warn, &ctr) == -1)
 				goto done;
-			}
-			ent = spare_entry;
-			spare_entry = NULL;
 		}
-		archive_write_finish_entry(arc);
-		archive_entry_clear(entry);
-		ctr++;
 	}
 
 done:
+	if (lanes) {
+		for (i = 0; i < ARC_LANES; i++)
+			free(lanes[i].paths);
+		free(lanes);
+	}
 	if (pctx->temp_mmap_len > 0)
 		munmap(pctx->temp_mmap_buf, pctx->temp_mmap_len);
 	archive_entry_free(entry);
@@ -1795,6 +2015,7 @@ init_archive_mod() {
 			}
 
 			memset(typetab, 0, sizeof (typetab));
+			sniff_init();
 			inited = 1;
 		} else {
 			rv = 1;
@@ -1876,199 +2097,3 @@ detect_type_by_ext(const char *path, int pathlen)
 out:
 	return (TYPE_UNKNOWN);
 }
-
-#ifdef WORDS_BIGENDIAN
-/* 0x7fELF packed into 32-bit integer. */
-#	define	ELFINT (0x7f454c46U)
-
-/* TZif packed into 32-bit integer. */
-#	define	TZSINT	(0x545a6966U)
-
-/* PPMZ packed into 32-bit integer. */
-#	define	PPMINT	(0x50504d5aU)
-
-/* wvpk packed into 32-bit integer. */
-#	define	WVPK	(0x7776706b)
-
-/* TTA1 packed into 32-bit integer. */
-#	define	TTA1	(0x54544131)
-
-/* Magic for different MSDOS COM file types. */
-#	define COM_MAGIC	(0xcd21)
-#else
-/* 0x7fELF packed into 32-bit integer. */
-#	define	ELFINT (0x464c457fU)
-
-/* TZif packed into 32-bit integer. */
-#	define	TZINT	(0x66695a54U)
-
-/* PPMZ packed into 32-bit integer. */
-#	define	PPMINT	(0x5a4d5050U)
-
-/* wvpk packed into 32-bit integer. */
-#	define	WVPK	(0x6b707677)
-
-/* TTA1 packed into 32-bit integer. */
-#	define	TTA1	(0x31415454)
-
-/* Magic for different MSDOS COM file types. */
-#	define COM_MAGIC	(0x21cd)
-#endif
-
-/*
- * Detect a few file types from looking at magic signatures.
- */
-static int
-detect_type_by_data(uchar_t *buf, size_t len)
-{
-	uint16_t leval;
-
-	// At least a few bytes.
-	if (len < 10) return (TYPE_UNKNOWN);
-
-	// Mozilla file types
-	if (len > 15) {
-		if (memcmp(buf, "XPCOM\nMozFASL\r\n\x1A", 16) == 0)
-			return (TYPE_BINARY);
-		if (memcmp(buf, "XPCOM\nTypeLib\r\n\032", 16) == 0)
-			return (TYPE_BINARY);
-	}
-
-	// WAV files.
-	if (identify_wav_type(buf, len))
-		return (TYPE_BINARY|TYPE_WAV);
-
-	if (memcmp(buf, "!<arch>\n", 8) == 0)
-		return (TYPE_BINARY|TYPE_ARCHIVE_AR);
-	if (memcmp(&buf[257], "ustar\0", 6) == 0 || memcmp(&buf[257], "ustar\040\040\0", 8) == 0)
-		return (TYPE_BINARY|TYPE_ARCHIVE_TAR);
-	if (memcmp(buf, "%PDF-", 5) == 0)
-		return (TYPE_BINARY|TYPE_PDF);
-
-	// Try to detect DICOM medical image file. BSC compresses these better.
-	if (len > 127) {
-		int i;
-
-		// DICOM files should have either DICM or ISO_IR within the first 128 bytes
-		for (i = 0; i < 128-4; i++) {
-			if (buf[i] == 'D')
-				if (memcmp(&buf[i], "DICM", 4) == 0)
-					return (TYPE_BINARY|TYPE_DICOM);
-			if (buf[i] == 'I')
-				if (memcmp(&buf[i], "ISO_IR ", 7) == 0)
-					return (TYPE_BINARY|TYPE_DICOM);
-		}
-	}
-
-	// Jpegs
-	if (len > 9 && buf[0] == 0xFF && buf[1] == 0xD8) {
-		if (strncmp((char *)&buf[6], "Exif", 4) == 0 ||
-		    strncmp((char *)&buf[6], "JFIF", 4) == 0) {
-			return (TYPE_BINARY|TYPE_JPEG);
-		}
-	}
-
-	if (U32_P(buf) == ELFINT) {  // Regular ELF, check for 32/64-bit, core dump
-		if (*(buf + 16) != 4) {
-			if (*(buf + 4) == 2) {
-				return (TYPE_BINARY|TYPE_EXE64);
-			} else {
-				return (TYPE_BINARY|TYPE_EXE32);
-			}
-		} else {
-			return (TYPE_BINARY);
-		}
-	}
-
-	if (buf[1] == 'Z') {
-		 // Check for MSDOS/Windows Exe types
-		if (buf[0] == 'L') {
-			return (TYPE_BINARY|TYPE_EXE32);
-		} else if (buf[0] == 'M') {
-			// If relocation table is less than 0x40 bytes into file then
-			// it is a 32-bit MSDOS exe.
-			if (LE16(U16_P(buf + 0x18)) < 0x40) {
-				return (TYPE_BINARY|TYPE_EXE32);
-			} else {
-				uint32_t off = LE32(U32_P(buf + 0x3c));
-				// This is non-MSDOS, check whether PE
-				if (off < len - 100) {
-					if (buf[off] == 'P' && buf[off+1] == 'E' &&
-					    buf[off+2] == '\0' && buf[off+3] == '\0') {
-						uint16_t id;
-
-						// This is a PE executable.
-						// Check 32/64-bit.
-						off = LE32(U32_P(buf + 0x3c))+24;
-						id = LE16(U16_P(buf + off));
-						if (id == 0x010b || id == 0x020b) {
-							off = LE32(U32_P(buf + 0x3c))+4;
-							id = LE16(U16_P(buf + off));
-							if (id == 0x8664) {
-								return (TYPE_BINARY|TYPE_EXE64);
-							} else {
-								return (TYPE_BINARY|TYPE_EXE32_PE);
-							}
-						} else {
-							return (TYPE_BINARY);
-						}
-					} else {
-						return (TYPE_BINARY|TYPE_EXE32);
-					}
-				}
-			}
-		}
-	}
-
-	// BMP Files
-	if (buf[0] == 'B' && buf[1] == 'M') {
-		uint16_t typ = LE16(U16_P(buf + 14));
-		if (typ == 12 || typ == 64 || typ == 40 || typ == 128)
-			return (TYPE_BINARY|TYPE_BMP);
-	}
-
-	if (U32_P(buf) == TZINT)
-		return (TYPE_BINARY); // Timezone data
-	if (U32_P(buf) == PPMINT)
-		return (TYPE_BINARY|TYPE_COMPRESSED|TYPE_COMPRESSED_PPMD); // PPM Compressed archive
-	if (U32_P(buf) == WVPK || U32_P(buf) == TTA1)
-		return (TYPE_BINARY|TYPE_COMPRESSED|TYPE_AUDIO_COMPRESSED);
-
-	// PNM files
-	if (identify_pnm_type(buf, len)) {
-		return (TYPE_BINARY|TYPE_PNM);
-	}
-
-	// MSDOS COM types, two byte and one byte magic numbers are checked
-        // after all other multi-byte magic number checks.
-	if (buf[0] == 0xe9 || buf[0] == 0xeb) {
-		if (LE16(U16_P(buf + 0x1fe)) == 0xaa55)
-			return (TYPE_BINARY|TYPE_EXE32); // MSDOS COM
-		else
-			return (TYPE_BINARY);
-	}
-
-	// x86 Unix format object files (COFF)
-	leval = LE16(U16_P(buf));
-	if (leval == 0502 || leval == 0503 || leval == 0510 || leval == 0511 ||
-	    leval == 0512 || leval == 0514 || leval == 0522) {
-		return (TYPE_BINARY|TYPE_EXE32);
-	}
-
-	// AMD64 COFF
-	if (leval == 0x8664)
-		return (TYPE_BINARY|TYPE_EXE64);
-
-	// Intel BIOS ROM images
-	if (*buf == 0x55 && *(buf + 1) == 0xaa)
-		return (TYPE_BINARY|TYPE_EXE32);
-
-	if (U16_P(buf + 2) == COM_MAGIC || U16_P(buf + 4) == COM_MAGIC ||
-	    U16_P(buf + 4) == COM_MAGIC || U16_P(buf + 5) == COM_MAGIC ||
-	    U16_P(buf + 13) == COM_MAGIC || U16_P(buf + 18) == COM_MAGIC ||
-	    U16_P(buf + 23) == COM_MAGIC || U16_P(buf + 30) == COM_MAGIC ||
-	    U16_P(buf + 70) == COM_MAGIC) {
-			return (TYPE_BINARY|TYPE_EXE32); // MSDOS COM
-	}
-	return (TYPE_UNKNOWN);
-}
@@ -0,0 +1,414 @@
+/*
+ * This file is a part of Pcompress, a chunked parallel multi-
+ * algorithm lossless compression and decompression program.
+ *
+ * Copyright (C) 2012-2013 Moinak Ghosh. All rights reserved.
+ * Use is subject to license terms.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ * moinakg@belenix.org, http://moinakg.wordpress.com/
+ *
+ */
+
+/*
+ * File type detection from magic signatures. All signatures are compiled into
+ * per-offset lookup tables, indexed by the byte found at that offset, giving a
+ * bitmask of the signatures that can start with that byte. A buffer is thus
+ * classified with one lookup per distinct signature offset and only the few
+ * candidates left are compared in full, in priority order.
+ */
+#include <sys/types.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <utils.h>
+#include "pc_sniff.h"
+
+#define	SIG_EMBED	1	/* Distinctive enough to find embedded files. */
+#define	SIG_WINDOW	2	/* Floating signature, located by the check. */
+
+#define	SNIFF_MAX_ANCHORS	16
+#define	SNIFF_MIN_LEN		10
+
+typedef int (*sig_check_t)(const uchar_t *buf, size_t len, int type);
+
+struct sniff_sig {
+	uint16_t off;
+	uint8_t mlen;
+	uint8_t flags;
+	uint16_t minlen;
+	const char *magic;
+	int type;
+	sig_check_t check;
+};
+
+static int
+chk_wav(const uchar_t *buf, size_t len, int type)
+{
+	return (identify_wav_type((uchar_t *)buf, len) ? type : -1);
+}
+
+/*
+ * DICOM files should have either DICM or ISO_IR within the first 128 bytes.
+ * BSC compresses these better.
+ */
+static int
+chk_dicom(const uchar_t *buf, size_t len, int type)
+{
+	int i;
+
+	for (i = 0; i < 128-4; i++) {
+		if (buf[i] == 'D' && memcmp(&buf[i], "DICM", 4) == 0)
+			return (type);
+		if (buf[i] == 'I' && i + 7 <= len && memcmp(&buf[i], "ISO_IR ", 7) == 0)
+			return (type);
+	}
+	return (-1);
+}
+
+static int
+chk_jpeg(const uchar_t *buf, size_t len, int type)
+{
+	if (memcmp(&buf[6], "Exif", 4) == 0 || memcmp(&buf[6], "JFIF", 4) == 0)
+		return (type);
+	return (-1);
+}
+
+/*
+ * Regular ELF, check for 32/64-bit, core dump.
+ */
+static int
+chk_elf(const uchar_t *buf, size_t len, int type)
+{
+	if (buf[16] == 4)
+		return (TYPE_BINARY);
+	if (buf[4] == 2)
+		return (TYPE_BINARY|TYPE_EXE64);
+	return (TYPE_BINARY|TYPE_EXE32);
+}
+
+/*
+ * MSDOS/Windows Exe types.
+ */
+static int
+chk_mz(const uchar_t *buf, size_t len, int type)
+{
+	uint32_t off;
+	uint16_t id;
+
+	// If relocation table is less than 0x40 bytes into file then
+	// it is a 32-bit MSDOS exe.
+	if (LE16(U16_P(buf + 0x18)) < 0x40)
+		return (TYPE_BINARY|TYPE_EXE32);
+
+	// This is non-MSDOS, check whether PE
+	off = LE32(U32_P(buf + 0x3c));
+	if (len < 100 || off >= len - 100)
+		return (-1);
+	if (buf[off] != 'P' || buf[off+1] != 'E' || buf[off+2] != '\0' || buf[off+3] != '\0')
+		return (TYPE_BINARY|TYPE_EXE32);
+
+	// This is a PE executable. Check 32/64-bit.
+	id = LE16(U16_P(buf + off + 24));
+	if (id != 0x010b && id != 0x020b)
+		return (TYPE_BINARY);
+	id = LE16(U16_P(buf + off + 4));
+	if (id == 0x8664)
+		return (TYPE_BINARY|TYPE_EXE64);
+	return (TYPE_BINARY|TYPE_EXE32_PE);
+}
+
+static int
+chk_bmp(const uchar_t *buf, size_t len, int type)
+{
+	uint16_t typ = LE16(U16_P(buf + 14));
+
+	if (typ == 12 || typ == 64 || typ == 40 || typ == 128)
+		return (type);
+	return (-1);
+}
+
+#ifndef _MPLV2_LICENSE_
+static int
+chk_pnm(const uchar_t *buf, size_t len, int type)
+{
+	return (identify_pnm_type((uchar_t *)buf, len) ? type : -1);
+}
+#endif
+
+static int
+chk_bzip2(const uchar_t *buf, size_t len, int type)
+{
+	if (buf[3] >= '1' && buf[3] <= '9' && memcmp(&buf[4], "1AY&SY", 6) == 0)
+		return (type);
+	return (-1);
+}
+
+/*
+ * MSDOS COM with a boot sector signature, otherwise just binary.
+ */
+static int
+chk_com(const uchar_t *buf, size_t len, int type)
+{
+	if (len >= 0x200 && LE16(U16_P(buf + 0x1fe)) == 0xaa55)
+		return (TYPE_BINARY|TYPE_EXE32);
+	return (TYPE_BINARY);
+}
+
+#define	SIG(o, m, f, t, c)	{ o, sizeof (m) - 1, f, 0, m, t, c }
+#define	SIGL(o, m, l, f, t, c)	{ o, sizeof (m) - 1, f, l, m, t, c }
+
+/*
+ * Signatures in order of priority. The first one that matches and whose check,
+ * if any, accepts the buffer gives the type. MSDOS COM types, two byte and one
+ * byte magic numbers are checked after all other multi-byte magic numbers.
+ */
+static struct sniff_sig sigtab[] = {
+	// Mozilla file types
+	SIG(0, "XPCOM\nMozFASL\r\n\x1A", SIG_EMBED, TYPE_BINARY, NULL),
+	SIG(0, "XPCOM\nTypeLib\r\n\032", SIG_EMBED, TYPE_BINARY, NULL),
+	SIG(0, "RIFF", SIG_EMBED, TYPE_BINARY|TYPE_WAV, chk_wav),
+	SIG(0, "!<arch>\n", SIG_EMBED, TYPE_BINARY|TYPE_ARCHIVE_AR, NULL),
+	SIG(257, "ustar\0", SIG_EMBED, TYPE_BINARY|TYPE_ARCHIVE_TAR, NULL),
+	SIG(257, "ustar\040\040\0", SIG_EMBED, TYPE_BINARY|TYPE_ARCHIVE_TAR, NULL),
+	SIG(0, "%PDF-", SIG_EMBED, TYPE_BINARY|TYPE_PDF, NULL),
+	SIGL(0, "", 128, SIG_WINDOW, TYPE_BINARY|TYPE_DICOM, chk_dicom),
+	SIGL(0, "\xFF\xD8", 10, SIG_EMBED, TYPE_BINARY|TYPE_JPEG, chk_jpeg),
+	SIGL(0, "\x7f" "ELF", 17, SIG_EMBED, 0, chk_elf),
+	SIG(0, "LZ", 0, TYPE_BINARY|TYPE_EXE32, NULL),
+	SIGL(0, "MZ", 0x40, 0, 0, chk_mz),
+	SIGL(0, "BM", 16, 0, TYPE_BINARY|TYPE_BMP, chk_bmp),
+	SIG(0, "TZif", SIG_EMBED, TYPE_BINARY, NULL),
+	SIG(0, "PPMZ", SIG_EMBED, TYPE_BINARY|TYPE_COMPRESSED|TYPE_COMPRESSED_PPMD, NULL),
+	SIG(0, "wvpk", SIG_EMBED, TYPE_BINARY|TYPE_COMPRESSED|TYPE_AUDIO_COMPRESSED, NULL),
+	SIG(0, "TTA1", SIG_EMBED, TYPE_BINARY|TYPE_COMPRESSED|TYPE_AUDIO_COMPRESSED, NULL),
+#ifndef _MPLV2_LICENSE_
+	// PNM files
+	SIG(0, "P", 0, TYPE_BINARY|TYPE_PNM, chk_pnm),
+	SIG(0, "S", 0, TYPE_BINARY|TYPE_PNM, chk_pnm),
+	SIG(0, "B", 0, TYPE_BINARY|TYPE_PNM, chk_pnm),
+#endif
+	// Compressed data and media containers
+	SIG(0, "\x1f\x8b\x08", SIG_EMBED, TYPE_BINARY|TYPE_COMPRESSED|TYPE_COMPRESSED_GZ, NULL),
+	SIG(0, "\x89PNG\r\n\x1a\n", SIG_EMBED, TYPE_BINARY|TYPE_COMPRESSED|TYPE_COMPRESSED_GZ, NULL),
+	SIGL(0, "BZh", 10, SIG_EMBED, TYPE_BINARY|TYPE_COMPRESSED|TYPE_COMPRESSED_BZ2, chk_bzip2),
+	SIG(0, "\xfd" "7zXZ\0", SIG_EMBED, TYPE_BINARY|TYPE_COMPRESSED|TYPE_COMPRESSED_LZMA, NULL),
+	SIG(0, "7z\xbc\xaf\x27\x1c", SIG_EMBED, TYPE_BINARY|TYPE_COMPRESSED|TYPE_COMPRESSED_LZMA, NULL),
+	SIG(0, "PK\003\004", SIG_EMBED, TYPE_BINARY|TYPE_COMPRESSED|TYPE_COMPRESSED_ZIP, NULL),
+	SIG(0, "Rar!\x1a\x07", SIG_EMBED, TYPE_BINARY|TYPE_COMPRESSED|TYPE_COMPRESSED_RAR, NULL),
+	SIG(0, "\x28\xb5\x2f\xfd", SIG_EMBED, TYPE_BINARY|TYPE_COMPRESSED, NULL),
+	SIG(0, "GIF87a", SIG_EMBED, TYPE_BINARY|TYPE_COMPRESSED|TYPE_COMPRESSED_LZW, NULL),
+	SIG(0, "GIF89a", SIG_EMBED, TYPE_BINARY|TYPE_COMPRESSED|TYPE_COMPRESSED_LZW, NULL),
+	SIG(0, "OggS\0", SIG_EMBED, TYPE_BINARY|TYPE_COMPRESSED, NULL),
+	SIG(0, "fLaC", SIG_EMBED, TYPE_BINARY|TYPE_FLAC, NULL),
+	SIG(4, "ftyp", SIG_EMBED, TYPE_BINARY|TYPE_COMPRESSED|TYPE_MP4, NULL),
+	// MSDOS COM
+	SIG(0, "\xe9", 0, 0, chk_com),
+	SIG(0, "\xeb", 0, 0, chk_com),
+	// x86 Unix format object files (COFF)
+	SIG(0, "\x42\x01", 0, TYPE_BINARY|TYPE_EXE32, NULL),
+	SIG(0, "\x43\x01", 0, TYPE_BINARY|TYPE_EXE32, NULL),
+	SIG(0, "\x48\x01", 0, TYPE_BINARY|TYPE_EXE32, NULL),
+	SIG(0, "\x49\x01", 0, TYPE_BINARY|TYPE_EXE32, NULL),
+	SIG(0, "\x4a\x01", 0, TYPE_BINARY|TYPE_EXE32, NULL),
+	SIG(0, "\x4c\x01", 0, TYPE_BINARY|TYPE_EXE32, NULL),
+	SIG(0, "\x52\x01", 0, TYPE_BINARY|TYPE_EXE32, NULL),
+	// AMD64 COFF
+	SIG(0, "\x64\x86", 0, TYPE_BINARY|TYPE_EXE64, NULL),
+	// Intel BIOS ROM images
+	SIG(0, "\x55\xaa", 0, TYPE_BINARY|TYPE_EXE32, NULL),
+	// MSDOS COM
+	SIG(2, "\xcd\x21", 0, TYPE_BINARY|TYPE_EXE32, NULL),
+	SIG(4, "\xcd\x21", 0, TYPE_BINARY|TYPE_EXE32, NULL),
+	SIG(5, "\xcd\x21", 0, TYPE_BINARY|TYPE_EXE32, NULL),
+	SIG(13, "\xcd\x21", 0, TYPE_BINARY|TYPE_EXE32, NULL),
+	SIG(18, "\xcd\x21", 0, TYPE_BINARY|TYPE_EXE32, NULL),
+	SIG(23, "\xcd\x21", 0, TYPE_BINARY|TYPE_EXE32, NULL),
+	SIG(30, "\xcd\x21", 0, TYPE_BINARY|TYPE_EXE32, NULL),
+	SIG(70, "\xcd\x21", 0, TYPE_BINARY|TYPE_EXE32, NULL)
+};
+
+#define	NUM_SIGS	(sizeof (sigtab) / sizeof (struct sniff_sig))
+
+static uint64_t anchor_tab[SNIFF_MAX_ANCHORS][256];
+static size_t anchor_off[SNIFF_MAX_ANCHORS];
+static int num_anchors = 0;
+static uint64_t window_mask = 0, embed_mask = 0;
+
+/*
+ * Compile the signature table into the per-offset candidate tables. Called
+ * once during archive module initialization.
+ */
+void
+sniff_init(void)
+{
+	int i, a;
+
+	if (NUM_SIGS > 64) {
+		log_msg(LOG_ERR, 0, "Too many type signatures.");
+		abort();
+	}
+	memset(anchor_tab, 0, sizeof (anchor_tab));
+	num_anchors = 0;
+	window_mask = 0;
+	embed_mask = 0;
+	for (i = 0; i < NUM_SIGS; i++) {
+		struct sniff_sig *s = &sigtab[i];
+
+		if (s->minlen < s->off + s->mlen)
+			s->minlen = s->off + s->mlen;
+		if (s->flags & SIG_EMBED)
+			embed_mask |= (1ULL << i);
+		if (s->flags & SIG_WINDOW) {
+			window_mask |= (1ULL << i);
+			continue;
+		}
+		for (a = 0; a < num_anchors && anchor_off[a] != s->off; a++);
+		if (a == num_anchors) {
+			if (num_anchors == SNIFF_MAX_ANCHORS) {
+				log_msg(LOG_ERR, 0, "Too many type signature offsets.");
+				abort();
+			}
+			anchor_off[num_anchors++] = s->off;
+		}
+		anchor_tab[a][(uchar_t)s->magic[0]] |= (1ULL << i);
+	}
+}
+
+static int
+sniff_match(const uchar_t *buf, size_t len, uint64_t cand)
+{
+	int i, t;
+
+	while (cand) {
+		struct sniff_sig *s;
+
+		i = __builtin_ctzll(cand);
+		cand &= cand - 1;
+		s = &sigtab[i];
+		if (len < s->minlen || memcmp(buf + s->off, s->magic, s->mlen) != 0)
+			continue;
+		t = s->check ? s->check(buf, len, s->type) : s->type;
+		if (t != -1)
+			return (t);
+	}
+	return (TYPE_UNKNOWN);
+}
+
+static inline uint64_t
+sniff_candidates(const uchar_t *buf, size_t len)
+{
+	uint64_t cand;
+	int a;
+
+	cand = window_mask;
+	for (a = 0; a < num_anchors; a++) {
+		if (anchor_off[a] < len)
+			cand |= anchor_tab[a][buf[anchor_off[a]]];
+	}
+	return (cand);
+}
+
+/*
+ * Detect the type of a file from the signature at its start.
+ */
+int
+sniff_type(const uchar_t *buf, size_t len)
+{
+	// At least a few bytes.
+	if (len < SNIFF_MIN_LEN)
+		return (TYPE_UNKNOWN);
+	return (sniff_match(buf, len, sniff_candidates(buf, len)));
+}
+
+/*
+ * Detect a file embedded at the given position within a container using only
+ * the signatures that are unlikely to occur by chance in other data.
+ */
+int
+sniff_embedded(const uchar_t *buf, size_t len)
+{
+	if (len < SNIFF_MIN_LEN)
+		return (TYPE_UNKNOWN);
+	return (sniff_match(buf, len, sniff_candidates(buf, len) & embed_mask));
+}
+
+/*
+ * Container formats whose contents are worth scanning for embedded files.
+ * Files with no recognized type are included as these are commonly disk and
+ * VM images.
+ */
+int
+sniff_is_container(int type)
+{
+	return (type == TYPE_UNKNOWN || type == TYPE_BINARY ||
+	    type == (TYPE_BINARY|TYPE_ARCHIVE_TAR));
+}
+
+void
+sniff_state_init(sniff_state_t *st, int base)
+{
+	st->base = base;
+	st->cur = base;
+	st->left = 0;
+}
+
+/*
+ * Find the leading run of data in buf that has a single type. The buffer must
+ * start at a SNIFF_ALIGN boundary within the container. Returns the type and
+ * sets runlen to the length of the run. The state carries the current type
+ * over to the next call.
+ */
+int
+sniff_next_run(sniff_state_t *st, const uchar_t *buf, size_t len, size_t *runlen)
+{
+	size_t p;
+	int cur, t;
+
+	cur = st->cur;
+	for (p = 0; p < len; p += SNIFF_ALIGN) {
+		t = sniff_embedded(buf + p, len - p);
+		if (t == (TYPE_BINARY|TYPE_ARCHIVE_TAR)) {
+			/*
+			 * A tar member header takes the type of the member data
+			 * following it, to avoid a tiny run for the header itself.
+			 */
+			t = st->base;
+			if (p + SNIFF_ALIGN < len) {
+				int t1 = sniff_embedded(buf + p + SNIFF_ALIGN,
+				    len - p - SNIFF_ALIGN);
+				if (t1 != TYPE_UNKNOWN && t1 != (TYPE_BINARY|TYPE_ARCHIVE_TAR))
+					t = t1;
+			}
+		} else if (t == TYPE_UNKNOWN) {
+			if (cur == st->base || p < st->left)
+				continue;
+			t = st->base;
+		}
+		if (t != cur) {
+			if (p > 0)
+				break;
+			cur = t;
+		}
+		st->left = (cur == st->base ? 0 : p + SNIFF_EMBED_SPAN);
+	}
+	if (p > len)
+		p = len;
+	*runlen = p;
+	st->cur = cur;
+	st->left = (st->left > p ? st->left - p : 0);
+	return (cur);
+}
@@ -0,0 +1,65 @@
+/*
+ * This file is a part of Pcompress, a chunked parallel multi-
+ * algorithm lossless compression and decompression program.
+ *
+ * Copyright (C) 2012-2013 Moinak Ghosh. All rights reserved.
+ * Use is subject to license terms.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ * moinakg@belenix.org, http://moinakg.wordpress.com/
+ *
+ */
+
+#ifndef	_PC_SNIFF_H
+#define	_PC_SNIFF_H
+
+#include <utils.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * Embedded content inside container files (tar, disk and VM images) is looked
+ * for at every SNIFF_ALIGN boundary. A type found this way is kept for at most
+ * SNIFF_EMBED_SPAN bytes unless another signature is seen.
+ */
+#define	SNIFF_ALIGN		512
+#define	SNIFF_EMBED_SPAN	(8 * 1024 * 1024)
+
+/*
+ * Minimum size of a file for it to be scanned for embedded content.
+ */
+#define	SNIFF_CONTAINER_MIN	(4 * 1024 * 1024)
+
+typedef struct {
+	int base;
+	int cur;
+	uint64_t left;
+} sniff_state_t;
+
+void sniff_init(void);
+int sniff_type(const uchar_t *buf, size_t len);
+int sniff_embedded(const uchar_t *buf, size_t len);
+int sniff_is_container(int type);
+void sniff_state_init(sniff_state_t *st, int base);
+int sniff_next_run(sniff_state_t *st, const uchar_t *buf, size_t len, size_t *runlen);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,118 @@
+/*
+ * This file is a part of Pcompress, a chunked parallel multi-
+ * algorithm lossless compression and decompression program.
+ *
+ * Copyright (C) 2012-2013 Moinak Ghosh. All rights reserved.
+ * Use is subject to license terms.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ * moinakg@belenix.org, http://moinakg.wordpress.com/
+ *      
+ */
+
+/*
+ * Pipelined AES-CTR using AES-NI. Eight counter blocks are encrypted per
+ * iteration with the AESENC instructions of the independent blocks
+ * interleaved to hide the instruction latency. The counter block layout
+ * is the same as crypto_aesctr_stream(): 64-bit big-endian nonce followed by
+ * a 64-bit big-endian block counter, so the output is identical to the
+ * generic CTR implementation. The block counter starts at ctr0.
+ *
+ * The key must have been expanded by aesni_set_encrypt_key() which stores
+ * the round count minus one in key->rounds.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <wmmintrin.h>
+#include <tmmintrin.h>
+#include <openssl/aes.h>
+#include "crypto_aes.h"
+
+#define	CTR_PAR	8
+
+void
+aesni_ctr_xor(const AES_KEY *key, uint64_t nonce, uint64_t ctr0, const uchar_t *in,
+	      uchar_t *out, uint64_t len)
+{
+	__m128i rk[15], ctr, one, bswap, blk[CTR_PAR];
+	const __m128i *kp;
+	uint64_t pos;
+	int i, j, nr;
+
+	nr = key->rounds + 1;
+	kp = (const __m128i *)(key->rd_key);
+	for (i = 0; i <= nr; i++)
+		rk[i] = _mm_loadu_si128(kp + i);
+
+	/*
+	 * The counter is kept as a little-endian {counter, nonce} pair and
+	 * byte-reversed into the big-endian {nonce, counter} block on use.
+	 */
+	bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	ctr = _mm_set_epi64x((int64_t)nonce, (int64_t)ctr0);
+	one = _mm_set_epi64x(0, 1);
+
+	pos = 0;
+	for (; pos + CTR_PAR * 16 <= len; pos += CTR_PAR * 16) {
+		for (j = 0; j < CTR_PAR; j++) {
+			blk[j] = _mm_xor_si128(_mm_shuffle_epi8(ctr, bswap), rk[0]);
+			ctr = _mm_add_epi64(ctr, one);
+		}
+		for (i = 1; i < nr; i++) {
+			for (j = 0; j < CTR_PAR; j++)
+				blk[j] = _mm_aesenc_si128(blk[j], rk[i]);
+		}
+		for (j = 0; j < CTR_PAR; j++) {
+			blk[j] = _mm_aesenclast_si128(blk[j], rk[nr]);
+			blk[j] = _mm_xor_si128(blk[j],
+			    _mm_loadu_si128((const __m128i *)(in + pos + j * 16)));
+			_mm_storeu_si128((__m128i *)(out + pos + j * 16), blk[j]);
+		}
+	}
+
+	/*
+	 * Remaining blocks one at a time. A trailing partial block is handled
+	 * via a scratch buffer.
+	 */
+	for (; pos < len; pos += 16) {
+		__m128i b;
+
+		b = _mm_xor_si128(_mm_shuffle_epi8(ctr, bswap), rk[0]);
+		ctr = _mm_add_epi64(ctr, one);
+		for (i = 1; i < nr; i++)
+			b = _mm_aesenc_si128(b, rk[i]);
+		b = _mm_aesenclast_si128(b, rk[nr]);
+		if (len - pos >= 16) {
+			b = _mm_xor_si128(b, _mm_loadu_si128((const __m128i *)(in + pos)));
+			_mm_storeu_si128((__m128i *)(out + pos), b);
+		} else {
+			uchar_t tmp[16];
+
+			memcpy(tmp, in + pos, len - pos);
+			b = _mm_xor_si128(b, _mm_loadu_si128((const __m128i *)tmp));
+			_mm_storeu_si128((__m128i *)tmp, b);
+			memcpy(out + pos, tmp, len - pos);
+			memset(tmp, 0, 16);
+		}
+	}
+
+	/*
+	 * Nullify key material held in registers/stack.
+	 */
+	memset(rk, 0, sizeof (rk));
+}
@@ -0,0 +1,87 @@
+/*
+ * This file is a part of Pcompress, a chunked parallel multi-
+ * algorithm lossless compression and decompression program.
+ *
+ * Copyright (C) 2012-2013 Moinak Ghosh. All rights reserved.
+ * Use is subject to license terms.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ * moinakg@belenix.org, http://moinakg.wordpress.com/
+ *      
+ */
+
+/*
+ * AES-CTR using the VAES instructions on 256-bit vectors. Each vector holds
+ * two counter blocks and eight vectors are processed per iteration, giving
+ * 16 blocks in flight. Output is identical to aesni_ctr_xor() which is also
+ * used to handle the tail. The block counter starts at ctr0.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <immintrin.h>
+#include <openssl/aes.h>
+#include "crypto_aes.h"
+
+#define	CTR_PAR	8
+
+void
+vaes_ctr_xor(const AES_KEY *key, uint64_t nonce, uint64_t ctr0, const uchar_t *in,
+	     uchar_t *out, uint64_t len)
+{
+	__m256i rk[15], ctr, two, bswap, blk[CTR_PAR];
+	const __m128i *kp;
+	uint64_t pos;
+	int i, j, nr;
+
+	nr = key->rounds + 1;
+	kp = (const __m128i *)(key->rd_key);
+	for (i = 0; i <= nr; i++)
+		rk[i] = _mm256_broadcastsi128_si256(_mm_loadu_si128(kp + i));
+
+	/*
+	 * Little-endian {counter, nonce} pairs for blocks n and n+1, byte-reversed
+	 * per 128-bit lane into big-endian {nonce, counter} blocks on use.
+	 */
+	bswap = _mm256_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+	    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	ctr = _mm256_set_epi64x((int64_t)nonce, (int64_t)(ctr0 + 1), (int64_t)nonce,
+	    (int64_t)ctr0);
+	two = _mm256_set_epi64x(0, 2, 0, 2);
+
+	pos = 0;
+	for (; pos + CTR_PAR * 32 <= len; pos += CTR_PAR * 32) {
+		for (j = 0; j < CTR_PAR; j++) {
+			blk[j] = _mm256_xor_si256(_mm256_shuffle_epi8(ctr, bswap), rk[0]);
+			ctr = _mm256_add_epi64(ctr, two);
+		}
+		for (i = 1; i < nr; i++) {
+			for (j = 0; j < CTR_PAR; j++)
+				blk[j] = _mm256_aesenc_epi128(blk[j], rk[i]);
+		}
+		for (j = 0; j < CTR_PAR; j++) {
+			blk[j] = _mm256_aesenclast_epi128(blk[j], rk[nr]);
+			blk[j] = _mm256_xor_si256(blk[j],
+			    _mm256_loadu_si256((const __m256i *)(in + pos + j * 32)));
+			_mm256_storeu_si256((__m256i *)(out + pos + j * 32), blk[j]);
+		}
+	}
+	memset(rk, 0, sizeof (rk));
+
+	if (pos < len)
+		aesni_ctr_xor(key, nonce, ctr0 + pos / 16, in + pos, out + pos, len - pos);
+}
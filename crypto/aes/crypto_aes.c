@@ -77,16 +77,27 @@ extern void aesni_encrypt(const unsigned char *in, unsigned char *out, const AES
 setkey_func_ptr enc_setkey;
 encrypt_func_ptr enc_encrypt;
 
+/*
+ * Optimized CTR mode kernel if available. When set, whole chunks are encrypted
+ * in place without allocating a crypto_aesctr stream.
+ */
+static ctr_xor_func_ptr enc_ctr_xor;
+
 void
 aes_module_init(processor_cap_t *pc)
 {
 	enc_setkey = AES_set_encrypt_key;
 	enc_encrypt = AES_encrypt;
+	enc_ctr_xor = NULL;
 
 	if (pc->proc_type == PROC_X64_INTEL || pc->proc_type == PROC_X64_AMD) {
 		if (pc->aes_avail) {
 			enc_setkey = aesni_set_encrypt_key;
 			enc_encrypt = aesni_encrypt;
+			if (pc->vaes_avail)
+				enc_ctr_xor = vaes_ctr_xor;
+			else
+				enc_ctr_xor = aesni_ctr_xor;
 
 		} else if (pc->sse_level >= 3 && pc->sse_sub_level >= 1) {
 			enc_setkey = vpaes_set_encrypt_key;
@@ -169,6 +180,11 @@ aes_encrypt(aes_ctx_t *ctx, uchar_t *plaintext, uchar_t *ciphertext, uint64_t le
 	struct crypto_aesctr *strm;
 	int i;
 
+	if (enc_ctr_xor) {
+		enc_ctr_xor(&(ctx->key), ctx->nonce + id, 0, plaintext, ciphertext, len);
+		return (0);
+	}
+
 	k1 = (uchar_t *)&(ctx->key);
 	k2 = (uchar_t *)&key;
 	for (i=0; i<sizeof (key); i++)
@@ -196,6 +212,11 @@ aes_decrypt(aes_ctx_t *ctx, uchar_t *ciphertext, uchar_t *plaintext, uint64_t le
 	struct crypto_aesctr *strm;
 	int i;
 
+	if (enc_ctr_xor) {
+		enc_ctr_xor(&(ctx->key), ctx->nonce + id, 0, ciphertext, plaintext, len);
+		return (0);
+	}
+
 	k1 = (uchar_t *)&(ctx->key);
 	k2 = (uchar_t *)&key;
 	for (i=0; i<sizeof (key); i++)
@@ -216,6 +237,31 @@ aes_decrypt(aes_ctx_t *ctx, uchar_t *ciphertext, uchar_t *plaintext, uint64_t le
 	return (0);
 }
 
+/*
+ * Indicate whether the CTR keystream can be started at an arbitrary block
+ * offset within a chunk. This allows a chunk to be processed in pieces.
+ */
+int
+aes_ctr_seekable(void)
+{
+	return (enc_ctr_xor != NULL);
+}
+
+/*
+ * Encrypt or decrypt (the same operation in CTR mode) len bytes that lie at
+ * the given byte offset within chunk id. Offset must be a multiple of the
+ * AES block size.
+ */
+int
+aes_ctr_at(aes_ctx_t *ctx, uchar_t *from, uchar_t *to, uint64_t len, uint64_t id,
+	   uint64_t offset)
+{
+	if (enc_ctr_xor == NULL || (offset & (AES_BLOCK_SIZE - 1)) != 0)
+		return (-1);
+	enc_ctr_xor(&(ctx->key), ctx->nonce + id, offset / AES_BLOCK_SIZE, from, to, len);
+	return (0);
+}
+
 uchar_t *
 aes_nonce(aes_ctx_t *ctx)
 {
@@ -49,11 +49,19 @@ int aes_init(aes_ctx_t *ctx, uchar_t *salt, int saltlen, uchar_t *pwd, int pwd_l
 	     uint64_t nonce, int enc);
 int aes_encrypt(aes_ctx_t *ctx, uchar_t *plaintext, uchar_t *ciphertext, uint64_t len, uint64_t id);
 int aes_decrypt(aes_ctx_t *ctx, uchar_t *ciphertext, uchar_t *plaintext, uint64_t len, uint64_t id);
+int aes_ctr_seekable(void);
+int aes_ctr_at(aes_ctx_t *ctx, uchar_t *from, uchar_t *to, uint64_t len, uint64_t id,
+	       uint64_t offset);
 uchar_t *aes_nonce(aes_ctx_t *ctx);
 void aes_clean_pkey(aes_ctx_t *ctx);
 void aes_cleanup(aes_ctx_t *ctx);
 void aes_module_init(processor_cap_t *pc);
 
+void aesni_ctr_xor(const AES_KEY *key, uint64_t nonce, uint64_t ctr0, const uchar_t *in,
+		   uchar_t *out, uint64_t len);
+void vaes_ctr_xor(const AES_KEY *key, uint64_t nonce, uint64_t ctr0, const uchar_t *in,
+		  uchar_t *out, uint64_t len);
+
 #ifdef	__cplusplus
 }
 #endif
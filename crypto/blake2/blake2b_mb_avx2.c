@@ -0,0 +1,268 @@
+/*
+ * This file is a part of Pcompress, a chunked parallel multi-
+ * algorithm lossless compression and decompression program.
+ *
+ * Copyright (C) 2012-2013 Moinak Ghosh. All rights reserved.
+ * Use is subject to license terms.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ * moinakg@belenix.org, http://moinakg.wordpress.com/
+ *      
+ */
+
+/*
+ * Multi-buffer BLAKE2b using AVX2. Four independent messages are hashed in
+ * parallel, one message per 64-bit lane of the 256-bit vectors. This is meant
+ * for fingerprinting a large number of small buffers such as Dedupe blocks
+ * where the single-stream SIMD implementations leave most vector lanes idle.
+ *
+ * Lanes are refilled from the job list as soon as a message completes, so
+ * messages of differing lengths keep all lanes busy till the job list runs out.
+ * The digests produced are identical to the sequential unkeyed blake2b().
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <immintrin.h>
+#include "blake2.h"
+
+#define	MB_LANES	4
+
+static const uint64_t blake2b_mb_IV[8] =
+{
+	0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL,
+	0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+	0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+	0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+};
+
+static const uint8_t blake2b_mb_sigma[12][16] =
+{
+	{  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 } ,
+	{ 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 } ,
+	{ 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 } ,
+	{  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 } ,
+	{  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 } ,
+	{  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 } ,
+	{ 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 } ,
+	{ 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 } ,
+	{  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 } ,
+	{ 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13 , 0 } ,
+	{  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 } ,
+	{ 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 }
+};
+
+#define	ROTR32(x)	_mm256_shuffle_epi32((x), _MM_SHUFFLE(2, 3, 0, 1))
+#define	ROTR24(x)	_mm256_shuffle_epi8((x), r24)
+#define	ROTR16(x)	_mm256_shuffle_epi8((x), r16)
+#define	ROTR63(x)	_mm256_xor_si256(_mm256_srli_epi64((x), 63), _mm256_add_epi64((x), (x)))
+
+#define	G(a, b, c, d, x, y) \
+	do { \
+		a = _mm256_add_epi64(_mm256_add_epi64(a, b), x); \
+		d = ROTR32(_mm256_xor_si256(d, a)); \
+		c = _mm256_add_epi64(c, d); \
+		b = ROTR24(_mm256_xor_si256(b, c)); \
+		a = _mm256_add_epi64(_mm256_add_epi64(a, b), y); \
+		d = ROTR16(_mm256_xor_si256(d, a)); \
+		c = _mm256_add_epi64(c, d); \
+		b = ROTR63(_mm256_xor_si256(b, c)); \
+	} while (0)
+
+/*
+ * Load 16 message words from each of the 4 lane blocks and transpose them so
+ * that m[i] holds word i of every lane.
+ */
+static inline void
+mb_load_msg(__m256i *m, const uint8_t **blk)
+{
+	__m256i a, b, c, d, t0, t1, t2, t3;
+	int g;
+
+	for (g = 0; g < 4; g++) {
+		a = _mm256_loadu_si256((const __m256i *)(blk[0] + g * 32));
+		b = _mm256_loadu_si256((const __m256i *)(blk[1] + g * 32));
+		c = _mm256_loadu_si256((const __m256i *)(blk[2] + g * 32));
+		d = _mm256_loadu_si256((const __m256i *)(blk[3] + g * 32));
+		t0 = _mm256_unpacklo_epi64(a, b);
+		t1 = _mm256_unpackhi_epi64(a, b);
+		t2 = _mm256_unpacklo_epi64(c, d);
+		t3 = _mm256_unpackhi_epi64(c, d);
+		m[g * 4 + 0] = _mm256_permute2x128_si256(t0, t2, 0x20);
+		m[g * 4 + 1] = _mm256_permute2x128_si256(t1, t3, 0x20);
+		m[g * 4 + 2] = _mm256_permute2x128_si256(t0, t2, 0x31);
+		m[g * 4 + 3] = _mm256_permute2x128_si256(t1, t3, 0x31);
+	}
+}
+
+static void
+mb_compress(uint64_t H[8][MB_LANES], const uint8_t **blk, const uint64_t *T, const uint64_t *F)
+{
+	__m256i m[16], v[16], h[8];
+	__m256i r24, r16;
+	int i, r;
+
+	r24 = _mm256_setr_epi8(3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10,
+	    3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10);
+	r16 = _mm256_setr_epi8(2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9,
+	    2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9);
+
+	mb_load_msg(m, blk);
+	for (i = 0; i < 8; i++) {
+		h[i] = _mm256_load_si256((__m256i *)H[i]);
+		v[i] = h[i];
+	}
+	v[8] = _mm256_set1_epi64x(blake2b_mb_IV[0]);
+	v[9] = _mm256_set1_epi64x(blake2b_mb_IV[1]);
+	v[10] = _mm256_set1_epi64x(blake2b_mb_IV[2]);
+	v[11] = _mm256_set1_epi64x(blake2b_mb_IV[3]);
+	v[12] = _mm256_xor_si256(_mm256_set1_epi64x(blake2b_mb_IV[4]),
+	    _mm256_loadu_si256((const __m256i *)T));
+	v[13] = _mm256_set1_epi64x(blake2b_mb_IV[5]);
+	v[14] = _mm256_xor_si256(_mm256_set1_epi64x(blake2b_mb_IV[6]),
+	    _mm256_loadu_si256((const __m256i *)F));
+	v[15] = _mm256_set1_epi64x(blake2b_mb_IV[7]);
+
+	for (r = 0; r < 12; r++) {
+		const uint8_t *s = blake2b_mb_sigma[r];
+
+		G(v[0], v[4], v[8], v[12], m[s[0]], m[s[1]]);
+		G(v[1], v[5], v[9], v[13], m[s[2]], m[s[3]]);
+		G(v[2], v[6], v[10], v[14], m[s[4]], m[s[5]]);
+		G(v[3], v[7], v[11], v[15], m[s[6]], m[s[7]]);
+		G(v[0], v[5], v[10], v[15], m[s[8]], m[s[9]]);
+		G(v[1], v[6], v[11], v[12], m[s[10]], m[s[11]]);
+		G(v[2], v[7], v[8], v[13], m[s[12]], m[s[13]]);
+		G(v[3], v[4], v[9], v[14], m[s[14]], m[s[15]]);
+	}
+
+	for (i = 0; i < 8; i++) {
+		h[i] = _mm256_xor_si256(h[i], _mm256_xor_si256(v[i], v[i + 8]));
+		_mm256_store_si256((__m256i *)H[i], h[i]);
+	}
+}
+
+static inline void
+mb_lane_init(uint64_t H[8][MB_LANES], int lane, uint8_t outlen)
+{
+	int i;
+
+	for (i = 0; i < 8; i++)
+		H[i][lane] = blake2b_mb_IV[i];
+	/*
+	 * Parameter block: digest length, no key, fanout 1, depth 1.
+	 */
+	H[0][lane] ^= 0x01010000ULL ^ outlen;
+}
+
+/*
+ * Compute unkeyed BLAKE2b digests of outlen bytes for num independent
+ * messages. Digest i of in[i] (of length inlen[i]) is written to out[i].
+ */
+int
+blake2b_mb_avx2(uint8_t **out, const uint8_t **in, const uint64_t *inlen,
+		const uint8_t outlen, int num)
+{
+	uint64_t H[8][MB_LANES] __attribute__((aligned(32)));
+	uint64_t T[MB_LANES], F[MB_LANES], rem[MB_LANES];
+	uint8_t pad[MB_LANES][BLAKE2B_BLOCKBYTES];
+	const uint8_t *ptr[MB_LANES], *blk[MB_LANES];
+	int job[MB_LANES], last[MB_LANES];
+	int lane, active, next, i;
+
+	if (outlen == 0 || outlen > BLAKE2B_OUTBYTES)
+		return (-1);
+
+	/*
+	 * Assign the first set of jobs to lanes. Idle lanes hash a dummy zero
+	 * block whose result is discarded.
+	 */
+	memset(pad, 0, sizeof (pad));
+	next = 0;
+	active = 0;
+	for (lane = 0; lane < MB_LANES; lane++) {
+		if (next < num) {
+			mb_lane_init(H, lane, outlen);
+			ptr[lane] = in[next];
+			rem[lane] = inlen[next];
+			T[lane] = 0;
+			job[lane] = next++;
+			active++;
+		} else {
+			job[lane] = -1;
+		}
+	}
+
+	while (active > 0) {
+		for (lane = 0; lane < MB_LANES; lane++) {
+			last[lane] = 0;
+			F[lane] = 0;
+			if (job[lane] < 0) {
+				blk[lane] = pad[lane];
+				continue;
+			}
+			if (rem[lane] > BLAKE2B_BLOCKBYTES) {
+				blk[lane] = ptr[lane];
+				T[lane] += BLAKE2B_BLOCKBYTES;
+			} else {
+				/*
+				 * Final block is zero padded into the lane's scratch block.
+				 */
+				memcpy(pad[lane], ptr[lane], rem[lane]);
+				memset(pad[lane] + rem[lane], 0, BLAKE2B_BLOCKBYTES - rem[lane]);
+				blk[lane] = pad[lane];
+				T[lane] += rem[lane];
+				F[lane] = ~0ULL;
+				last[lane] = 1;
+			}
+		}
+
+		mb_compress(H, blk, T, F);
+
+		for (lane = 0; lane < MB_LANES; lane++) {
+			if (job[lane] < 0)
+				continue;
+			if (!last[lane]) {
+				ptr[lane] += BLAKE2B_BLOCKBYTES;
+				rem[lane] -= BLAKE2B_BLOCKBYTES;
+				continue;
+			}
+
+			/*
+			 * Message complete. Emit the digest and load the next job into
+			 * this lane.
+			 */
+			{
+				uint8_t dig[BLAKE2B_OUTBYTES];
+
+				for (i = 0; i < 8; i++)
+					memcpy(dig + i * 8, &H[i][lane], 8);
+				memcpy(out[job[lane]], dig, outlen);
+			}
+			if (next < num) {
+				mb_lane_init(H, lane, outlen);
+				ptr[lane] = in[next];
+				rem[lane] = inlen[next];
+				T[lane] = 0;
+				job[lane] = next++;
+			} else {
+				job[lane] = -1;
+				active--;
+			}
+		}
+	}
+	return (0);
+}
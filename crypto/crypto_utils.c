@@ -94,6 +94,7 @@ static struct {
 };
 
 static int cksum_provider = PROVIDER_OPENSSL;
+static wpool_t *cksum_wpool = NULL;
 
 extern uint64_t lzma_crc64(const uint8_t *buf, uint64_t size, uint64_t crc);
 extern uint64_t lzma_crc64_8bchk(const uint8_t *buf, uint64_t size,
@@ -208,13 +209,18 @@ compute_checksum(uchar_t *cksum_buf, int cksum, uchar_t *buf, uint64_t bytes, in
 	DEBUG_STAT_EN(double strt, en);
 
 #ifdef __HASH_COMPATIBILITY_
-	assert(mt == 0 || mt == 1 || mt == 2);
+	assert(mt >= CKSUM_MT_NONE && mt <= CKSUM_MT_TREE);
 #else
-	assert(mt == 0 || mt == 1);
+	assert(mt == CKSUM_MT_NONE || mt == CKSUM_MT_PAR || mt == CKSUM_MT_TREE);
 #endif
 
 	DEBUG_STAT_EN(if (verbose) strt = get_wtime_millis());
-	if (cksum == CKSUM_CRC64) {
+	if (mt == CKSUM_MT_TREE) {
+		if (compute_checksum_tree(cksum_buf, cksum, buf, bytes, TREE_HASH_LEAF_SZ,
+		    TREE_HASH_FANOUT, cksum_wpool) != 0)
+			return (-1);
+
+	} else if (cksum == CKSUM_CRC64) {
 		uint64_t *ck = (uint64_t *)cksum_buf;
 		*ck = lzma_crc64(buf, bytes, 0);
 
@@ -326,6 +332,186 @@ compute_checksum(uchar_t *cksum_buf, int cksum, uchar_t *buf, uint64_t bytes, in
 	return (0);
 }
 
+/*
+ * Compute checksums of a batch of independent buffers. Where a multi-buffer
+ * SIMD implementation of the digest is available, several buffers are hashed
+ * in parallel in the vector lanes, otherwise this falls back to hashing each
+ * buffer in turn. Digests are identical to those from compute_checksum().
+ */
+int
+compute_checksum_mb(uchar_t **cksum_bufs, int cksum, uchar_t **bufs, uint64_t *bytes, int num)
+{
+	int i;
+
+	if (bdsp.blake2b_mb != NULL) {
+		if (cksum == CKSUM_BLAKE256) {
+			return (bdsp.blake2b_mb(cksum_bufs, (const uint8_t **)bufs, bytes, 32, num));
+		} else if (cksum == CKSUM_BLAKE512) {
+			return (bdsp.blake2b_mb(cksum_bufs, (const uint8_t **)bufs, bytes, 64, num));
+		}
+	}
+
+	for (i = 0; i < num; i++) {
+		if (compute_checksum(cksum_bufs[i], cksum, bufs[i], bytes[i], 0, 0) != 0)
+			return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Tree hashing. The buffer is split into leaves of leaf_sz bytes and each leaf
+ * is hashed with the plain digest. Consecutive runs of up to fanout digests are
+ * then hashed into a parent node, prefixed by a node marker byte, and this is
+ * repeated until one root digest is left. A buffer that fits into one leaf gets
+ * the plain digest. The leaf level and first node level, which is where all the
+ * data is touched, is split into fanout-sized groups of leaves that run on the
+ * worker pool. Leaves within a group are hashed in multi-buffer mode where
+ * available. The remaining upper levels are tiny and hashed serially.
+ *
+ * Unlike the fixed 4-way OpenMP parallel versions this works for every digest
+ * type, including SKEIN and CRC64.
+ */
+#define	TREE_NODE_MARKER	1
+
+struct tree_task {
+	uchar_t *buf;
+	uint64_t bytes;
+	uint64_t leaf_sz;
+	uchar_t *node;
+	int cksum, dlen, rv;
+};
+
+static int
+cksum_digest_len(int cksum)
+{
+	int i;
+
+	for (i=0; i<(sizeof (cksum_props)/sizeof (cksum_props[0])); i++) {
+		if (cksum == cksum_props[i].cksum_id)
+			return (cksum_props[i].bytes);
+	}
+	return (-1);
+}
+
+/*
+ * Hash a run of child digests into a parent node digest.
+ */
+static int
+tree_node_hash(uchar_t *node, int cksum, uchar_t *children, int dlen, int nchild)
+{
+	uchar_t nbuf[1 + TREE_HASH_MAX_FANOUT * CKSUM_MAX_BYTES];
+
+	nbuf[0] = TREE_NODE_MARKER;
+	memcpy(nbuf + 1, children, (size_t)nchild * dlen);
+	return (compute_checksum(node, cksum, nbuf, 1 + (uint64_t)nchild * dlen, 0, 0));
+}
+
+static void
+tree_group_hash(void *arg)
+{
+	struct tree_task *tt = (struct tree_task *)arg;
+	uchar_t digests[TREE_HASH_MAX_FANOUT * CKSUM_MAX_BYTES];
+	uchar_t *dbufs[TREE_HASH_MAX_FANOUT], *bufs[TREE_HASH_MAX_FANOUT];
+	uint64_t lens[TREE_HASH_MAX_FANOUT], pos;
+	int n;
+
+	n = 0;
+	for (pos = 0; pos < tt->bytes; pos += tt->leaf_sz) {
+		bufs[n] = tt->buf + pos;
+		lens[n] = tt->bytes - pos;
+		if (lens[n] > tt->leaf_sz)
+			lens[n] = tt->leaf_sz;
+		dbufs[n] = digests + n * tt->dlen;
+		n++;
+	}
+	tt->rv = compute_checksum_mb(dbufs, tt->cksum, bufs, lens, n);
+	if (tt->rv == 0)
+		tt->rv = tree_node_hash(tt->node, tt->cksum, digests, tt->dlen, n);
+}
+
+int
+compute_checksum_tree(uchar_t *cksum_buf, int cksum, uchar_t *buf, uint64_t bytes,
+		      uint64_t leaf_sz, int fanout, wpool_t *wp)
+{
+	struct tree_task *tasks;
+	uchar_t *level;
+	uint64_t nleaves, group_sz;
+	int dlen, ngroups, nnodes, i, j, rv;
+
+	if (fanout < 2 || fanout > TREE_HASH_MAX_FANOUT || leaf_sz == 0)
+		return (-1);
+	dlen = cksum_digest_len(cksum);
+	if (dlen < 0)
+		return (-1);
+	if (bytes <= leaf_sz)
+		return (compute_checksum(cksum_buf, cksum, buf, bytes, 0, 0));
+
+	nleaves = (bytes + leaf_sz - 1) / leaf_sz;
+	ngroups = (nleaves + fanout - 1) / fanout;
+	group_sz = leaf_sz * fanout;
+	tasks = (struct tree_task *)malloc(ngroups * sizeof (struct tree_task));
+	level = (uchar_t *)malloc((size_t)ngroups * dlen);
+	if (tasks == NULL || level == NULL) {
+		free(tasks);
+		free(level);
+		return (-1);
+	}
+
+	for (i = 0; i < ngroups; i++) {
+		tasks[i].buf = buf + i * group_sz;
+		tasks[i].bytes = bytes - i * group_sz;
+		if (tasks[i].bytes > group_sz)
+			tasks[i].bytes = group_sz;
+		tasks[i].leaf_sz = leaf_sz;
+		tasks[i].node = level + i * dlen;
+		tasks[i].cksum = cksum;
+		tasks[i].dlen = dlen;
+		tasks[i].rv = 0;
+	}
+	wpool_run(wp, tree_group_hash, tasks, sizeof (struct tree_task), ngroups);
+
+	rv = 0;
+	for (i = 0; i < ngroups; i++) {
+		if (tasks[i].rv != 0)
+			rv = -1;
+	}
+
+	/*
+	 * Upper levels are reduced in place, a parent is always written at or
+	 * before the position of its first child.
+	 */
+	nnodes = ngroups;
+	while (rv == 0 && nnodes > 1) {
+		for (i = 0, j = 0; i < nnodes; i += fanout, j++) {
+			int nchild = nnodes - i;
+
+			if (nchild > fanout)
+				nchild = fanout;
+			if (tree_node_hash(level + j * dlen, cksum, level + i * dlen,
+			    dlen, nchild) != 0) {
+				rv = -1;
+				break;
+			}
+		}
+		nnodes = j;
+	}
+	if (rv == 0)
+		memcpy(cksum_buf, level, dlen);
+	free(tasks);
+	free(level);
+	return (rv);
+}
+
+/*
+ * Register the worker pool used for CKSUM_MT_TREE checksums. A NULL pool
+ * makes tree hashing run serially in the calling thread.
+ */
+void
+set_checksum_wpool(wpool_t *wp)
+{
+	cksum_wpool = wp;
+}
+
 static void
 init_sha512(void)
 {
@@ -875,6 +1061,56 @@ crypto_buf(crypto_ctx_t *cctx, uchar_t *from, uchar_t *to, uint64_t bytes, uint6
 	return (0);
 }
 
+/*
+ * Encrypt in-place and add the ciphertext to the running HMAC, or in decrypt
+ * mode add the ciphertext to the HMAC and then decrypt in-place. If the
+ * cipher keystream can be positioned at an arbitrary offset the buffer is
+ * processed in cache-sized pieces, so that every piece is encrypted and MAC-ed
+ * while it is hot in cache instead of making two full passes over the buffer.
+ * The result is identical to separate crypto_buf() and hmac_update() calls.
+ *
+ * NOTE: In decrypt mode the caller must not use the buffer contents unless
+ * the HMAC verifies.
+ */
+int
+crypto_buf_mac(crypto_ctx_t *cctx, mac_ctx_t *mctx, uchar_t *buf, uint64_t bytes,
+	       uint64_t id)
+{
+	uint64_t pos, len;
+
+	if (cctx->crypto_alg != CRYPTO_ALG_AES || !aes_ctr_seekable()) {
+		if (cctx->enc_dec == ENCRYPT_FLAG) {
+			if (crypto_buf(cctx, buf, buf, bytes, id) == -1)
+				return (-1);
+			return (hmac_update(mctx, buf, bytes));
+		}
+		if (hmac_update(mctx, buf, bytes) == -1)
+			return (-1);
+		return (crypto_buf(cctx, buf, buf, bytes, id));
+	}
+
+	for (pos = 0; pos < bytes; pos += len) {
+		len = bytes - pos;
+		if (len > CRYPTO_MAC_BLOCK)
+			len = CRYPTO_MAC_BLOCK;
+
+		if (cctx->enc_dec == ENCRYPT_FLAG) {
+			if (aes_ctr_at((aes_ctx_t *)(cctx->crypto_ctx), buf + pos, buf + pos,
+			    len, id, pos) == -1)
+				return (-1);
+			if (hmac_update(mctx, buf + pos, len) == -1)
+				return (-1);
+		} else {
+			if (hmac_update(mctx, buf + pos, len) == -1)
+				return (-1);
+			if (aes_ctr_at((aes_ctx_t *)(cctx->crypto_ctx), buf + pos, buf + pos,
+			    len, id, pos) == -1)
+				return (-1);
+		}
+	}
+	return (0);
+}
+
 uchar_t *
 crypto_nonce(crypto_ctx_t *cctx)
 {
@@ -31,6 +31,7 @@
 #include <stdint.h>
 
 #include <utils.h>
+#include <wpool.h>
 
 #ifdef	__cplusplus
 extern "C" {
@@ -61,6 +62,27 @@ extern "C" {
 
 #define	KECCAK_MAX_SEG	(2305843009213693950ULL)
 
+/*
+ * Values of the mt parameter of compute_checksum(). CKSUM_MT_TREE selects a
+ * tree hash built on top of the plain digest with the fixed archive leaf size
+ * and fan-out below. It is computed on the worker pool registered via
+ * set_checksum_wpool().
+ */
+#define	CKSUM_MT_NONE		0
+#define	CKSUM_MT_PAR		1
+#define	CKSUM_MT_PAR_OLD	2
+#define	CKSUM_MT_TREE		3
+
+#define	TREE_HASH_LEAF_SZ	(1024 * 1024)
+#define	TREE_HASH_FANOUT	16
+#define	TREE_HASH_MAX_FANOUT	64
+
+/*
+ * Piece size for single pass encrypt + HMAC. Small enough that a piece is
+ * still in L1/L2 cache when it is fed to the HMAC after encryption.
+ */
+#define	CRYPTO_MAC_BLOCK	(32 * 1024)
+
 typedef struct {
 	void *crypto_ctx;
 	int crypto_alg;
@@ -81,6 +103,10 @@ typedef struct {
  * Generic message digest functions.
  */
 int compute_checksum(uchar_t *cksum_buf, int cksum, uchar_t *buf, uint64_t bytes, int mt, int verbose);
+int compute_checksum_mb(uchar_t **cksum_bufs, int cksum, uchar_t **bufs, uint64_t *bytes, int num);
+int compute_checksum_tree(uchar_t *cksum_buf, int cksum, uchar_t *buf, uint64_t bytes,
+			  uint64_t leaf_sz, int fanout, wpool_t *wp);
+void set_checksum_wpool(wpool_t *wp);
 void list_checksums(FILE *strm, char *pad);
 int get_checksum_props(const char *name, int *cksum, int *cksum_bytes,
 		      int *mac_bytes, int accept_compatible);
@@ -93,6 +119,8 @@ void deserialize_checksum(uchar_t *checksum, uchar_t *buf, int cksum_bytes);
 int init_crypto(crypto_ctx_t *cctx, uchar_t *pwd, int pwd_len, int crypto_alg,
 	       uchar_t *salt, int saltlen, int keylen, uchar_t *nonce, int enc_dec);
 int crypto_buf(crypto_ctx_t *cctx, uchar_t *from, uchar_t *to, uint64_t bytes, uint64_t id);
+int crypto_buf_mac(crypto_ctx_t *cctx, mac_ctx_t *mctx, uchar_t *buf, uint64_t bytes,
+		   uint64_t id);
 uchar_t *crypto_nonce(crypto_ctx_t *cctx);
 void crypto_clean_pkey(crypto_ctx_t *cctx);
 void cleanup_crypto(crypto_ctx_t *cctx);
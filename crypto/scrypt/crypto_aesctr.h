@@ -59,6 +59,8 @@
 
 typedef int (*setkey_func_ptr)(const unsigned char *userKey, const int bits, AES_KEY *key);
 typedef void (*encrypt_func_ptr)(const unsigned char *in, unsigned char *out, const AES_KEY *key);
+typedef void (*ctr_xor_func_ptr)(const AES_KEY *key, uint64_t nonce, uint64_t ctr0,
+		const unsigned char *in, unsigned char *out, uint64_t len);
 
 /**
  * crypto_aesctr_init(key, nonce):
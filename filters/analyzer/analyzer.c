@@ -22,6 +22,8 @@
  * moinakg@belenix.org, http://moinakg.wordpress.com/
  */
 
+#include <math.h>
+#include <string.h>
 #include "utils.h"
 #include "analyzer.h"
 
@@ -29,44 +31,83 @@
 #define	FORTY_PCT(x)	(((x)/10) * 4)
 #define	TEN_PCT(x)	((x)/10)
 
+#define	CPUCAP_NM(x)	x##_scalar
+#include "analyzer_simd.c"
+
+extern uint64_t analyzer_count_tags_SSE4(uchar_t *src, uint64_t start, uint64_t end,
+    uchar_t *prev);
+extern uint64_t analyzer_count_tags_AVX2(uchar_t *src, uint64_t start, uint64_t end,
+    uchar_t *prev);
+extern void analyzer_count_bin_SSE4(uchar_t *src, uint64_t srclen, uint64_t *tot8b,
+    uint64_t *lbytes);
+extern void analyzer_count_bin_AVX2(uchar_t *src, uint64_t srclen, uint64_t *tot8b,
+    uint64_t *lbytes);
+
+static uint64_t (*count_tags)(uchar_t *src, uint64_t start, uint64_t end, uchar_t *prev) =
+    analyzer_count_tags_scalar;
+static void (*count_bin)(uchar_t *src, uint64_t srclen, uint64_t *tot8b,
+    uint64_t *lbytes) = analyzer_count_bin_scalar;
+
+static void byte_histogram(uchar_t *buf, uint64_t len, uint64_t *hist);
+static double hist_entropy(uint64_t *hist, int nsyms, uint64_t tot);
+
+void
+analyzer_module_init(processor_cap_t *pc)
+{
+	if (pc->proc_type != PROC_X64_INTEL && pc->proc_type != PROC_X64_AMD)
+		return;
+	if (pc->avx_level >= 2) {
+		count_tags = analyzer_count_tags_AVX2;
+		count_bin = analyzer_count_bin_AVX2;
+	} else if (pc->sse_level >= 4) {
+		count_tags = analyzer_count_tags_SSE4;
+		count_bin = analyzer_count_bin_SSE4;
+	}
+}
+
 void
 analyze_buffer(void *src, uint64_t srclen, analyzer_ctx_t *actx)
 {
 	uchar_t *src1 = (uchar_t *)src;
 	uint64_t i, tot8b, tot_8b, lbytes, spc;
-	uchar_t cur_byte, prev_byte;
 	uint64_t tag1, tag2, tag3;
+	uchar_t prev;
 	double tagcnt, pct_tag;
 	int markup;
 
 	/*
-	 * Count number of 8-bit binary bytes and XML tags in source.
+	 * Histogram the source and count closing XML tags piecewise, so that the
+	 * tag scan finds each piece in cache. The byte class counts are then
+	 * taken from the histogram.
 	 */
-	tot8b = 0;
-	tag1 = 0;
-	tag2 = 0;
+	memset(actx->hist, 0, sizeof (actx->hist));
 	tag3 = 0;
-	lbytes = 0;
-	spc = 0;
-	prev_byte = cur_byte = 0;
-	for (i = 0; i < srclen; i++) {
-		cur_byte = src1[i];
-		tot8b += (cur_byte & 0x80); // This way for possible auto-vectorization
-		lbytes += (cur_byte < 32);
-		spc += (cur_byte == ' ');
-		tag1 += (cur_byte == '<');
-		tag2 += (cur_byte == '>');
-		tag3 += ((prev_byte == '<') & (cur_byte == '/'));
-		tag3 += ((prev_byte == '/') & (cur_byte == '>'));
-		if (cur_byte != ' ')
-			prev_byte = cur_byte;
+	prev = 0;
+	for (i = 0; i < srclen; i += ANALYZER_BLKSZ) {
+		uint64_t end = i + ANALYZER_BLKSZ;
+
+		if (end > srclen)
+			end = srclen;
+		byte_histogram(src1 + i, end - i, actx->hist);
+		tag3 += count_tags(src1, i, end, &prev);
 	}
+	actx->entropy = hist_entropy(actx->hist, 256, srclen);
+
+	tot8b = 0;
+	for (i = 0x80; i < 256; i++)
+		tot8b += actx->hist[i];
+	lbytes = 0;
+	for (i = 0; i < 32; i++)
+		lbytes += actx->hist[i];
+	spc = actx->hist[' '];
+	tag1 = actx->hist['<'];
+	tag2 = actx->hist['>'];
 
 	/*
 	 * Heuristics for detecting BINARY vs generic TEXT vs XML data at various
 	 * significance levels.
 	 */
-	tot_8b = tot8b / 0x80 + lbytes;
+	tot_8b = tot8b + lbytes;
 	tagcnt = tag1 + tag2;
 	pct_tag = tagcnt / (double)srclen;
 	if (tot_8b > FORTY_PCT(srclen)) {
@@ -81,7 +122,6 @@ analyze_buffer(void *src, uint64_t srclen, analyzer_ctx_t *actx)
 		actx->fifty_pct.btype = TYPE_TEXT;
 	}
 
-	tot8b /= 0x80;
 	if (tot8b <= TEN_PCT((double)srclen) && lbytes < ((srclen>>1) + (srclen>>2) + (srclen>>3))) {
 		actx->one_pct.btype = TYPE_TEXT;
 	}
@@ -104,27 +144,132 @@ analyze_buffer(void *src, uint64_t srclen, analyzer_ctx_t *actx)
 int
 analyze_buffer_simple(void *src, uint64_t srclen)
 {
-	uchar_t *src1 = (uchar_t *)src;
-	uint64_t i, tot8b, lbytes;
-	uchar_t cur_byte;
+	uint64_t tot8b, lbytes;
 	int btype = TYPE_UNKNOWN;
+
 	/*
 	 * Count number of 8-bit binary bytes in source
 	 */
-	tot8b = 0;
-	lbytes = 0;
-	for (i = 0; i < srclen; i++) {
-		cur_byte = src1[i];
-		tot8b += (cur_byte & 0x80); // This way for possible auto-vectorization
-		lbytes += (cur_byte < 32);
-	}
+	count_bin((uchar_t *)src, srclen, &tot8b, &lbytes);
+
 	/*
 	 * Heuristics for detecting BINARY vs generic TEXT
 	 */
-	tot8b /= 0x80;
 	if (tot8b <= TEN_PCT((double)srclen) && lbytes < ((srclen>>1) + (srclen>>2) + (srclen>>3))) {
 		btype = TYPE_TEXT;
 	}
 	return (btype);
 }
 
+/*
+ * Order-0 byte histogram. Four interleaved count tables avoid the store to load
+ * dependency when consecutive bytes hit the same counter, which is what limits
+ * a naive histogram loop.
+ */
+static void
+byte_histogram(uchar_t *buf, uint64_t len, uint64_t *hist)
+{
+	uint32_t h[4][256];
+	uint64_t i;
+	int j;
+
+	memset(h, 0, sizeof (h));
+	for (i = 0; i + 8 <= len; i += 8) {
+		uint64_t w = U64_P(buf + i);
+
+		h[0][w & 0xff]++;
+		h[1][(w >> 8) & 0xff]++;
+		h[2][(w >> 16) & 0xff]++;
+		h[3][(w >> 24) & 0xff]++;
+		h[0][(w >> 32) & 0xff]++;
+		h[1][(w >> 40) & 0xff]++;
+		h[2][(w >> 48) & 0xff]++;
+		h[3][w >> 56]++;
+	}
+	for (; i < len; i++)
+		h[0][buf[i]]++;
+	for (j = 0; j < 256; j++)
+		hist[j] += h[0][j] + h[1][j] + h[2][j] + h[3][j];
+}
+
+/*
+ * Shannon entropy in bits per symbol of a histogram with tot samples.
+ */
+static double
+hist_entropy(uint64_t *hist, int nsyms, uint64_t tot)
+{
+	double sum;
+	int i;
+
+	if (tot == 0)
+		return (0);
+	sum = 0;
+	for (i = 0; i < nsyms; i++) {
+		if (hist[i])
+			sum += (double)hist[i] * log2((double)hist[i]);
+	}
+	return (log2((double)tot) - sum / (double)tot);
+}
+
+/*
+ * Fast check for incompressible data such as already compressed media or
+ * encrypted blobs that carry no recognizable type. Up to ENTROPY_MAX_BLKS
+ * blocks are sampled at an even stride across the buffer. If the order-0
+ * entropy of the sample is high, an order-1 estimate is computed over the
+ * same blocks using the high nibble of the previous byte as context, which
+ * catches data that is byte-wise uniform but has short range structure.
+ * Returns 1 if both estimates are at least ENTROPY_LIMIT bits per byte.
+ *
+ * Long range repeats are not detected here. Deduplication handles those.
+ */
+int
+analyze_incompressible(void *src, uint64_t srclen)
+{
+	uchar_t *src1 = (uchar_t *)src;
+	uint64_t hist[256], ctx_hist[16][256];
+	uint64_t nblks, stride, blksz, i, tot;
+	double h0, h1;
+	int c;
+
+	if (srclen < ENTROPY_MIN_LEN)
+		return (0);
+
+	nblks = srclen / ENTROPY_BLKSZ;
+	if (nblks > ENTROPY_MAX_BLKS)
+		nblks = ENTROPY_MAX_BLKS;
+	stride = srclen / nblks;
+	blksz = ENTROPY_BLKSZ;
+
+	memset(hist, 0, sizeof (hist));
+	for (i = 0; i < nblks; i++)
+		byte_histogram(src1 + i * stride, blksz, hist);
+	tot = nblks * blksz;
+	h0 = hist_entropy(hist, 256, tot);
+	if (h0 < ENTROPY_LIMIT)
+		return (0);
+
+	/*
+	 * Order-1 estimate: H(X | prev >> 4) weighted across the 16 contexts.
+	 */
+	memset(ctx_hist, 0, sizeof (ctx_hist));
+	for (i = 0; i < nblks; i++) {
+		uchar_t *blk = src1 + i * stride;
+		uint64_t j;
+
+		for (j = 1; j < blksz; j++)
+			ctx_hist[blk[j - 1] >> 4][blk[j]]++;
+	}
+	h1 = 0;
+	tot = 0;
+	for (c = 0; c < 16; c++) {
+		uint64_t ctot = 0;
+		int j;
+
+		for (j = 0; j < 256; j++)
+			ctot += ctx_hist[c][j];
+		h1 += (double)ctot * hist_entropy(ctx_hist[c], 256, ctot);
+		tot += ctot;
+	}
+	h1 /= (double)tot;
+	return (h1 >= ENTROPY_LIMIT);
+}
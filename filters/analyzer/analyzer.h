@@ -33,14 +33,39 @@ struct significance_value {
 	int btype;
 };
 
+/*
+ * Results of analyze_buffer(). The byte histogram of the whole buffer and its
+ * order-0 entropy in bits per byte are kept so that later stages do not have
+ * to scan the data again.
+ */
 typedef struct _analyzer_ctx {
 	struct significance_value one_pct;
 	struct significance_value forty_pct;
 	struct significance_value fifty_pct;
+	uint64_t hist[256];
+	double entropy;
 } analyzer_ctx_t;
 
+/*
+ * Sampling entropy estimator parameters. Data whose sampled order-0 and
+ * order-1 entropy is at least ENTROPY_LIMIT bits per byte is treated as
+ * incompressible.
+ */
+#define	ENTROPY_BLKSZ		4096
+#define	ENTROPY_MAX_BLKS	256
+#define	ENTROPY_MIN_LEN		(64 * 1024)
+#define	ENTROPY_LIMIT		7.95
+
+/*
+ * Size of the pieces in which analyze_buffer() histograms and scans the data,
+ * small enough for both passes over a piece to run from L1/L2.
+ */
+#define	ANALYZER_BLKSZ		(32 * 1024)
+
+void analyzer_module_init(processor_cap_t *pc);
 void analyze_buffer(void *src, uint64_t srclen, analyzer_ctx_t *actx);
 int analyze_buffer_simple(void *src, uint64_t srclen);
+int analyze_incompressible(void *src, uint64_t srclen);
 
 #ifdef  __cplusplus
 }
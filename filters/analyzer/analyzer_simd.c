@@ -0,0 +1,170 @@
+/*
+ * This file is a part of Pcompress, a chunked parallel multi-
+ * algorithm lossless compression and decompression program.
+ *
+ * Copyright (C) 2012-2013 Moinak Ghosh. All rights reserved.
+ * Use is subject to license terms.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ * moinakg@belenix.org, http://moinakg.wordpress.com/
+ */
+
+/*
+ * Vectorized scan kernels for the data analyzer. This file is included by
+ * analyzer_sse4.c and analyzer_avx2.c which define CPUCAP_NM and one of
+ * ANALYZER_SSE4 or ANALYZER_AVX2 to select the vector width. Without either
+ * of those the plain scalar loops are built.
+ *
+ * The closing tag count needs the last non-space byte preceding every '/' and
+ * '>'. The vector loop compares each byte with the byte immediately before
+ * it, which is the same thing unless that byte is a space. Those positions
+ * are rare in practice and are fixed up by looking back past the spaces, at
+ * most to the start of the piece being scanned.
+ */
+
+#include <stdint.h>
+#include "utils.h"
+#include "analyzer.h"
+
+#if defined(ANALYZER_AVX2)
+#include <immintrin.h>
+#define	VSZ			32
+typedef __m256i			vec_t;
+#define	vload(p)		_mm256_loadu_si256((const __m256i *)(p))
+#define	vset1(c)		_mm256_set1_epi8(c)
+#define	veq(a, b)		_mm256_cmpeq_epi8(a, b)
+#define	vand(a, b)		_mm256_and_si256(a, b)
+#define	vor(a, b)		_mm256_or_si256(a, b)
+#define	vminu(a, b)		_mm256_min_epu8(a, b)
+#define	vmask(a)		((uint32_t)_mm256_movemask_epi8(a))
+
+#elif defined(ANALYZER_SSE4)
+#include <smmintrin.h>
+#define	VSZ			16
+typedef __m128i			vec_t;
+#define	vload(p)		_mm_loadu_si128((const __m128i *)(p))
+#define	vset1(c)		_mm_set1_epi8(c)
+#define	veq(a, b)		_mm_cmpeq_epi8(a, b)
+#define	vand(a, b)		_mm_and_si128(a, b)
+#define	vor(a, b)		_mm_or_si128(a, b)
+#define	vminu(a, b)		_mm_min_epu8(a, b)
+#define	vmask(a)		((uint32_t)_mm_movemask_epi8(a))
+#endif
+
+/*
+ * Last non-space byte in [start, pos) of src, or prev if there is none.
+ */
+static uchar_t
+prev_nonspace(uchar_t *src, uint64_t start, uint64_t pos, uchar_t prev)
+{
+	while (pos > start) {
+		pos--;
+		if (src[pos] != ' ')
+			return (src[pos]);
+	}
+	return (prev);
+}
+
+/*
+ * Count "</" and "/>" pairs ending in the range [start, end) of src, ignoring
+ * spaces between the two bytes. On entry *prev holds the last non-space byte
+ * before start and on return the last one before end, so the buffer can be
+ * processed in pieces without looking back past start.
+ */
+uint64_t
+CPUCAP_NM(analyzer_count_tags)(uchar_t *src, uint64_t start, uint64_t end, uchar_t *prev)
+{
+	uint64_t i, tag3;
+	uchar_t cur_byte, prev_byte;
+
+	tag3 = 0;
+	i = start;
+#ifdef VSZ
+	if (i == 0)
+		i = 1;
+	if (i + VSZ <= end) {
+		vec_t lt, gt, sl, sp;
+
+		lt = vset1('<');
+		gt = vset1('>');
+		sl = vset1('/');
+		sp = vset1(' ');
+		for (; i + VSZ <= end; i += VSZ) {
+			vec_t cur, prv, c_sl, c_gt;
+			uint32_t hits, fix;
+
+			cur = vload(src + i);
+			prv = vload(src + i - 1);
+			c_sl = veq(cur, sl);
+			c_gt = veq(cur, gt);
+			hits = vmask(vor(vand(veq(prv, lt), c_sl), vand(veq(prv, sl), c_gt)));
+			fix = vmask(vand(veq(prv, sp), vor(c_sl, c_gt)));
+			tag3 += __builtin_popcount(hits);
+			while (fix) {
+				uint64_t pos = i + __builtin_ctz(fix);
+
+				prev_byte = prev_nonspace(src, start, pos, *prev);
+				cur_byte = src[pos];
+				tag3 += ((prev_byte == '<') & (cur_byte == '/'));
+				tag3 += ((prev_byte == '/') & (cur_byte == '>'));
+				fix &= fix - 1;
+			}
+		}
+	}
+#endif
+	prev_byte = prev_nonspace(src, start, i, *prev);
+	for (; i < end; i++) {
+		cur_byte = src[i];
+		tag3 += ((prev_byte == '<') & (cur_byte == '/'));
+		tag3 += ((prev_byte == '/') & (cur_byte == '>'));
+		if (cur_byte != ' ')
+			prev_byte = cur_byte;
+	}
+	*prev = prev_byte;
+	return (tag3);
+}
+
+/*
+ * Count bytes with the high bit set and control bytes below 32.
+ */
+void
+CPUCAP_NM(analyzer_count_bin)(uchar_t *src, uint64_t srclen, uint64_t *tot8b,
+    uint64_t *lbytes)
+{
+	uint64_t i, hi, lo;
+
+	hi = 0;
+	lo = 0;
+	i = 0;
+#ifdef VSZ
+	if (srclen >= VSZ) {
+		vec_t lim = vset1(31);
+
+		for (; i + VSZ <= srclen; i += VSZ) {
+			vec_t cur = vload(src + i);
+
+			hi += __builtin_popcount(vmask(cur));
+			lo += __builtin_popcount(vmask(veq(vminu(cur, lim), cur)));
+		}
+	}
+#endif
+	for (; i < srclen; i++) {
+		hi += (src[i] >> 7);
+		lo += (src[i] < 32);
+	}
+	*tot8b = hi;
+	*lbytes = lo;
+}
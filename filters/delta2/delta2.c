@@ -54,6 +54,9 @@
 
 #include <stdio.h>
 #include <string.h>
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
 #include <utils.h>
 #include <transpose.h>
 #include "delta2.h"
@@ -97,6 +100,13 @@
 static uchar_t strides[NSTRIDES] = {2, 4, 8, 3, 5, 6, 7};
 
 
+/*
+ * Maximum number of stride elements in a block and the number of words in
+ * a bitmap holding one bit per element.
+ */
+#define	D2_MAXELEM	(DELTA2_CHUNK / STRIDE_MIN)
+#define	D2_MAPWORDS	(D2_MAXELEM / 64 + 1)
+
 static int delta2_encode_real(uchar_t *src, uint64_t srclen, uchar_t *dst, uint64_t *dstlen,
 		int rle_thresh, int last_encode, int *hdr_ovr, int nstrides);
 
@@ -216,6 +226,213 @@ delta2_encode(uchar_t *src, uint64_t srclen, uchar_t *dst, uint64_t *dstlen,
 	return (0);
 }
 
+/*
+ * Stride estimation works on bitmaps with one bit per stride element. A bit
+ * is set where the element starts a new delta run, that is where the delta
+ * to the previous element differs from the one before it. With v(i) the
+ * element value this is v(i) + v(i-2) != 2 * v(i-1), elements before the
+ * block start being zero.
+ */
+static void
+delta2_breaks_scalar(uchar_t *src, uint64_t i, uint64_t n, int st, uint64_t mask,
+		     uint64_t *map)
+{
+	uint64_t v0, v1, v2, bits, end;
+
+	v0 = (i > 1 ? LE64(U64_P(src + (i - 2) * st)) & mask : 0);
+	v1 = (i > 0 ? LE64(U64_P(src + (i - 1) * st)) & mask : 0);
+	while (i < n) {
+		end = (i | 63) + 1;
+		if (end > n)
+			end = n;
+		bits = 0;
+		for (; i < end; i++) {
+			v2 = LE64(U64_P(src + i * st)) & mask;
+			bits |= (uint64_t)(v2 + v0 != v1 + v1) << (i & 63);
+			v0 = v1;
+			v1 = v2;
+		}
+		map[(i - 1) >> 6] |= bits;
+	}
+}
+
+#if defined(__AVX2__) || defined(__SSE4_1__)
+/*
+ * Load consecutive elements of a stride into the 64-bit lanes of a vector.
+ * Each 128-bit lane takes two elements from a 16-byte load, the shuffle
+ * mask picks the stride bytes of each element and zeroes the rest.
+ */
+static __m128i
+d2_shufmask(int st)
+{
+	uchar_t m[16];
+	int j;
+
+	for (j = 0; j < 8; j++) {
+		m[j] = (j < st ? j : 0x80);
+		m[j + 8] = (j < st ? st + j : 0x80);
+	}
+	return (_mm_loadu_si128((__m128i *)m));
+}
+#endif
+
+#if defined(__AVX2__)
+static inline __m256i
+d2_load4(uchar_t *pos, int st, __m256i shuf)
+{
+	__m256i v;
+
+	v = _mm256_castsi128_si256(_mm_loadu_si128((__m128i *)pos));
+	v = _mm256_inserti128_si256(v, _mm_loadu_si128((__m128i *)(pos + 2 * st)), 1);
+	return (_mm256_shuffle_epi8(v, shuf));
+}
+
+static void
+delta2_breaks(uchar_t *src, uint64_t srclen, uint64_t n, int st, uint64_t mask,
+	      uint64_t *map)
+{
+	__m256i shuf, prev, cur, p1, p2, eq;
+	uint64_t i, bits;
+
+	shuf = _mm256_broadcastsi128_si256(d2_shufmask(st));
+	delta2_breaks_scalar(src, 0, (n < 4 ? n : 4), st, mask, map);
+	prev = _mm256_setzero_si256();
+	if (n >= 8 && 6 * st + 16 <= srclen)
+		prev = d2_load4(src, st, shuf);
+	for (i = 4; i + 4 <= n && (i + 2) * st + 16 <= srclen; i += 4) {
+		/*
+		 * Elements i-2 .. i+1 and i-1 .. i+2 come from the previous
+		 * and the current group.
+		 */
+		cur = d2_load4(src + i * st, st, shuf);
+		p2 = _mm256_permute2x128_si256(prev, cur, 0x21);
+		p1 = _mm256_alignr_epi8(cur, p2, 8);
+		eq = _mm256_cmpeq_epi64(_mm256_add_epi64(cur, p2), _mm256_add_epi64(p1, p1));
+		prev = cur;
+		bits = ~_mm256_movemask_pd(_mm256_castsi256_pd(eq)) & 0xf;
+		map[i >> 6] |= bits << (i & 63);
+	}
+	if (i < n)
+		delta2_breaks_scalar(src, i, n, st, mask, map);
+}
+
+#elif defined(__SSE4_1__)
+static void
+delta2_breaks(uchar_t *src, uint64_t srclen, uint64_t n, int st, uint64_t mask,
+	      uint64_t *map)
+{
+	__m128i shuf, prev, cur, p1, eq;
+	uint64_t i, bits;
+
+	shuf = d2_shufmask(st);
+	delta2_breaks_scalar(src, 0, (n < 2 ? n : 2), st, mask, map);
+	prev = _mm_setzero_si128();
+	if (n >= 4 && 16 + 2 * st <= srclen)
+		prev = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)src), shuf);
+	for (i = 2; i + 2 <= n && i * st + 16 <= srclen; i += 2) {
+		cur = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)(src + i * st)), shuf);
+		p1 = _mm_alignr_epi8(cur, prev, 8);
+		eq = _mm_cmpeq_epi64(_mm_add_epi64(cur, prev), _mm_add_epi64(p1, p1));
+		prev = cur;
+		bits = ~_mm_movemask_pd(_mm_castsi128_pd(eq)) & 0x3;
+		map[i >> 6] |= bits << (i & 63);
+	}
+	if (i < n)
+		delta2_breaks_scalar(src, i, n, st, mask, map);
+}
+
+#else
+static void
+delta2_breaks(uchar_t *src, uint64_t srclen, uint64_t n, int st, uint64_t mask,
+	      uint64_t *map)
+{
+	delta2_breaks_scalar(src, 0, n, st, mask, map);
+}
+#endif
+
+/*
+ * Return the position of the next set bit (or clear bit if inv is all ones)
+ * at or after i, or n if there is none.
+ */
+static inline uint64_t
+d2_next(uint64_t *map, uint64_t i, uint64_t n, uint64_t inv)
+{
+	uint64_t w;
+
+	if (i >= n)
+		return (n);
+	w = (map[i >> 6] ^ inv) >> (i & 63);
+	if (w == 0) {
+		i = (i | 63) + 1;
+		while (i < n && (w = map[i >> 6] ^ inv) == 0)
+			i += 64;
+		if (i >= n)
+			return (n);
+	}
+	i += __builtin_ctzll(w);
+	return (i < n ? i : n);
+}
+
+/*
+ * Estimate the encoded size of a block from the break map of a stride. Runs
+ * longer than rle_thresh bytes cost a delta header plus a literal header if
+ * literal bytes precede them, everything else is copied as literal bytes.
+ * Only the long runs have to be located, the literal byte count follows from
+ * the block size. *rst is set to the start of a table running into the end
+ * of the block, from where the next block should be scanned.
+ */
+static uint64_t
+delta2_cost(uint64_t *map, uint64_t n, int st, int rle_thresh, uint64_t *rst)
+{
+	uint64_t gtot, lng, start, z, b, last, snum;
+	int w;
+
+	*rst = 0;
+	if (n == 0)
+		return (LIT_HDR);
+	gtot = LIT_HDR + n * st;
+	lng = 0;
+	start = 0;
+	last = 0;
+	while (start < n) {
+		/*
+		 * Elements up to the next clear bit each start a run of one
+		 * element, the run of interest begins just before it.
+		 */
+		z = d2_next(map, start + 1, n, ~0ULL);
+		if (z >= n)
+			break;
+		start = z - 1;
+		b = d2_next(map, z, n, 0);
+		snum = (b - start) * st;
+		if (snum > rle_thresh) {
+			gtot -= snum;
+			gtot += DELTA_HDR;
+			if (b < n && start > lng)
+				gtot += LIT_HDR;
+			lng = b;
+		}
+		start = b;
+	}
+
+	/*
+	 * Start of the final run.
+	 */
+	for (w = (n - 1) >> 6; w >= 0; w--) {
+		z = map[w];
+		if (w == (n - 1) >> 6 && (n & 63))
+			z &= (1ULL << (n & 63)) - 1;
+		if (z) {
+			last = ((uint64_t)w << 6) + 63 - __builtin_clzll(z);
+			break;
+		}
+	}
+	snum = (n - last) * st;
+	if (snum > rle_thresh || snum >= (MIN_THRESH>>1))
+		*rst = last * st;
+	return (gtot);
+}
+
 /*
  * Process one block of data upto 4K in size.
  */
@@ -226,74 +443,43 @@ delta2_encode_real(uchar_t *src, uint64_t srclen, uchar_t *dst, uint64_t *dstlen
 	uint64_t snum, gtot1, gtot2, tot;
 	uint64_t cnt, val, sval;
 	uint64_t vl1, vl2, vld1, vld2;
+	uint64_t map[D2_MAPWORDS], nelem, rst;
 	uchar_t *pos, *pos2, stride, st1;
 	int st;
 
 	assert(srclen == *dstlen);
+
+	/*
+	 * Too short to hold a single element, leave it as literal data.
+	 */
+	if (srclen <= sizeof (cnt))
+		return (-1);
 	gtot1 = ULL_MAX;
 	stride = 0;
 	tot = 0;
 
 	/*
 	 * Estimate which stride length gives the max reduction given rle_thresh.
+	 * For each stride the positions where a delta run breaks are computed
+	 * into a bitmap, several elements at a time, and the cost is derived
+	 * from the runs in the bitmap.
 	 */
 	for (st = 0; st < nstrides; st++) {
-		int gt;
-
-		snum = 0;
-		gtot2 = LIT_HDR;
-		vl1 = 0;
-		vld1 = 0;
-		tot = 0;
-		pos = src;
 		st1 = strides[st];
 		sval = st1;
 		sval = ((sval << 3) - 1);
 		sval = (1ULL << sval);
 		sval |= (sval - 1);
-		val = 0;
-		for (cnt = 0; cnt < (srclen - sizeof (cnt)); cnt += st1) {
-			vl2 = U64_P(pos);
-			vl2 = LE64(vl2);
-			vl2 &= sval;
-			vld2 = vl2 - vl1;
-			if (vld1 != vld2) {
-				if (snum > rle_thresh) {
-					gt = (tot > 0);
-					gtot2 += (LIT_HDR * gt);
-					tot = 0;
-					gtot2 += DELTA_HDR;
-				} else {
-					gtot2 += snum;
-					tot += snum;
-				}
-				snum = 0;
-			}
-			snum += st1;
-			vld1 = vld2;
-			vl1 = vl2;
-			pos += st1;
-		}
-		if (snum > rle_thresh) {
-			gtot2 += DELTA_HDR;
-			/*
-			 * If this ended into another table reset next scan
-			 * point to beginning of the table.
-			 */
-			val = cnt - snum;
-		} else {
-			gtot2 += snum;
-			/*
-			 * If this ended into another table reset next scan
-			 * point to beginning of the table.
-			 */
-			if (snum >= (MIN_THRESH>>1))
-				val = cnt - snum;
-		}
+		nelem = 0;
+		if (srclen > sizeof (cnt))
+			nelem = (srclen - sizeof (cnt) + st1 - 1) / st1;
+		memset(map, 0, ((nelem >> 6) + 1) * sizeof (uint64_t));
+		delta2_breaks(src, srclen, nelem, st1, sval, map);
+		gtot2 = delta2_cost(map, nelem, st1, rle_thresh, &rst);
 		if (gtot2 < gtot1) {
 			gtot1 = gtot2;
 			stride = st1;
-			tot = val;
+			tot = rst;
 		}
 	}
 
@@ -69,6 +69,9 @@
 #include <stdio.h>
 #include <pthread.h>
 #include <ctype.h>
+#if defined(__AVX2__) || defined(__SSSE3__)
+#include <immintrin.h>
+#endif
 #include "DictFilter.h"
 #include "utils.h"
 #include "allocator.h"
@@ -77,23 +80,45 @@
 #define	WORD_MIN	3
 #define	WORD_MAX	50
 #define	LIST_LRU_NUM	15
+#define	KEY_BYTES	16
 
+/*
+ * A dictionary word. The bytes after the first one are kept inline in key,
+ * so words of up to KEY_BYTES + 1 bytes are matched without touching the
+ * source buffer. While scanning, indx is the bucket of the word's XXH32
+ * hash and seq the order in which the entry was added. Together they give
+ * the order in which entries are flattened for sorting.
+ */
 typedef struct dict_entry {
 	unsigned char *word;
-	unsigned char sz;
-	unsigned char lcfirst;
+	struct dict_entry *list_next;
+	uint64_t key[KEY_BYTES / sizeof (uint64_t)];
+	uint32_t hash;
+	uint32_t seq;
 	uint32_t indx;
 	uint32_t occur;
-	struct dict_entry *next;
-	struct dict_entry *list_next;
+	unsigned char sz;
+	unsigned char lcfirst;
 } dict_entry_t;
 
+/*
+ * Open addressed hash table with linear probing. Each slot holds the
+ * 32-bit key hash in the low half and the arena index plus one of the
+ * entry in the high half, zero means empty. The table never holds more
+ * than dictsize entries so they are all carved from one arena.
+ */
 typedef struct hash_context_s {
-	dict_entry_t    **dict;
+	uint64_t        *slots;
+	uint32_t        slotmask;
+	dict_entry_t    *arena;
+	uint32_t        arena_used;
 	uint32_t        dictcount;
 	uint32_t        dictsize;
-	uint32_t        cur_indx;
+	uint32_t        cur_hash;
+	uint64_t        cur_key[KEY_BYTES / sizeof (uint64_t)];
+	uint32_t        seq;
 	uint32_t        collisions;
+	uint8_t         *srcend;
 	dict_entry_t    *sentinel;
 } hash_context_t;
 
@@ -238,9 +263,7 @@ protected:
 	~DictFilter();
 	DictFilter();
 
-	dict_entry_t *find_string(dict_entry_t *de, uint8_t *str, uint32_t sz,
-	    uint8_t lcfirst);
-	void hash_context_init(hash_context_t *hctx, uint32_t dictsize);
+	void hash_context_init(hash_context_t *hctx, uint32_t dictsize, uint8_t *srcend);
 	void hash_context_delete(hash_context_t *hctx);
 	dict_entry_t *hash_lookup(hash_context_t *hctx, uint8_t *word, uint32_t wordsize,
 	    uint8_t lcfirst);
@@ -254,6 +277,10 @@ protected:
 	dict_entry_t *list_push(list_context_t *lctx, dict_entry_t *de);
 	dict_entry_t *list_pop_lru_min(list_context_t *lctx);
 
+	void flatten_dict(hash_context_t *hctx, dict_entry_t **sorted_dict, uint32_t *pos);
+	uint64_t sep_mask(uint8_t *src);
+	uint32_t next_sep(uint8_t *src, uint32_t size, uint32_t *base, uint64_t *mask);
+
 	uint8_t *to_base_enc(uint32_t number, uint8_t *str, int sz);
 	uint32_t from_base_enc(uint8_t *dnum, int sz);
 
@@ -262,6 +289,8 @@ protected:
 	static const char *BASE_DIGITS;
 
 	uint8_t  SEPARATOR[256], flag, flag1, flag2;
+	uint8_t  sep_lo[16], sep_hi[16];
+	int      sep_simd;
 	uint8_t  base_enc_digits[256];
 	uint8_t  base_dec_digits[256];
 	uint32_t NUMERAL_BASE;
@@ -273,7 +302,7 @@ const char *DictFilter::BASE_DIGITS = "0123456789abcdefghijklmnopqrstuvwxyz@ABCD
 
 DictFilter::DictFilter()
 {
-	uint32_t new_size, i;
+	uint32_t new_size, i, nbits;
 
 	memset(SEPARATOR, 0, 256);
 
@@ -348,6 +377,27 @@ DictFilter::DictFilter()
 	SEPARATOR['G'] = 128;
 	SEPARATOR['C'] = 128;
 
+	/*
+	 * Nibble lookup tables to classify separators a vector at a time. Each
+	 * high nibble occurring in a separator gets its own bit in sep_hi and
+	 * sep_lo has that bit set for every low nibble completing a separator.
+	 * This is exact as long as separators span at most 8 high nibbles.
+	 */
+	memset(sep_lo, 0, sizeof (sep_lo));
+	memset(sep_hi, 0, sizeof (sep_hi));
+	nbits = 0;
+	for (i = 0; i < 256; i++) {
+		if (!(SEPARATOR[i] & 1))
+			continue;
+		if (sep_hi[i >> 4] == 0) {
+			if (nbits == 8)
+				break;
+			sep_hi[i >> 4] = 1 << nbits++;
+		}
+		sep_lo[i & 15] |= sep_hi[i >> 4];
+	}
+	sep_simd = (i == 256);
+
 	/*
 	 * Prefix characters for encoded words and numbers.
 	 */
@@ -401,67 +451,110 @@ DictFilter::from_base_enc(uint8_t *dnum, int sz)
 	return (num);
 }
 
+static const uint8_t key_mask[2 * KEY_BYTES] = {
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+};
+
 /*
- * Search for a string in the hash table bucket chain. The first letter is
- * always lower-cased for Proper-case capital-converted comparison.
+ * Load the bytes of a word following the first one into an inline key,
+ * zero padded. A full width load is used unless that would run past the
+ * end of the source buffer.
  */
-dict_entry_t *
-DictFilter::find_string(dict_entry_t *de, uint8_t *str, unsigned int sz, uint8_t lcfirst)
+static inline void
+word_key(uint8_t *word, uint32_t sz, uint8_t *srcend, uint64_t *key)
 {
-	uint8_t c1 = lcfirst;
-	while(de) {
-		if (de->sz == sz) {
-			uint8_t c2 = de->lcfirst;
-			if (c1 == c2) {
-				if (eq_bytes(de->word+1, str+1, sz-1) == 0)
-					return (de);
-			}
-		}
-		de = de->next;
+	uint64_t m[2];
+
+	sz--;
+	word++;
+	if (sz > KEY_BYTES)
+		sz = KEY_BYTES;
+	if (word + KEY_BYTES <= srcend) {
+		memcpy(key, word, KEY_BYTES);
+		memcpy(m, key_mask + KEY_BYTES - sz, KEY_BYTES);
+		key[0] &= m[0];
+		key[1] &= m[1];
+	} else {
+		key[0] = 0;
+		key[1] = 0;
+		memcpy(key, word, sz);
 	}
-	return (NULL);
+}
+
+/*
+ * Hash of an inline key used to place entries in the table. Words longer
+ * than the key that share its bytes just end up probing the same slots.
+ */
+static inline uint32_t
+key_hash(uint64_t *key, uint32_t sz, uint8_t lcfirst)
+{
+	uint64_t h;
+
+	h = key[0] * 0x9E3779B97F4A7C15ULL + key[1];
+	h = (h ^ (h >> 29) ^ (((uint64_t)sz << 8) | lcfirst)) * 0xC2B2AE3D27D4EB4FULL;
+	return ((uint32_t)(h >> 32));
 }
 
 void
-DictFilter::hash_context_init(hash_context_t *hctx, uint32_t dictsize)
+DictFilter::hash_context_init(hash_context_t *hctx, uint32_t dictsize, uint8_t *srcend)
 {
-	hctx->dict = new dict_entry_t* [dictsize]();
+	uint32_t nslots;
+
+	nslots = 16;
+	while (nslots < dictsize * 2)
+		nslots <<= 1;
+	hctx->slots = new uint64_t[nslots]();
+	hctx->slotmask = nslots - 1;
+	hctx->arena = new dict_entry_t[dictsize];
+	hctx->arena_used = 0;
 	hctx->dictcount = 0;
 	hctx->dictsize = dictsize;
+	hctx->seq = 0;
 	hctx->collisions = 0;
+	hctx->srcend = srcend;
 	hctx->sentinel = new dict_entry_t[1]();
 }
 
 void
 DictFilter::hash_context_delete(hash_context_t *hctx) {
-	uint32_t i;
-
-	for (i=0; i<hctx->dictsize; i++) {
-		if (hctx->dict[i]) {
-			dict_entry_t *de, *de1;
-
-			de = hctx->dict[i];
-			while (de) {
-				de1 = de->next;
-				delete de;
-				de = de1;
-			}
-		}
-	}
-	delete hctx->dict;
-	delete hctx->sentinel;
+	delete[] hctx->slots;
+	delete[] hctx->arena;
+	delete[] hctx->sentinel;
 	hctx->dictcount = 0;
 	hctx->collisions = 0;
 }
 
+/*
+ * Look up a word. The first letter is always lower-cased for Proper-case
+ * capital-converted comparison. The hash and key of the word are left in
+ * the context for a following hash_add().
+ */
 dict_entry_t *
 DictFilter::hash_lookup(hash_context_t *hctx, uint8_t *word, uint32_t wordsize, uint8_t lcfirst)
 {
-	uint32_t indx;
+	uint32_t hash, i;
+	uint64_t slot;
+
+	word_key(word, wordsize, hctx->srcend, hctx->cur_key);
+	hash = key_hash(hctx->cur_key, wordsize, lcfirst);
+	hctx->cur_hash = hash;
+	for (i = hash & hctx->slotmask; (slot = hctx->slots[i]) != 0;
+	    i = (i + 1) & hctx->slotmask) {
+		dict_entry_t *de;
 
-	indx = XXH32(word+1, wordsize-1, lcfirst) % hctx->dictsize;
-	hctx->cur_indx = indx;
-	return (find_string(hctx->dict[indx], word, wordsize, lcfirst));
+		if ((uint32_t)slot != hash)
+			continue;
+		de = &hctx->arena[(slot >> 32) - 1];
+		if (de->sz == wordsize && de->lcfirst == lcfirst &&
+		    de->key[0] == hctx->cur_key[0] && de->key[1] == hctx->cur_key[1]) {
+			if (wordsize <= KEY_BYTES + 1 ||
+			    eq_bytes(de->word + KEY_BYTES + 1, word + KEY_BYTES + 1,
+			    wordsize - KEY_BYTES - 1) == 0)
+				return (de);
+		}
+	}
+	return (NULL);
 }
 
 dict_entry_t *
@@ -469,12 +562,14 @@ DictFilter::hash_add(hash_context_t *hctx, uint8_t *word, uint32_t wordsize, dic
 {
 	dict_entry_t *de;
 	uint8_t lcfirst;
+	uint32_t i;
 
 	lcfirst = tolower(word[0]);
 
 	/*
 	 * As of now non-NULL _de means a lookup was already done and match was not found
-	 * and the hash table is full.
+	 * and the hash table is full. The hash and key of that lookup are still in
+	 * the context.
 	 * So we are adding a new entry with a aged out node. No need to do another lookup.
 	 */
 	if (!_de) {
@@ -486,66 +581,184 @@ DictFilter::hash_add(hash_context_t *hctx, uint8_t *word, uint32_t wordsize, dic
 
 		if (hctx->dictcount == hctx->dictsize)
 			return (NULL);
+		de = &hctx->arena[hctx->arena_used++];
 	} else {
-		hctx->cur_indx = XXH32(word+1, wordsize-1, lcfirst) % hctx->dictsize;
+		de = _de;
 	}
 
-	if (_de)
-		de = _de;
-	else
-		de = new dict_entry_t[1]();
 	de->word = word;
 	de->sz = wordsize;
 	de->lcfirst = lcfirst;
 	de->occur = 1;
-	de->indx = hctx->cur_indx;
-	if (hctx->dict[hctx->cur_indx])
+	de->hash = hctx->cur_hash;
+	de->key[0] = hctx->cur_key[0];
+	de->key[1] = hctx->cur_key[1];
+	de->indx = XXH32(word+1, wordsize-1, lcfirst) % hctx->dictsize;
+	de->seq = hctx->seq++;
+
+	for (i = de->hash & hctx->slotmask; hctx->slots[i] != 0;
+	    i = (i + 1) & hctx->slotmask)
 		hctx->collisions++;
-
-	de->next = hctx->dict[hctx->cur_indx];
-	hctx->dict[hctx->cur_indx] = de;
+	hctx->slots[i] = ((uint64_t)(de - hctx->arena + 1) << 32) | de->hash;
 	hctx->dictcount++;
 	return (de);
 }
 
+/*
+ * Remove an entry and close the gap in its probe sequence by moving back
+ * later entries that would otherwise become unreachable.
+ */
 dict_entry_t *
 DictFilter::hash_remove(hash_context_t *hctx, uint8_t *word, uint32_t wordsize, dict_entry_t *r_de)
 {
 	dict_entry_t *de;
-	uint8_t lcfirst;
+	uint64_t ent;
+	uint32_t i, j, home, mask;
 
 	if (!r_de) {
-		lcfirst = tolower(word[0]);
-		de = hash_lookup(hctx, word, wordsize, lcfirst);
+		de = hash_lookup(hctx, word, wordsize, tolower(word[0]));
+		if (!de)
+			return (NULL);
 	} else {
 		de = r_de;
-		hctx->cur_indx = de->indx;
 	}
-	if (de) {
-		dict_entry_t *c_de, *p_de;
-		de->indx = UINT32_MAX;
-
-		c_de = hctx->dict[hctx->cur_indx];
-		if (c_de == de) {
-			hctx->dict[hctx->cur_indx] = c_de->next;
-			hctx->dictcount--;
-			return (de);
+
+	mask = hctx->slotmask;
+	ent = (uint64_t)(de - hctx->arena + 1) << 32;
+	for (i = de->hash & mask; (hctx->slots[i] & 0xffffffff00000000ULL) != ent;
+	    i = (i + 1) & mask)
+		assert(hctx->slots[i] != 0); // Fail, corrupted hash
+
+	for (j = (i + 1) & mask; hctx->slots[j] != 0; j = (j + 1) & mask) {
+		home = (uint32_t)hctx->slots[j] & mask;
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			hctx->slots[i] = hctx->slots[j];
+			i = j;
 		}
+	}
+	hctx->slots[i] = 0;
+	de->indx = UINT32_MAX;
+	hctx->dictcount--;
+	return (de);
+}
 
-		p_de = c_de;
-		c_de = c_de->next;
-		while (c_de) {
-			if (c_de == de) {
-				p_de->next = c_de->next;
-				hctx->dictcount--;
-				return (de);
-			}
-			p_de = c_de;
-			c_de = c_de->next;
+/*
+ * Sort order reproducing a walk of chained hash buckets: by bucket and
+ * most recently added first within a bucket.
+ */
+static int
+cmpbucket(const void *a, const void *b) {
+	dict_entry_t *de1 = *((dict_entry_t **)a);
+	dict_entry_t *de2 = *((dict_entry_t **)b);
+
+	if (de1->indx != de2->indx)
+		return (de1->indx < de2->indx ? -1 : 1);
+	return (de1->seq < de2->seq ? 1 : -1);
+}
+
+/*
+ * Mark below-threshold entries in the dictionary. Also sorted_dict holds a
+ * flattened view of the hash in bucket order, so that the final sort sees
+ * entries in a stable order.
+ */
+void
+DictFilter::flatten_dict(hash_context_t *hctx, dict_entry_t **sorted_dict, uint32_t *pos)
+{
+	uint32_t i, n;
+
+	n = 0;
+	for (i = 0; i < hctx->arena_used; i++) {
+		dict_entry_t *de;
+		ssize_t val;
+
+		de = &hctx->arena[i];
+		val = (size_t)de->occur * (size_t)de->sz;
+		if (val <= 4500) {
+			de->occur = 0;
+			continue;
 		}
-		assert(0 == 1); // Fail, corrupted hash
+		sorted_dict[n++] = de;
 	}
-	return (NULL);
+	qsort(sorted_dict, n, sizeof (dict_entry_t *), cmpbucket);
+	*pos = n;
+}
+
+/*
+ * Return a bitmask of the separator characters among the 64 bytes at src.
+ */
+uint64_t
+DictFilter::sep_mask(uint8_t *src)
+{
+	uint64_t mask;
+	int i;
+
+#if defined(__AVX2__)
+	if (sep_simd) {
+		__m256i lo_t, hi_t, nib, v, t;
+
+		lo_t = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *)sep_lo));
+		hi_t = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *)sep_hi));
+		nib = _mm256_set1_epi8(0x0f);
+		mask = 0;
+		for (i = 0; i < 64; i += 32) {
+			v = _mm256_loadu_si256((__m256i *)(src + i));
+			t = _mm256_and_si256(_mm256_shuffle_epi8(lo_t, _mm256_and_si256(v, nib)),
+			    _mm256_shuffle_epi8(hi_t,
+			    _mm256_and_si256(_mm256_srli_epi16(v, 4), nib)));
+			t = _mm256_cmpeq_epi8(t, _mm256_setzero_si256());
+			mask |= (uint64_t)(~(uint32_t)_mm256_movemask_epi8(t)) << i;
+		}
+		return (mask);
+	}
+#elif defined(__SSSE3__)
+	if (sep_simd) {
+		__m128i lo_t, hi_t, nib, v, t;
+
+		lo_t = _mm_loadu_si128((__m128i *)sep_lo);
+		hi_t = _mm_loadu_si128((__m128i *)sep_hi);
+		nib = _mm_set1_epi8(0x0f);
+		mask = 0;
+		for (i = 0; i < 64; i += 16) {
+			v = _mm_loadu_si128((__m128i *)(src + i));
+			t = _mm_and_si128(_mm_shuffle_epi8(lo_t, _mm_and_si128(v, nib)),
+			    _mm_shuffle_epi8(hi_t, _mm_and_si128(_mm_srli_epi16(v, 4), nib)));
+			t = _mm_cmpeq_epi8(t, _mm_setzero_si128());
+			mask |= (uint64_t)(~_mm_movemask_epi8(t) & 0xffff) << i;
+		}
+		return (mask);
+	}
+#endif
+	mask = 0;
+	for (i = 0; i < 64; i++)
+		mask |= (uint64_t)(SEPARATOR[src[i]] & 1) << i;
+	return (mask);
+}
+
+/*
+ * Return the position of the next separator in the buffer or size if
+ * there are none left. The caller keeps the position of the current 64
+ * byte window in base and its pending separators in mask, both starting
+ * out as zero.
+ */
+uint32_t
+DictFilter::next_sep(uint8_t *src, uint32_t size, uint32_t *base, uint64_t *mask)
+{
+	uint32_t i;
+
+	while (*mask == 0) {
+		if (*base >= size)
+			return (size);
+		if (size - *base >= 64) {
+			*mask = sep_mask(src + *base);
+		} else {
+			for (i = *base; i < size; i++)
+				*mask |= (uint64_t)(SEPARATOR[src[i]] & 1) << (i - *base);
+		}
+		*base += 64;
+	}
+	i = *base - 64 + __builtin_ctzll(*mask);
+	*mask &= *mask - 1;
+	return (i);
 }
 
 void
@@ -561,7 +774,7 @@ DictFilter::list_context_init(list_context_t *lctx, uint32_t listsize)
 void
 DictFilter::list_context_delete(list_context_t *lctx)
 {
-	delete lctx->head;
+	delete[] lctx->head;
 	lctx->listcount = 0;
 	lctx->aged_entries = 0;
 }
@@ -643,11 +856,12 @@ DictFilter::list_pop_lru_min(list_context_t *lctx)
 int
 DictFilter::Forward_Dict(uint8_t *src, uint32_t size, uint8_t *dst, uint32_t *dstsize)
 {
-	uint32_t dstSize = 0, dictSize, i, pos, num_entries;
+	uint32_t dstSize = 0, dictSize, i, pos, num_entries, base;
 	hash_context_t hctx;
 	list_context_t lctx;
 	dict_entry_t **sorted_dict;
 	uint8_t num_dict[10], *numd;
+	uint64_t smask;
 	ssize_t new_size;
 	int rv, sz;
 
@@ -664,70 +878,45 @@ DictFilter::Forward_Dict(uint8_t *src, uint32_t size, uint8_t *dst, uint32_t *ds
 
 	pos = 0;
 	rv = 0;
-	hash_context_init(&hctx, dictSize);
+	hash_context_init(&hctx, dictSize, src + size);
 	list_context_init(&lctx, dictSize);
 	sorted_dict = new dict_entry_t* [dictSize];
 
 	/*
 	 * Scan words in the data and build the dictionary.
 	 */
-	for (i=0; i<size; i++) {
-		uint8_t c = src[i];
-
-		if (SEPARATOR[c] & 1) {
-			dict_entry_t *de;
-			size_t toklen = i - pos;
-
-			if (toklen < WORD_MIN || toklen > WORD_MAX) {
-				pos = i+1;
-				continue;
-			}
+	base = 0;
+	smask = 0;
+	for (i = next_sep(src, size, &base, &smask); i < size;
+	    i = next_sep(src, size, &base, &smask)) {
+		dict_entry_t *de;
+		size_t toklen = i - pos;
 
-			de = hash_add(&hctx, src+pos, toklen, NULL);
-			if (!de && i > (size>>1)) {
-				de = list_pop_lru_min(&lctx);
-				if (de) {
-					dict_entry_t *de1;
-					de1 = hash_remove(&hctx, de->word, de->sz, de);
-					assert(de1 == de);
-					de1 = hash_add(&hctx, src+pos, toklen, de);
-					assert(de1 != NULL);
-					assert(de1 != hctx.sentinel);
-					list_push(&lctx, de1);
-				}
-			} else if (de != hctx.sentinel) {
-				list_push(&lctx, de);
-			}
+		if (toklen < WORD_MIN || toklen > WORD_MAX) {
 			pos = i+1;
+			continue;
 		}
-	}
-
-	/*
-	 * Mark below-threshold entries in the dictionary. Also sorted_dict holds a
-	 * flattened view of the hash.
-	 */
-	pos = 0;
-	for (i=0; i<dictSize; i++) {
-		if (hctx.dict[i]) {
-			dict_entry_t *de;
-
-			de = hctx.dict[i];
-			while (de) {
-				ssize_t val;
 
-				val = (size_t)de->occur * (size_t)de->sz;
-				if (val <= 4500) {
-					de->occur = 0;
-					de = de->next;
-					continue;
-				}
-
-				sorted_dict[pos++] = de;
-				de = de->next;
+		de = hash_add(&hctx, src+pos, toklen, NULL);
+		if (!de && i > (size>>1)) {
+			de = list_pop_lru_min(&lctx);
+			if (de) {
+				dict_entry_t *de1;
+				de1 = hash_remove(&hctx, de->word, de->sz, de);
+				assert(de1 == de);
+				de1 = hash_add(&hctx, src+pos, toklen, de);
+				assert(de1 != NULL);
+				assert(de1 != hctx.sentinel);
+				list_push(&lctx, de1);
 			}
+		} else if (de != hctx.sentinel) {
+			list_push(&lctx, de);
 		}
+		pos = i+1;
 	}
 
+	flatten_dict(&hctx, sorted_dict, &pos);
+
 	/*
 	 * Sort the flattened view of the hash in descending order of
 	 * occurrence X word size.
@@ -800,15 +989,86 @@ DictFilter::Forward_Dict(uint8_t *src, uint32_t size, uint8_t *dst, uint32_t *ds
 	}
 
 	pos = 0;
-	for (i=0; i<size && dstSize<*dstsize; i++) {
-		uint8_t *tok, c;
+	base = 0;
+	smask = 0;
+	for (i = next_sep(src, size, &base, &smask); i < size && dstSize<*dstsize;
+	    i = next_sep(src, size, &base, &smask)) {
+		uint8_t *tok;
+		dict_entry_t *de;
+		size_t toklen = i - pos;
 
-		c = src[i];
-		if (SEPARATOR[c] & 1) {
-			dict_entry_t *de;
-			size_t toklen = i - pos;
+		if (toklen < WORD_MIN || toklen > WORD_MAX) {
+			if (*(src+pos) == flag || *(src+pos) == flag1 ||
+			    *(src+pos) == flag2 || *(src+pos) == '\\') {
+				dst[dstSize++] = '\\';
+			}
+			if (dstSize + toklen + 1 > *dstsize) {
+				goto bail;
+			}
+			copy_bytes(&dst[dstSize], src+pos, toklen+1);
+			dstSize += (toklen+1);
+			pos = i+1;
+			continue;
+		}
 
-			if (toklen < WORD_MIN || toklen > WORD_MAX) {
+		tok = src+pos;
+		de = hash_lookup(&hctx, tok, toklen, tolower(tok[0]));
+		if (de != NULL && de->occur > 1) {
+			uint16_t val;
+			unsigned char tok_hdr[10], *dnum;
+
+			/*
+			 * Encode word with dictionary reference.
+			 */
+			sz = sizeof (tok_hdr);
+			val = de->indx;
+			dnum = to_base_enc(val, tok_hdr, sz);
+			dnum--;
+			if (isupper(tok[0])) {
+				*dnum = flag1;
+			} else {
+				*dnum = flag;
+			}
+
+			val = tok_hdr+sz - dnum-1;
+			if (dstSize + val + 1 > *dstsize) {
+				goto bail;
+			}
+			copy_bytes(&dst[dstSize], dnum, val);
+			dstSize += val;
+			dst[dstSize++] = src[i];
+		} else {
+			uint8_t *word = src+pos;
+			uint32_t val, k;
+			int converted;
+
+			/*
+			 * Encode literal numeric strings.
+			 */
+			converted = 0;
+			if (word[0] > '0' && word[0] <= '9' && toklen > 4 && toklen < 10) {
+				val = 0;
+				for (k = 0; k < toklen && word[k] >= '0' && word[k] <= '9'; k++)
+					val = val * 10 + (word[k] - '0');
+
+				if (k == toklen) {
+					uint8_t tok_hdr[10], *dnum;
+					sz = sizeof (tok_hdr);
+					dnum = to_base_enc(val, tok_hdr, sz);
+					dnum--;
+					*dnum = flag2;
+
+					val = tok_hdr+sz - dnum-1;
+					if (dstSize + val + 1 > *dstsize) {
+						goto bail;
+					}
+					copy_bytes(&dst[dstSize], dnum, val);
+					dstSize += val;
+					dst[dstSize++] = src[i];
+					converted = 1;
+				}
+			}
+			if (!converted) {
 				if (*(src+pos) == flag || *(src+pos) == flag1 ||
 				    *(src+pos) == flag2 || *(src+pos) == '\\') {
 					dst[dstSize++] = '\\';
@@ -818,82 +1078,9 @@ DictFilter::Forward_Dict(uint8_t *src, uint32_t size, uint8_t *dst, uint32_t *ds
 				}
 				copy_bytes(&dst[dstSize], src+pos, toklen+1);
 				dstSize += (toklen+1);
-				pos = i+1;
-				continue;
-			}
-
-			tok = src+pos;
-			de = hash_lookup(&hctx, tok, toklen, tolower(tok[0]));
-			if (de != NULL && de->occur > 1) {
-				uint16_t val;
-				unsigned char tok_hdr[10], *dnum;
-
-				/*
-				 * Encode word with dictionary reference.
-				 */
-				sz = sizeof (tok_hdr);
-				val = de->indx;
-				dnum = to_base_enc(val, tok_hdr, sz);
-				dnum--;
-				if (isupper(tok[0])) {
-					*dnum = flag1;
-				} else {
-					*dnum = flag;
-				}
-
-				val = tok_hdr+sz - dnum-1;
-				if (dstSize + val + 1 > *dstsize) {
-					goto bail;
-				}
-				copy_bytes(&dst[dstSize], dnum, val);
-				dstSize += val;
-				dst[dstSize++] = src[i];
-			} else {
-				uint8_t *word = src+pos;
-				uint8_t num[15];
-				uint32_t val;
-				int converted;
-
-				/*
-				 * Encode literal numeric strings.
-				 */
-				converted = 0;
-				if (isdigit(word[0]) && word[0] != '0' && toklen > 4 && toklen < 10) {
-					copy_bytes(num, word, toklen);
-					num[toklen] = '\0';
-					val = strtoul((const char *)num, (char **)&word, 10);
-
-					if (*word == '\0' && word - num == toklen && val > 0) {
-						uint8_t tok_hdr[10], *dnum;
-						sz = sizeof (tok_hdr);
-						dnum = to_base_enc(val, tok_hdr, sz);
-						dnum--;
-						*dnum = flag2;
-
-						val = tok_hdr+sz - dnum-1;
-						if (dstSize + val + 1 > *dstsize) {
-							goto bail;
-						}
-						copy_bytes(&dst[dstSize], dnum, val);
-						dstSize += val;
-						dst[dstSize++] = src[i];
-						converted = 1;
-					}
-				}
-				if (!converted) {
-					if (*(src+pos) == flag || *(src+pos) == flag1 ||
-					    *(src+pos) == flag2 || *(src+pos) == '\\') {
-						dst[dstSize++] = '\\';
-					}
-					if (dstSize + toklen + 1 > *dstsize) {
-						goto bail;
-					}
-					copy_bytes(&dst[dstSize], src+pos, toklen+1);
-					dstSize += (toklen+1);
-				}
 			}
-			pos = i+1;
 		}
+		pos = i+1;
 	}
 	if (pos < size) {
 		uint32_t sz = size - pos;
@@ -911,7 +1098,7 @@ DictFilter::Forward_Dict(uint8_t *src, uint32_t size, uint8_t *dst, uint32_t *ds
 bail:
 	hash_context_delete(&hctx);
 	list_context_delete(&lctx);
-	delete sorted_dict;
+	delete[] sorted_dict;
 
 	return rv;
 }
@@ -941,7 +1128,7 @@ DictFilter::Forward_Dict_Fasta(uint8_t *src, uint32_t size, uint8_t *dst, uint32
 	pos = 0;
 	rv = 0;
 	j = 0;
-	hash_context_init(&hctx, dictSize);
+	hash_context_init(&hctx, dictSize, src + size);
 	list_context_init(&lctx, dictSize);
 	sorted_dict = new dict_entry_t* [dictSize];
 
@@ -1008,31 +1195,7 @@ DictFilter::Forward_Dict_Fasta(uint8_t *src, uint32_t size, uint8_t *dst, uint32
 		j++;
 	}
 
-	/*
-	 * Mark below-threshold entries in the dictionary. Also sorted_dict holds a
-	 * flattened view of the hash.
-	 */
-	pos = 0;
-	for (i=0; i<dictSize; i++) {
-		if (hctx.dict[i]) {
-			dict_entry_t *de;
-
-			de = hctx.dict[i];
-			while (de) {
-				ssize_t val;
-
-				val = (size_t)de->occur * (size_t)de->sz;
-				if (val <= 4500) {
-					de->occur = 0;
-					de = de->next;
-					continue;
-				}
-
-				sorted_dict[pos++] = de;
-				de = de->next;
-			}
-		}
-	}
+	flatten_dict(&hctx, sorted_dict, &pos);
 
 	/*
 	 * Sort the flattened view of the hash in descending order of
@@ -1227,7 +1390,7 @@ DictFilter::Forward_Dict_Fasta(uint8_t *src, uint32_t size, uint8_t *dst, uint32
 bail:
 	hash_context_delete(&hctx);
 	list_context_delete(&lctx);
-	delete sorted_dict;
+	delete[] sorted_dict;
 
 	return rv;
 }
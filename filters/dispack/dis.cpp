@@ -33,6 +33,11 @@
 #endif
 #include <assert.h>
 #include <iostream>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 using namespace std;
 
@@ -953,74 +958,272 @@ extern "C" {
  *    false positives.
  * 2) Store transformed values in big-endian format. This improves compression.
  */
-int
-Forward_E89(uint8_t *src, uint64_t sz)
+/*
+ * Convert a single E8/E9 candidate at position i. Returns 1 if the address
+ * was transformed.
+ */
+static inline int
+e89_convert(uint8_t *buf, uint32_t i)
 {
-	uint32_t i;
-	uint32_t size, conversions;
+	uint32_t off;
+
+	if ((buf[i] & 0xfe) != 0xe8 || (buf[i+4] != 0 && buf[i+4] != 0xff))
+		return (0);
+	off = (buf[i+1] | (buf[i+2] << 8) | (buf[i+3] << 16));
+	if (off > 0) {
+		off += i;
+		off &= 0xffffff;
+		if (off > 0) {
+			buf[i+1] = (uint8_t)(off >> 16);
+			buf[i+2] = (uint8_t)(off >> 8);
+			buf[i+3] = (uint8_t)off;
+			return (1);
+		}
+	}
+	return (0);
+}
 
-	if (sz > UINT32_MAX || sz < 25) {
-		return (-1);
+static inline int
+e89_revert(uint8_t *buf, uint32_t i)
+{
+	uint32_t val;
+
+	if ((buf[i] & 0xfe) != 0xe8 || (buf[i+4] != 0 && buf[i+4] != 0xff))
+		return (0);
+	val = (buf[i+3] | (buf[i+2] << 8) | (buf[i+1] << 16));
+	if (val > 0) {
+		val -= i;
+		val &= 0xffffff;
+		if (val > 0) {
+			buf[i+1] = (uint8_t)val;
+			buf[i+2] = (uint8_t)(val >> 8);
+			buf[i+3] = (uint8_t)(val >> 16);
+			return (1);
+		}
 	}
+	return (0);
+}
 
-	size = sz;
-	i = 0;
+/*
+ * Candidate positions in a 32-byte block: bit k is set if buf[k] is E8 or E9
+ * and buf[k+4] is 00 or FF. Reads 36 bytes. The vector compare finds the rare
+ * candidates, the transform itself is done by the scalar routines above.
+ */
+#define	E89_BLK		32
+
+#if defined(__AVX2__)
+static inline uint32_t
+e89_mask(const uint8_t *buf)
+{
+	__m256i v0, v4, op, hi;
+
+	v0 = _mm256_loadu_si256((const __m256i *)buf);
+	v4 = _mm256_loadu_si256((const __m256i *)(buf + 4));
+	op = _mm256_cmpeq_epi8(_mm256_and_si256(v0, _mm256_set1_epi8((char)0xfe)),
+	    _mm256_set1_epi8((char)0xe8));
+	hi = _mm256_or_si256(_mm256_cmpeq_epi8(v4, _mm256_setzero_si256()),
+	    _mm256_cmpeq_epi8(v4, _mm256_set1_epi8((char)0xff)));
+	return ((uint32_t)_mm256_movemask_epi8(_mm256_and_si256(op, hi)));
+}
+
+#elif defined(__SSE2__)
+static inline uint32_t
+e89_mask16(const uint8_t *buf)
+{
+	__m128i v0, v4, op, hi;
+
+	v0 = _mm_loadu_si128((const __m128i *)buf);
+	v4 = _mm_loadu_si128((const __m128i *)(buf + 4));
+	op = _mm_cmpeq_epi8(_mm_and_si128(v0, _mm_set1_epi8((char)0xfe)),
+	    _mm_set1_epi8((char)0xe8));
+	hi = _mm_or_si128(_mm_cmpeq_epi8(v4, _mm_setzero_si128()),
+	    _mm_cmpeq_epi8(v4, _mm_set1_epi8((char)0xff)));
+	return ((uint32_t)_mm_movemask_epi8(_mm_and_si128(op, hi)));
+}
+
+static inline uint32_t
+e89_mask(const uint8_t *buf)
+{
+	return (e89_mask16(buf) | (e89_mask16(buf + 16) << 16));
+}
+
+#else
+static inline uint32_t
+e89_mask(const uint8_t *buf)
+{
+	uint32_t k, mask;
+
+	mask = 0;
+	for (k = 0; k < E89_BLK; k++) {
+		if ((buf[k] & 0xfe) == 0xe8 && (buf[k+4] == 0 || buf[k+4] == 0xff))
+			mask |= (1U << k);
+	}
+	return (mask);
+}
+#endif
+
+/*
+ * Candidate mask for the last n < E89_BLK positions of the buffer.
+ */
+static inline uint32_t
+e89_mask_tail(const uint8_t *buf, uint32_t n)
+{
+	uint32_t k, mask;
+
+	mask = 0;
+	for (k = 0; k < n; k++) {
+		if ((buf[k] & 0xfe) == 0xe8 && (buf[k+4] == 0 || buf[k+4] == 0xff))
+			mask |= (1U << k);
+	}
+	return (mask);
+}
+
+/*
+ * Candidate mask of the block at blk, for positions below end.
+ */
+static inline uint32_t
+e89_block_mask(const uint8_t *buf, uint32_t blk, uint32_t end)
+{
+	if (blk + E89_BLK <= end)
+		return (e89_mask(buf + blk));
+	return (e89_mask_tail(buf + blk, end - blk));
+}
+
+/*
+ * Copy src to dst up to position n in pieces that stay in cache while the
+ * transform runs over them.
+ */
+#define	E89_COPY_AHEAD	4096
+
+static inline void
+e89_copy_upto(const uint8_t *src, uint8_t *dst, uint32_t *copied, uint32_t n,
+    uint32_t size)
+{
+	uint32_t upto;
+
+	if (*copied >= n)
+		return;
+	upto = n + E89_COPY_AHEAD;
+	if (upto > size)
+		upto = size;
+	memcpy(dst + *copied, src + *copied, upto - *copied);
+	*copied = upto;
+}
+
+/*
+ * Forward transform of src into dst, which may be the same buffer. Candidates
+ * are found a block at a time in the original data. A transform at position i
+ * rewrites bytes i+1 to i+3, which may in turn become candidates, so the
+ * positions following a transform are checked one at a time like the plain
+ * sequential scan. The high byte checked at a position is never rewritten
+ * before that position is reached, so the output is the same.
+ */
+static uint32_t
+e89_forward(const uint8_t *src, uint8_t *dst, uint32_t size)
+{
+	uint32_t blk, end, next, last, p, j, copied, conversions;
+	uint32_t mask;
+
+	end = size - 4;
+	next = 0;
 	conversions = 0;
-	while (i < size-4) {
-		if ((src[i] & 0xfe) == 0xe8 &&
-		    (src[i+4] == 0 || src[i+4] == 0xff))
-		{
-			uint32_t off;
-
-			off = (src[i+1] | (src[i+2] << 8) | (src[i+3] << 16));
-			if (off > 0) {
-				off += i;
-				off &= 0xffffff;
-				if (off > 0) {
-					src[i+1] = (uint8_t)(off >> 16);
-					src[i+2] = (uint8_t)(off >> 8);
-					src[i+3] = (uint8_t)off;
+	copied = (src == dst ? size : 0);
+	for (blk = 0; blk < end; blk += E89_BLK) {
+		e89_copy_upto(src, dst, &copied, blk + E89_BLK + 4, size);
+		mask = e89_block_mask(src, blk, end);
+		if (next > blk)
+			mask = (next - blk >= E89_BLK ? 0 : mask & (~0U << (next - blk)));
+
+		while (mask) {
+			j = blk + __builtin_ctz(mask);
+			mask &= mask - 1;
+			if (!e89_convert(dst, j))
+				continue;
+			conversions++;
+			last = j;
+			for (p = j + 1; p < end && p <= last + 3; p++) {
+				e89_copy_upto(src, dst, &copied, p + 5, size);
+				if (e89_convert(dst, p)) {
 					conversions++;
+					last = p;
 				}
 			}
+			next = p;
+			mask = (next - blk >= E89_BLK ? 0 : mask & (~0U << (next - blk)));
 		}
-		i++;
 	}
-	if (conversions < 5)
+	e89_copy_upto(src, dst, &copied, size, size);
+	return (conversions);
+}
+
+int
+Forward_E89(uint8_t *src, uint64_t sz)
+{
+	if (sz > UINT32_MAX || sz < 25) {
+		return (-1);
+	}
+
+	if (e89_forward(src, src, sz) < 5)
+		return (-1);
+	return (0);
+}
+
+/*
+ * Same transform as Forward_E89() but the result is written to dst, so that the
+ * copy and the transform are done in a single pass. The output is identical to
+ * the in-place variant. The contents of dst are undefined if the filter is not
+ * applied.
+ */
+int
+Forward_E89_copy(const uint8_t *src, uint8_t *dst, uint64_t sz)
+{
+	if (sz > UINT32_MAX || sz < 25) {
+		return (-1);
+	}
+
+	if (e89_forward(src, dst, sz) < 5)
 		return (-1);
 	return (0);
 }
 
+/*
+ * The inverse scan runs backwards over positions size-5 down to 1. Reverting
+ * position i rewrites bytes i+1 to i+3, which are the high bytes of positions
+ * i-3 to i-1, so after a revert the rest of the block is rescanned from the
+ * current data.
+ */
 int
 Inverse_E89(uint8_t *src, uint64_t sz)
 {
-	uint32_t i;
-	uint32_t size;
+	uint32_t size, end, blk, j;
+	uint32_t mask;
 
 	if (sz > UINT32_MAX) {
 		return (-1);
 	}
+	if (sz < 6)
+		return (0);
 
 	size = sz;
-	i = size-5;;
-	while (i > 0) {
-		if ((src[i] & 0xfe) == 0xe8 &&
-		    (src[i+4] == 0 || src[i+4] == 0xff))
-		{
-			uint32_t val;
-
-			val = (src[i+3] | (src[i+2] << 8) | (src[i+1] << 16));
-			if (val > 0) {
-				val -= i;
-				val &= 0xffffff;
-				if (val > 0) {
-					src[i+1] = (uint8_t)val;
-					src[i+2] = (uint8_t)(val >> 8);
-					src[i+3] = (uint8_t)(val >> 16);
-				}
+	end = size - 4;
+	blk = ((end - 1) / E89_BLK) * E89_BLK;
+	for (;;) {
+		mask = e89_block_mask(src, blk, end);
+		if (blk == 0)
+			mask &= ~1U;
+
+		while (mask) {
+			j = blk + 31 - __builtin_clz(mask);
+			mask &= ~(1U << (j - blk));
+			if (e89_revert(src, j)) {
+				mask = e89_block_mask(src, blk, end) & ((1U << (j - blk)) - 1);
+				if (blk == 0)
+					mask &= ~1U;
 			}
 		}
-		i--;
+		if (blk == 0)
+			break;
+		blk -= E89_BLK;
 	}
 	return (0);
 }
@@ -35,6 +35,7 @@ extern "C" {
 int dispack_decode(uchar_t *from, uint64_t fromlen, uchar_t *to, uint64_t *dstlen);
 
 int Forward_E89(uint8_t *src, uint64_t sz);
+int Forward_E89_copy(const uint8_t *src, uint8_t *dst, uint64_t sz);
 int Inverse_E89(uint8_t *src, uint64_t sz);
 
 #ifdef	__cplusplus
@@ -58,11 +58,6 @@ See also the bsc and libbsc web site:
 
 --*/
 
-/*
- *  TODO: Port the parallel implementation.
- */
-#undef LZP_OPENMP
-
 #ifndef __STDC_FORMAT_MACROS
 #define	__STDC_FORMAT_MACROS	1
 #endif
@@ -74,11 +69,24 @@ See also the bsc and libbsc web site:
 #include <sys/types.h>
 #include <stdio.h>
 #include <utils.h>
+#include <wpool.h>
 
 #include "lzp.h"
 
 #define LZP_MATCH_FLAG 	0xf2
 
+static wpool_t *lzp_wpool = NULL;
+
+/*
+ * Set the worker pool on which the blocks of a multi-block LZP stream are
+ * encoded and decoded.
+ */
+void
+lzp_set_wpool(wpool_t *wp)
+{
+	lzp_wpool = wp;
+}
+
 static
 inline int bsc_lzp_num_blocks(int64_t n)
 {
@@ -312,177 +320,173 @@ int64_t bsc_lzp_compress_serial(const unsigned char * input, unsigned char * out
     return outputPtr;
 }
 
-#ifdef LZP_OPENMP
+/*
+ * One block of a multi-block LZP stream, processed as a worker pool task.
+ */
+struct lzp_task {
+    const unsigned char * input;
+    unsigned char *       output;
+    int                   inputSize;
+    int                   outputSize;
+    int                   hashSize;
+    int                   minLen;
+    int                   result;
+};
+
+static void
+lzp_encode_task(void *arg)
+{
+    struct lzp_task *t = (struct lzp_task *)arg;
 
-static
-int bsc_lzp_compress_parallel(const unsigned char * input, unsigned char * output, int64_t n, int hashSize, int minLen)
+    t->result = bsc_lzp_encode_block(t->input, t->input + t->inputSize, t->output, t->output + t->inputSize, t->hashSize, t->minLen);
+    if (t->result < LZP_NO_ERROR) t->result = t->inputSize;
+}
+
+static void
+lzp_decode_task(void *arg)
 {
-    if (unsigned char * buffer = (unsigned char *)bsc_malloc(n * sizeof(unsigned char)))
+    struct lzp_task *t = (struct lzp_task *)arg;
+
+    if (t->inputSize != t->outputSize)
     {
-        int compressionResult[ALPHABET_SIZE];
+        t->result = bsc_lzp_decode_block(t->input, t->input + t->inputSize, t->output, t->hashSize, t->minLen);
+        if (t->result >= LZP_NO_ERROR && t->result != t->outputSize) t->result = LZP_DATA_CORRUPT;
+    }
+    else
+    {
+        t->result = t->inputSize; memcpy(t->output, t->input, t->inputSize);
+    }
+}
 
-        int nBlocks   = bsc_lzp_num_blocks(n);
-        int result    = LZP_NO_ERROR;
-        int chunkSize = n / nBlocks;
+/*
+ * Encode all the blocks concurrently on the worker pool. Each block is encoded
+ * into its own region of a scratch buffer and the results are then packed
+ * into the output after the block table. The stream layout is the same as
+ * produced by the serial encoder.
+ */
+static
+int64_t bsc_lzp_compress_parallel(const unsigned char * input, unsigned char * output, int64_t n, int hashSize, int minLen)
+{
+    struct lzp_task tasks[ALPHABET_SIZE];
+    unsigned char *buffer;
+    int nBlocks = bsc_lzp_num_blocks(n);
+    int64_t chunkSize, outputPtr;
+    int blockId;
+    DEBUG_STAT_EN(double strt, en);
 
-        int numThreads = omp_get_max_threads();
-        if (numThreads > nBlocks) numThreads = nBlocks;
+    buffer = (unsigned char *)slab_alloc(NULL, n);
+    if (buffer == NULL) return LZP_NOT_ENOUGH_MEMORY;
 
-        output[0] = nBlocks;
-        #pragma omp parallel num_threads(numThreads) if(numThreads > 1)
-        {
-            if (omp_get_num_threads() == 1)
-            {
-                result = bsc_lzp_compress_serial(input, output, n, hashSize, minLen);
-            }
-            else
-            {
-                #pragma omp for schedule(dynamic)
-                for (int blockId = 0; blockId < nBlocks; ++blockId)
-                {
-                    int blockStart   = blockId * chunkSize;
-                    int blockSize    = blockId != nBlocks - 1 ? chunkSize : n - blockStart;
+    DEBUG_STAT_EN(strt = get_wtime_millis());
+    if (n > LZP_MAX_BLOCK)
+        chunkSize = LZP_MAX_BLOCK;
+    else
+        chunkSize = n / nBlocks;
 
-                    compressionResult[blockId] = bsc_lzp_encode_block(input + blockStart, input + blockStart + blockSize, buffer + blockStart, buffer + blockStart + blockSize, hashSize, minLen);
-                    if (compressionResult[blockId] < LZP_NO_ERROR) compressionResult[blockId] = blockSize;
+    for (blockId = 0; blockId < nBlocks; ++blockId)
+    {
+        int64_t inputStart = blockId * chunkSize;
 
-                    *(int *)(output + 1 + 8 * blockId + 0) = blockSize;
-                    *(int *)(output + 1 + 8 * blockId + 4) = compressionResult[blockId];
-                }
+        tasks[blockId].input = input + inputStart;
+        tasks[blockId].output = buffer + inputStart;
+        tasks[blockId].inputSize = blockId != nBlocks - 1 ? chunkSize : n - inputStart;
+        tasks[blockId].hashSize = hashSize;
+        tasks[blockId].minLen = minLen;
+    }
+    wpool_run(lzp_wpool, lzp_encode_task, tasks, sizeof (struct lzp_task), nBlocks);
 
-                #pragma omp single
-                {
-                    result = 1 + 8 * nBlocks;
-                    for (int blockId = 0; blockId < nBlocks; ++blockId)
-                    {
-                        result += compressionResult[blockId];
-                    }
+    outputPtr = 1 + 8 * nBlocks;
+    for (blockId = 0; blockId < nBlocks; ++blockId)
+        outputPtr += tasks[blockId].result;
+    if (outputPtr >= n)
+    {
+        slab_free(NULL, buffer);
+        return LZP_NOT_COMPRESSIBLE;
+    }
 
-                    if (result >= n) result = LZP_NOT_COMPRESSIBLE;
-                }
+    output[0] = nBlocks;
+    outputPtr = 1 + 8 * nBlocks;
+    for (blockId = 0; blockId < nBlocks; ++blockId)
+    {
+        struct lzp_task *t = &tasks[blockId];
 
-                if (result >= LZP_NO_ERROR)
-                {
-                    #pragma omp for schedule(dynamic)
-                    for (int blockId = 0; blockId < nBlocks; ++blockId)
-                    {
-                        int blockStart   = blockId * chunkSize;
-                        int blockSize    = blockId != nBlocks - 1 ? chunkSize : n - blockStart;
-
-                        int outputPtr = 1 + 8 * nBlocks;
-                        for (int p = 0; p < blockId; ++p) outputPtr += compressionResult[p];
-
-                        if (compressionResult[blockId] != blockSize)
-                        {
-                            memcpy(output + outputPtr, buffer + blockStart, compressionResult[blockId]);
-                        }
-                        else
-                        {
-                            memcpy(output + outputPtr, input + blockStart, compressionResult[blockId]);
-                        }
-                    }
-                }
-            }
-        }
+        if (t->result != t->inputSize)
+            memcpy(output + outputPtr, t->output, t->result);
+        else
+            memcpy(output + outputPtr, t->input, t->result);
 
-        bsc_free(buffer);
+        *(int *)(output + 1 + 8 * blockId + 0) = t->inputSize;
+        *(int *)(output + 1 + 8 * blockId + 4) = t->result;
 
-        return result;
+        outputPtr += t->result;
     }
-    return LZP_NOT_ENOUGH_MEMORY;
-}
+    slab_free(NULL, buffer);
+    DEBUG_STAT_EN(en = get_wtime_millis());
 
-#endif
+    DEBUG_STAT_EN(fprintf(stderr, "LZP: Insize: %" PRId64 ", Outsize: %" PRId64 "\n", n, outputPtr));
+    DEBUG_STAT_EN(fprintf(stderr, "LZP: Processed at %.3f MB/s\n", get_mb_s(n, strt, en)));
+    return outputPtr;
+}
 
 int64_t lzp_compress(const unsigned char * input, unsigned char * output, int64_t n, int hashSize, int minLen, int features)
 {
-
-#ifdef LZP_OPENMP
-
-    if ((bsc_lzp_num_blocks(n) != 1) && (features & LZP_FEATURE_MULTITHREADING))
+    if ((bsc_lzp_num_blocks(n) != 1) && (features & LZP_FEATURE_MULTITHREADING) &&
+        lzp_wpool != NULL && lzp_wpool->nthreads > 0)
     {
         return bsc_lzp_compress_parallel(input, output, n, hashSize, minLen);
     }
 
-#endif
-
     return bsc_lzp_compress_serial(input, output, n, hashSize, minLen);
 }
 
 int64_t lzp_decompress(const unsigned char * input, unsigned char * output, int64_t n, int hashSize, int minLen, int features)
 {
-    int nBlocks = input[0];
+    struct lzp_task tasks[ALPHABET_SIZE];
+    int64_t inputPtr, outputPtr;
+    int nBlocks, blockId;
+
+    if (n < 1) return LZP_UNEXPECTED_EOB;
+    nBlocks = input[0];
 
     if (nBlocks == 1)
     {
         return bsc_lzp_decode_block(input + 1, input + n, output, hashSize, minLen);
     }
-
-    int decompressionResult[ALPHABET_SIZE];
-
-#ifdef LZP_OPENMP
-
-    if (features & LZP_FEATURE_MULTITHREADING)
+    if (nBlocks == 0 || n < 1 + 8 * nBlocks) return LZP_DATA_CORRUPT;
+
+    /*
+     * The block table gives the encoded and original size of every block so
+     * the input and output offsets are known upfront and the blocks can be
+     * decoded independently.
+     */
+    inputPtr = 1 + 8 * nBlocks;
+    outputPtr = 0;
+    for (blockId = 0; blockId < nBlocks; ++blockId)
     {
-        #pragma omp parallel for schedule(dynamic)
-        for (int blockId = 0; blockId < nBlocks; ++blockId)
-        {
-            int inputPtr = 0;  for (int p = 0; p < blockId; ++p) inputPtr  += *(int *)(input + 1 + 8 * p + 4);
-            int outputPtr = 0; for (int p = 0; p < blockId; ++p) outputPtr += *(int *)(input + 1 + 8 * p + 0);
-
-            inputPtr += 1 + 8 * nBlocks;
-
-            int inputSize  = *(int *)(input + 1 + 8 * blockId + 4);
-            int outputSize = *(int *)(input + 1 + 8 * blockId + 0);
-
-            if (inputSize != outputSize)
-            {
-                decompressionResult[blockId] = bsc_lzp_decode_block(input + inputPtr, input + inputPtr + inputSize, output + outputPtr, hashSize, minLen);
-            }
-            else
-            {
-                decompressionResult[blockId] = inputSize; memcpy(output + outputPtr, input + inputPtr, inputSize);
-            }
-        }
+        struct lzp_task *t = &tasks[blockId];
+
+        t->inputSize  = *(int *)(input + 1 + 8 * blockId + 4);
+        t->outputSize = *(int *)(input + 1 + 8 * blockId + 0);
+        if (t->inputSize < 0 || t->outputSize < 0 || t->inputSize > n - inputPtr)
+            return LZP_DATA_CORRUPT;
+        t->input = input + inputPtr;
+        t->output = output + outputPtr;
+        t->hashSize = hashSize;
+        t->minLen = minLen;
+
+        inputPtr += t->inputSize;
+        outputPtr += t->outputSize;
     }
-    else
-
-#endif
-
-    {
-	int blockId, p;
 
-        for (blockId = 0; blockId < nBlocks; ++blockId)
-        {
-            int64_t inputPtr = 0;  for (p = 0; p < blockId; ++p) inputPtr  += *(int *)(input + 1 + 8 * p + 4);
-            int64_t outputPtr = 0; for (p = 0; p < blockId; ++p) outputPtr += *(int *)(input + 1 + 8 * p + 0);
-
-            inputPtr += 1 + 8 * nBlocks;
+    wpool_run((features & LZP_FEATURE_MULTITHREADING) ? lzp_wpool : NULL, lzp_decode_task,
+        tasks, sizeof (struct lzp_task), nBlocks);
 
-            int inputSize  = *(int *)(input + 1 + 8 * blockId + 4);
-            int outputSize = *(int *)(input + 1 + 8 * blockId + 0);
-
-            if (inputSize != outputSize)
-            {
-                decompressionResult[blockId] = bsc_lzp_decode_block(input + inputPtr, input + inputPtr + inputSize, output + outputPtr, hashSize, minLen);
-            }
-            else
-            {
-                decompressionResult[blockId] = inputSize; memcpy(output + outputPtr, input + inputPtr, inputSize);
-            }
-        }
-    }
-
-    int64_t dataSize = 0;
-    int result = LZP_NO_ERROR;
-    int blockId;
     for (blockId = 0; blockId < nBlocks; ++blockId)
     {
-        if (decompressionResult[blockId] < LZP_NO_ERROR) result = decompressionResult[blockId];
-        dataSize += decompressionResult[blockId];
+        if (tasks[blockId].result < LZP_NO_ERROR) return tasks[blockId].result;
     }
 
-    return (result == LZP_NO_ERROR) ? dataSize : result;
+    return outputPtr;
 }
 
 /*
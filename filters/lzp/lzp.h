@@ -61,6 +61,8 @@ See also the bsc and libbsc web site:
 #ifndef _LZP_H
 #define _LZP_H
 
+#include <wpool.h>
+
 #define LZP_NO_ERROR                0
 #define LZP_BAD_PARAMETER          -1
 #define LZP_NOT_ENOUGH_MEMORY      -2
@@ -71,6 +73,7 @@ See also the bsc and libbsc web site:
 
 #define LZP_DEFAULT_LZPHASHSIZE    16
 #define LZP_DEFAULT_LZPMINLEN      128
+#define LZP_FEATURE_MULTITHREADING 1
 #define	LZP_MAX_BLOCK              (2000000000LL)
 #define	ALPHABET_SIZE              (256)
 
@@ -103,6 +106,12 @@ extern "C" {
     int64_t lzp_decompress(const unsigned char * input, unsigned char * output, int64_t n, int hashSize, int minLen, int features);
 
     int lzp_hash_size(int level);
+
+    /**
+    * Set the worker pool used to process the blocks of a stream in parallel
+    * when LZP_FEATURE_MULTITHREADING is given. A NULL pool disables this.
+    */
+    void lzp_set_wpool(wpool_t *wp);
 #ifdef __cplusplus
 }
 #endif
@@ -22,19 +22,72 @@
  * moinakg@belenix.org, http://moinakg.wordpress.com/
  */
 
+#include "utils.h"
 #include "transpose.h"
 
+#define	CPUCAP_NM(x)	x##_scalar
+#include "transpose_simd.c"
+
+typedef void (*transp_func_t)(const uchar_t *from, uchar_t *to, uint64_t n);
+
+extern void transpose_split4_SSE2(const uchar_t *from, uchar_t *to, uint64_t n);
+extern void transpose_merge4_SSE2(const uchar_t *from, uchar_t *to, uint64_t n);
+extern void transpose_split8_SSE2(const uchar_t *from, uchar_t *to, uint64_t n);
+extern void transpose_merge8_SSE2(const uchar_t *from, uchar_t *to, uint64_t n);
+extern void transpose_split4_AVX2(const uchar_t *from, uchar_t *to, uint64_t n);
+extern void transpose_merge4_AVX2(const uchar_t *from, uchar_t *to, uint64_t n);
+extern void transpose_split8_AVX2(const uchar_t *from, uchar_t *to, uint64_t n);
+extern void transpose_merge8_AVX2(const uchar_t *from, uchar_t *to, uint64_t n);
+
+static transp_func_t split4 = transpose_split4_scalar;
+static transp_func_t merge4 = transpose_merge4_scalar;
+static transp_func_t split8 = transpose_split8_scalar;
+static transp_func_t merge8 = transpose_merge8_scalar;
+
+void
+transpose_module_init(processor_cap_t *pc)
+{
+	if (pc->proc_type != PROC_X64_INTEL && pc->proc_type != PROC_X64_AMD)
+		return;
+	if (pc->avx_level >= 2) {
+		split4 = transpose_split4_AVX2;
+		merge4 = transpose_merge4_AVX2;
+		split8 = transpose_split8_AVX2;
+		merge8 = transpose_merge8_AVX2;
+	} else if (pc->sse_level >= 2) {
+		split4 = transpose_split4_SSE2;
+		merge4 = transpose_merge4_SSE2;
+		split8 = transpose_split8_SSE2;
+		merge8 = transpose_merge8_SSE2;
+	}
+}
+
 /*
  * Perform a simple matrix transpose of the given buffer in "from".
  * If the buffer contains tables of numbers or structured data a
  * transpose can potentially help improve compression ratio by
  * bringing repeating values in columns into row ordering.
+ *
+ * A row transpose splits the elements of size stride into byte planes and
+ * a column transpose merges them back. Strides of 4 and 8 bytes have vector
+ * kernels, other strides use the plain copy loop. Trailing bytes that do not
+ * make up a whole element are left untouched in "to".
  */
 void
 transpose(unsigned char *from, unsigned char *to, uint64_t buflen, uint64_t stride, rowcol_t rc)
 {
 	uint64_t rows, cols, i, j, k, l;
 
+	if (stride == 4 || stride == 8) {
+		uint64_t n = buflen / stride;
+
+		if (rc == ROW)
+			(stride == 4 ? split4 : split8)(from, to, n);
+		else
+			(stride == 4 ? merge4 : merge8)(from, to, n);
+		return;
+	}
+
 	if (rc == ROW) {
 		rows = buflen / stride;
 		cols = stride;
@@ -28,6 +28,7 @@
 #include <sys/types.h>
 #include <stdint.h>
 #include <inttypes.h>
+#include <utils.h>
 
 #ifdef	__cplusplus
 extern "C" {
@@ -40,6 +41,7 @@ typedef enum {
 
 void transpose(unsigned char *from, unsigned char *to, uint64_t buflen,
 	       uint64_t stride, rowcol_t rc);
+void transpose_module_init(processor_cap_t *pc);
 
 #ifdef	__cplusplus
 }
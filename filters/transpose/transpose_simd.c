@@ -0,0 +1,301 @@
+/*
+ * This file is a part of Pcompress, a chunked parallel multi-
+ * algorithm lossless compression and decompression program.
+ *
+ * Copyright (C) 2012-2013 Moinak Ghosh. All rights reserved.
+ * Use is subject to license terms.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ * moinakg@belenix.org, http://moinakg.wordpress.com/
+ */
+
+
+/*
+ * Byte plane split and merge kernels for 4 and 8 byte strides. This file is
+ * included by transpose_sse2.c and transpose_avx2.c which define CPUCAP_NM and
+ * one of TRANSPOSE_SSE2 or TRANSPOSE_AVX2 to select the vector width. Without
+ * either of those the plain scalar loops are built.
+ *
+ * Split writes byte k of each of the n elements to plane k, that is to
+ * to[k * n + j]. Merge is the inverse. The vector loops handle whole groups of
+ * elements and the scalar loops finish the remainder.
+ */
+
+#include <stdint.h>
+#include "utils.h"
+#include "transpose.h"
+
+#if defined(TRANSPOSE_AVX2)
+#include <immintrin.h>
+#elif defined(TRANSPOSE_SSE2)
+#include <emmintrin.h>
+#endif
+
+#if defined(TRANSPOSE_SSE2) || defined(TRANSPOSE_AVX2)
+/*
+ * 128-bit kernels. Split isolates byte k of every element in the low byte of
+ * the element and narrows with saturating packs, which cannot saturate as the
+ * values are below 256. Merge interleaves the planes with unpacks.
+ */
+#define	LD(p)		_mm_loadu_si128((const __m128i *)(p))
+#define	ST(p, v)	_mm_storeu_si128((__m128i *)(p), v)
+
+static uint64_t
+split4_128(const uchar_t *from, uchar_t *to, uint64_t n)
+{
+	__m128i a, b, c, d, m;
+	uint64_t j;
+	int k;
+
+	m = _mm_set1_epi32(0xff);
+	for (j = 0; j + 16 <= n; j += 16) {
+		a = LD(from + j * 4);
+		b = LD(from + j * 4 + 16);
+		c = LD(from + j * 4 + 32);
+		d = LD(from + j * 4 + 48);
+		for (k = 0; k < 4; k++) {
+			__m128i ab, cd;
+
+			ab = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a, k * 8), m),
+			    _mm_and_si128(_mm_srli_epi32(b, k * 8), m));
+			cd = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(c, k * 8), m),
+			    _mm_and_si128(_mm_srli_epi32(d, k * 8), m));
+			ST(to + k * n + j, _mm_packus_epi16(ab, cd));
+		}
+	}
+	return (j);
+}
+
+static uint64_t
+merge4_128(const uchar_t *from, uchar_t *to, uint64_t n)
+{
+	__m128i p0, p1, p2, p3, l01, h01, l23, h23;
+	uint64_t j;
+
+	for (j = 0; j + 16 <= n; j += 16) {
+		p0 = LD(from + j);
+		p1 = LD(from + n + j);
+		p2 = LD(from + 2 * n + j);
+		p3 = LD(from + 3 * n + j);
+		l01 = _mm_unpacklo_epi8(p0, p1);
+		h01 = _mm_unpackhi_epi8(p0, p1);
+		l23 = _mm_unpacklo_epi8(p2, p3);
+		h23 = _mm_unpackhi_epi8(p2, p3);
+		ST(to + j * 4, _mm_unpacklo_epi16(l01, l23));
+		ST(to + j * 4 + 16, _mm_unpackhi_epi16(l01, l23));
+		ST(to + j * 4 + 32, _mm_unpacklo_epi16(h01, h23));
+		ST(to + j * 4 + 48, _mm_unpackhi_epi16(h01, h23));
+	}
+	return (j);
+}
+
+static uint64_t
+split8_128(const uchar_t *from, uchar_t *to, uint64_t n)
+{
+	__m128i v[8], p[4], q0, q1, m;
+	uint64_t j;
+	int i, k;
+
+	m = _mm_set1_epi64x(0xff);
+	for (j = 0; j + 16 <= n; j += 16) {
+		for (i = 0; i < 8; i++)
+			v[i] = LD(from + j * 8 + i * 16);
+		for (k = 0; k < 8; k++) {
+			for (i = 0; i < 4; i++) {
+				p[i] = _mm_packs_epi32(
+				    _mm_and_si128(_mm_srli_epi64(v[2 * i], k * 8), m),
+				    _mm_and_si128(_mm_srli_epi64(v[2 * i + 1], k * 8), m));
+			}
+			q0 = _mm_packs_epi32(p[0], p[1]);
+			q1 = _mm_packs_epi32(p[2], p[3]);
+			ST(to + k * n + j, _mm_packus_epi16(q0, q1));
+		}
+	}
+	return (j);
+}
+
+static uint64_t
+merge8_128(const uchar_t *from, uchar_t *to, uint64_t n)
+{
+	__m128i p[8], a[8], b[8];
+	uint64_t j;
+	int i;
+
+	for (j = 0; j + 16 <= n; j += 16) {
+		for (i = 0; i < 8; i++)
+			p[i] = LD(from + i * n + j);
+		for (i = 0; i < 4; i++) {
+			a[2 * i] = _mm_unpacklo_epi8(p[2 * i], p[2 * i + 1]);
+			a[2 * i + 1] = _mm_unpackhi_epi8(p[2 * i], p[2 * i + 1]);
+		}
+
+		/*
+		 * b[0-3] hold bytes 0-3 and b[4-7] bytes 4-7 of elements 0-3, 4-7,
+		 * 8-11 and 12-15.
+		 */
+		for (i = 0; i < 2; i++) {
+			b[i * 4] = _mm_unpacklo_epi16(a[i * 4], a[i * 4 + 2]);
+			b[i * 4 + 1] = _mm_unpackhi_epi16(a[i * 4], a[i * 4 + 2]);
+			b[i * 4 + 2] = _mm_unpacklo_epi16(a[i * 4 + 1], a[i * 4 + 3]);
+			b[i * 4 + 3] = _mm_unpackhi_epi16(a[i * 4 + 1], a[i * 4 + 3]);
+		}
+		for (i = 0; i < 4; i++) {
+			ST(to + j * 8 + i * 32, _mm_unpacklo_epi32(b[i], b[i + 4]));
+			ST(to + j * 8 + i * 32 + 16, _mm_unpackhi_epi32(b[i], b[i + 4]));
+		}
+	}
+	return (j);
+}
+#endif
+
+#if defined(TRANSPOSE_AVX2)
+/*
+ * 256-bit kernels for the 4-byte stride. Split gathers the planes within each
+ * 128-bit lane with a byte shuffle, collects each plane into adjacent dwords
+ * and then regroups four vectors with a 4x4 transpose of 64-bit words.
+ */
+static uint64_t
+split4_256(const uchar_t *from, uchar_t *to, uint64_t n)
+{
+	__m256i v[4], t0, t1, t2, t3, shuf, perm;
+	uint64_t j;
+	int i;
+
+	shuf = _mm256_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15,
+	    0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+	perm = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	for (j = 0; j + 32 <= n; j += 32) {
+		for (i = 0; i < 4; i++) {
+			v[i] = _mm256_loadu_si256((const __m256i *)(from + j * 4 + i * 32));
+			v[i] = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v[i], shuf), perm);
+		}
+		t0 = _mm256_unpacklo_epi64(v[0], v[1]);
+		t1 = _mm256_unpackhi_epi64(v[0], v[1]);
+		t2 = _mm256_unpacklo_epi64(v[2], v[3]);
+		t3 = _mm256_unpackhi_epi64(v[2], v[3]);
+		_mm256_storeu_si256((__m256i *)(to + j),
+		    _mm256_permute2x128_si256(t0, t2, 0x20));
+		_mm256_storeu_si256((__m256i *)(to + n + j),
+		    _mm256_permute2x128_si256(t1, t3, 0x20));
+		_mm256_storeu_si256((__m256i *)(to + 2 * n + j),
+		    _mm256_permute2x128_si256(t0, t2, 0x31));
+		_mm256_storeu_si256((__m256i *)(to + 3 * n + j),
+		    _mm256_permute2x128_si256(t1, t3, 0x31));
+	}
+	return (j);
+}
+
+static uint64_t
+merge4_256(const uchar_t *from, uchar_t *to, uint64_t n)
+{
+	__m256i p0, p1, p2, p3, l01, h01, l23, h23, a, b, c, d;
+	uint64_t j;
+
+	for (j = 0; j + 32 <= n; j += 32) {
+		p0 = _mm256_loadu_si256((const __m256i *)(from + j));
+		p1 = _mm256_loadu_si256((const __m256i *)(from + n + j));
+		p2 = _mm256_loadu_si256((const __m256i *)(from + 2 * n + j));
+		p3 = _mm256_loadu_si256((const __m256i *)(from + 3 * n + j));
+		l01 = _mm256_unpacklo_epi8(p0, p1);
+		h01 = _mm256_unpackhi_epi8(p0, p1);
+		l23 = _mm256_unpacklo_epi8(p2, p3);
+		h23 = _mm256_unpackhi_epi8(p2, p3);
+
+		/*
+		 * Elements 0-3|16-19, 4-7|20-23, 8-11|24-27 and 12-15|28-31.
+		 */
+		a = _mm256_unpacklo_epi16(l01, l23);
+		b = _mm256_unpackhi_epi16(l01, l23);
+		c = _mm256_unpacklo_epi16(h01, h23);
+		d = _mm256_unpackhi_epi16(h01, h23);
+		_mm256_storeu_si256((__m256i *)(to + j * 4),
+		    _mm256_permute2x128_si256(a, b, 0x20));
+		_mm256_storeu_si256((__m256i *)(to + j * 4 + 32),
+		    _mm256_permute2x128_si256(c, d, 0x20));
+		_mm256_storeu_si256((__m256i *)(to + j * 4 + 64),
+		    _mm256_permute2x128_si256(a, b, 0x31));
+		_mm256_storeu_si256((__m256i *)(to + j * 4 + 96),
+		    _mm256_permute2x128_si256(c, d, 0x31));
+	}
+	return (j);
+}
+#endif
+
+void
+CPUCAP_NM(transpose_split4)(const uchar_t *from, uchar_t *to, uint64_t n)
+{
+	uint64_t j = 0;
+
+#if defined(TRANSPOSE_AVX2)
+	j = split4_256(from, to, n);
+#elif defined(TRANSPOSE_SSE2)
+	j = split4_128(from, to, n);
+#endif
+	for (; j < n; j++) {
+		to[j] = from[j * 4];
+		to[n + j] = from[j * 4 + 1];
+		to[2 * n + j] = from[j * 4 + 2];
+		to[3 * n + j] = from[j * 4 + 3];
+	}
+}
+
+void
+CPUCAP_NM(transpose_merge4)(const uchar_t *from, uchar_t *to, uint64_t n)
+{
+	uint64_t j = 0;
+
+#if defined(TRANSPOSE_AVX2)
+	j = merge4_256(from, to, n);
+#elif defined(TRANSPOSE_SSE2)
+	j = merge4_128(from, to, n);
+#endif
+	for (; j < n; j++) {
+		to[j * 4] = from[j];
+		to[j * 4 + 1] = from[n + j];
+		to[j * 4 + 2] = from[2 * n + j];
+		to[j * 4 + 3] = from[3 * n + j];
+	}
+}
+
+void
+CPUCAP_NM(transpose_split8)(const uchar_t *from, uchar_t *to, uint64_t n)
+{
+	uint64_t j = 0;
+	int k;
+
+#if defined(TRANSPOSE_SSE2) || defined(TRANSPOSE_AVX2)
+	j = split8_128(from, to, n);
+#endif
+	for (; j < n; j++) {
+		for (k = 0; k < 8; k++)
+			to[k * n + j] = from[j * 8 + k];
+	}
+}
+
+void
+CPUCAP_NM(transpose_merge8)(const uchar_t *from, uchar_t *to, uint64_t n)
+{
+	uint64_t j = 0;
+	int k;
+
+#if defined(TRANSPOSE_SSE2) || defined(TRANSPOSE_AVX2)
+	j = merge8_128(from, to, n);
+#endif
+	for (; j < n; j++) {
+		for (k = 0; k < 8; k++)
+			to[j * 8 + k] = from[k * n + j];
+	}
+}
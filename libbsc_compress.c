@@ -31,9 +31,18 @@
 #include <pcompress.h>
 #include <allocator.h>
 #include <libbsc.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 // 1G
 #define	BSC_MAX_CHUNK	1073741824L
+#define	BSC_MAX_THREADS	8
+
+/*
+ * OpenMP team size for libbsc parallel sections in each chunk thread.
+ */
+static int bsc_threads = 1;
 
 struct libbsc_params {
 	int lzpHashSize;
@@ -41,6 +50,7 @@ struct libbsc_params {
 	int bscCoder;
 	int features;
 	int oldversion;
+	int nthreads;
 };
 
 static void
@@ -76,10 +86,27 @@ libbsc_buf_extra(uint64_t buflen)
 }
 
 
+/*
+ * Give libbsc a share of the CPUs that the chunk threads leave over, the same
+ * CPUs that size the shared worker pool. Each of the nchunk threads may run
+ * OpenMP teams of 1 + spare / nchunk threads, so the total thread count stays
+ * within the CPU count also when several chunks are compressed at once. Must
+ * be called before libbsc_init().
+ */
+void
+libbsc_set_threads(int spare, int nchunk)
+{
+	if (nchunk < 1)
+		nchunk = 1;
+	bsc_threads = 1 + (spare > 0 ? spare / nchunk : 0);
+	if (bsc_threads > BSC_MAX_THREADS)
+		bsc_threads = BSC_MAX_THREADS;
+}
+
 /*
  * BSC uses OpenMP where it does not control thread count
- * deterministically. We only use multithread capability in BSC
- * when compressing entire file in a single chunk.
+ * deterministically. The team size is therefore pinned per chunk thread via
+ * omp_set_num_threads() before every libbsc call.
  */
 void
 libbsc_props(algo_props_t *data, int level, uint64_t chunksize) {
@@ -111,7 +138,8 @@ libbsc_init(void **data, int *level, int nthreads, uint64_t chunksize,
 	bscdat = slab_alloc(NULL, sizeof (struct libbsc_params));
 
 	bscdat->features = LIBBSC_FEATURE_FASTMODE;
-	if (nthreads > 1)
+	bscdat->nthreads = (nthreads > bsc_threads ? nthreads : bsc_threads);
+	if (bscdat->nthreads > 1)
 		bscdat->features |= LIBBSC_FEATURE_MULTITHREADING;
 
 	if (*level > 9) *level = 9;
@@ -171,6 +199,9 @@ libbsc_compress(void *src, uint64_t srclen, void *dst, uint64_t *dstlen,
 			return (-1);
 	}
 
+#ifdef _OPENMP
+	omp_set_num_threads(bscdat->nthreads);
+#endif
 	rv = bsc_compress(src, dst, srclen, bscdat->lzpHashSize, bscdat->lzpMinLen,
 	    LIBBSC_BLOCKSORTER_BWT, bscdat->bscCoder, bscdat->features);
 	if (rv < 0) {
@@ -188,6 +219,9 @@ libbsc_decompress(void *src, uint64_t srclen, void *dst, uint64_t *dstlen,
 	int rv;
 	struct libbsc_params *bscdat = (struct libbsc_params *)data;
 
+#ifdef _OPENMP
+	omp_set_num_threads(bscdat->nthreads);
+#endif
 	if (bscdat->oldversion)
 		rv = bsc_decompress_old(src, srclen, dst, *dstlen, bscdat->features);
 	else
@@ -425,6 +425,7 @@ typedef struct
   UInt32 matchFinderCycles;
 
   int needInit;
+  UInt32 primeLen;
 
   CSaveState saveState;
 } CLzmaEnc;
@@ -1875,6 +1876,7 @@ void LzmaEnc_Construct(CLzmaEnc *p)
   LzmaEnc_InitPriceTables(p->ProbPrices);
   p->litProbs = 0;
   p->saveState.litProbs = 0;
+  p->primeLen = 0;
 }
 
 CLzmaEncHandle LzmaEnc_Create(ISzAlloc *alloc)
@@ -1917,6 +1919,16 @@ static SRes LzmaEnc_CodeOneBlock(CLzmaEnc *p, Bool useLimits, UInt32 maxPackSize
   {
     p->matchFinder.Init(p->matchFinderObj);
     p->needInit = 0;
+    /*
+     * The first primeLen bytes of input are only entered into the
+     * match finder. Encoding starts after them as if they were already
+     * coded, so that matches can refer back into the priming window.
+     */
+    if (p->primeLen != 0)
+    {
+      p->matchFinder.Skip(p->matchFinderObj, p->primeLen);
+      p->nowPos64 = p->primeLen;
+    }
   }
 
   if (p->finished)
@@ -2449,6 +2461,71 @@ SRes LzmaEnc_MemEncode(CLzmaEncHandle pp, Byte *dest, SizeT *destLen, const Byte
   return res;
 }
 
+typedef struct
+{
+  ISeqInStream funcTable;
+  const Byte *buf[2];
+  SizeT rem[2];
+} CSeqInStreamPrimed;
+
+static SRes PrimedRead(void *pp, void *data, size_t *size)
+{
+  CSeqInStreamPrimed *p = (CSeqInStreamPrimed *)pp;
+  int i = (p->rem[0] == 0);
+  size_t sz = *size;
+
+  if (sz > p->rem[i])
+    sz = p->rem[i];
+  memcpy(data, p->buf[i], sz);
+  p->buf[i] += sz;
+  p->rem[i] -= sz;
+  *size = sz;
+  return SZ_OK;
+}
+
+SRes LzmaEncodePrimed(Byte *dest, SizeT *destLen, const Byte *prime, SizeT primeLen,
+    const Byte *src, SizeT srcLen, CLzmaEncProps *props, Byte *propsEncoded,
+    SizeT *propsSize, ISzAlloc *alloc, ISzAlloc *allocBig)
+{
+  CLzmaEnc *p;
+  CSeqOutStreamBuf outStream;
+  CSeqInStreamPrimed inStream;
+  SRes res = SZ_OK;
+
+  if (primeLen > props->dictSize || primeLen > ((UInt32)1 << 31))
+    return SZ_ERROR_PARAM;
+  p = (CLzmaEnc *)LzmaEnc_Create(alloc);
+  if (p == 0)
+    return SZ_ERROR_MEM;
+
+  outStream.funcTable.Write = MyWrite;
+  outStream.data = dest;
+  outStream.rem = *destLen;
+  outStream.overflow = False;
+  inStream.funcTable.Read = PrimedRead;
+  inStream.buf[0] = prime;
+  inStream.rem[0] = primeLen;
+  inStream.buf[1] = src;
+  inStream.rem[1] = srcLen;
+
+  res = LzmaEnc_SetProps(p, props);
+  if (res == SZ_OK)
+    res = LzmaEnc_WriteProperties(p, propsEncoded, propsSize);
+  if (res == SZ_OK)
+  {
+    p->writeEndMark = 0;
+    p->primeLen = (UInt32)primeLen;
+    res = LzmaEnc_Encode(p, &outStream.funcTable, &inStream.funcTable, NULL,
+        alloc, allocBig);
+  }
+  LzmaEnc_Destroy(p, alloc, allocBig);
+
+  *destLen -= outStream.rem;
+  if (outStream.overflow)
+    return SZ_ERROR_OUTPUT_EOF;
+  return res;
+}
+
 SRes LzmaEncode(Byte *dest, SizeT *destLen, const Byte *src, SizeT srcLen,
     CLzmaEncProps *props, Byte *propsEncoded, SizeT *propsSize, int writeEndMark,
     ICompressProgress *progress, ISzAlloc *alloc, ISzAlloc *allocBig)
@@ -96,5 +96,15 @@ extern SRes LzmaEncode(Byte *dest, SizeT *destLen, const Byte *src, SizeT srcLen
     CLzmaEncProps *props, Byte *propsEncoded, SizeT *propsSize, int writeEndMark,
     ICompressProgress *progress, ISzAlloc *alloc, ISzAlloc *allocBig);
 
+/* LzmaEncodePrimed
+   Same as LzmaEncode without an end mark, but the encoder window is first
+   filled with primeLen bytes of prime data that are not themselves encoded.
+   The decoder must place the same bytes in front of its output buffer.
+   primeLen must not exceed the dictionary size.
+*/
+
+extern SRes LzmaEncodePrimed(Byte *dest, SizeT *destLen, const Byte *prime, SizeT primeLen,
+    const Byte *src, SizeT srcLen, CLzmaEncProps *props, Byte *propsEncoded,
+    SizeT *propsSize, ISzAlloc *alloc, ISzAlloc *allocBig);
 
 #endif
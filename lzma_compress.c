@@ -25,6 +25,7 @@
 
 #include <sys/types.h>
 #include <stdio.h>
+#include <string.h>
 #include <strings.h>
 #include <LzmaEnc.h>
 #include <LzmaDec.h>
@@ -35,7 +36,27 @@
 #define	SZ_ERROR_DESTLEN	100
 #define	LZMA_DEFAULT_DICT	(1 << 24)
 
+/*
+ * Sub-block parameters for lzmaMtX. Sub-blocks are never smaller than
+ * LZMA_MTX_MIN_BLK unless the chunk itself is.
+ */
+#define	LZMA_MTX_MIN_BLK	(4 * 1024 * 1024)
+#define	LZMA_MTX_MAX_BLKS	64
+#define	LZMA_MTX_MAX_THREADS	16
+#define	LZMA_MTX_HDR_SZ(n)	(1 + 8 + 8 + (n) * 8)
+
+/*
+ * Per-thread LZMA state. Encoder properties are shared by all threads. The
+ * priming window is only used in solid mode and is set before each chunk.
+ */
+typedef struct {
+	CLzmaEncProps *props;
+	uchar_t *prime;
+	uint64_t prime_len;
+} lzma_data_t;
+
 CLzmaEncProps *p = NULL;
+static wpool_t *mtx_wpool = NULL;
 
 static ISzAlloc g_Alloc = {
 	slab_alloc,
@@ -48,6 +69,71 @@ lzma_stats(int show)
 {
 }
 
+/*
+ * Set the dictionary size and fast bytes based on level.
+ */
+static void
+lzma_set_props(CLzmaEncProps *props, int level, int nthreads)
+{
+	LzmaEncProps_Init(props);
+	if (level < 8) {
+		/*
+		 * Choose a dict size with a balance between perf and
+		 * compression.
+		 */
+		props->dictSize = LZMA_DEFAULT_DICT;
+
+	} else {
+		/*
+		 * Let LZMA determine best dict size.
+		 */
+		props->dictSize = 0;
+	}
+
+	/* Determine the fast bytes value and also adjust dict size further. */
+	if (level < 7) {
+		props->fb = 32;
+
+	} else if (level < 10) {
+		props->fb = 64;
+
+	} else if (level == 11) {
+		props->fb = 64;
+		props->mc = 128;
+
+	} else if (level == 12) {
+		props->fb = 128;
+		props->mc = 256;
+
+	} else if (level == 13) {
+		props->fb = 64;
+		props->mc = 128;
+		props->dictSize = (1 << 27);
+
+	} else if (level == 14) {
+		props->fb = 128;
+		props->mc = 256;
+		props->dictSize = (1 << 28);
+	}
+	if (level > 9) level = 9;
+	props->level = level;
+	props->numThreads = nthreads;
+	LzmaEncProps_Normalize(props);
+}
+
+/*
+ * Solid mode priming window. It is the dictionary size for the level, which
+ * the decompressor can derive as well.
+ */
+static uint64_t
+lzma_solid_window(int level)
+{
+	CLzmaEncProps props;
+
+	lzma_set_props(&props, level, 1);
+	return (props.dictSize);
+}
+
 void
 lzma_mt_props(algo_props_t *data, int level, uint64_t chunksize) {
 	data->compress_mt_capable = 1;
@@ -55,18 +141,43 @@ lzma_mt_props(algo_props_t *data, int level, uint64_t chunksize) {
 	data->buf_extra = 0;
 	data->c_max_threads = 2;
 	data->delta2_span = 150;
+	data->solid_window = lzma_solid_window(level);
+	if (level < 12)
+		data->deltac_min_distance = (EIGHTM * 16);
+	else
+		data->deltac_min_distance = (EIGHTM * 32);
+}
+
+void
+lzma_mtx_props(algo_props_t *data, int level, uint64_t chunksize) {
+	data->compress_mt_capable = 1;
+	data->decompress_mt_capable = 1;
+	data->buf_extra = LZMA_MTX_HDR_SZ(LZMA_MTX_MAX_BLKS);
+	data->c_max_threads = LZMA_MTX_MAX_THREADS;
+	data->d_max_threads = LZMA_MTX_MAX_THREADS;
+	data->delta2_span = 150;
 	if (level < 12)
 		data->deltac_min_distance = (EIGHTM * 16);
 	else
 		data->deltac_min_distance = (EIGHTM * 32);
 }
 
+/*
+ * Set the worker pool on which lzmaMtX sub-blocks are run.
+ */
+void
+lzma_set_wpool(wpool_t *wp)
+{
+	mtx_wpool = wp;
+}
+
 void
 lzma_props(algo_props_t *data, int level, uint64_t chunksize) {
 	data->compress_mt_capable = 0;
 	data->decompress_mt_capable = 0;
 	data->buf_extra = 0;
 	data->delta2_span = 150;
+	data->solid_window = lzma_solid_window(level);
 	if (level < 12)
 		data->deltac_min_distance = (EIGHTM * 16);
 	else
@@ -80,59 +191,21 @@ int
 lzma_init(void **data, int *level, int nthreads, uint64_t chunksize,
 	  int file_version, compress_op_t op)
 {
+	lzma_data_t *ld;
+
 	if (!p && op == COMPRESS) {
 		p = (CLzmaEncProps *)slab_alloc(NULL, sizeof (CLzmaEncProps));
-		LzmaEncProps_Init(p);
-		/*
-		 * Set the dictionary size and fast bytes based on level.
-		 */
-		if (*level < 8) {
-			/*
-			 * Choose a dict size with a balance between perf and
-			 * compression.
-			 */
-			p->dictSize = LZMA_DEFAULT_DICT;
-
-		} else {
-			/*
-			 * Let LZMA determine best dict size.
-			 */
-			p->dictSize = 0;
-		}
-
-		/* Determine the fast bytes value and also adjust dict size further. */
-		if (*level < 7) {
-			p->fb = 32;
-
-		} else if (*level < 10) {
-			p->fb = 64;
-
-		} else if (*level == 11) {
-			p->fb = 64;
-			p->mc = 128;
-
-		} else if (*level == 12) {
-			p->fb = 128;
-			p->mc = 256;
-
-		} else if (*level == 13) {
-			p->fb = 64;
-			p->mc = 128;
-			p->dictSize = (1 << 27);
-
-		} else if (*level == 14) {
-			p->fb = 128;
-			p->mc = 256;
-			p->dictSize = (1 << 28);
-		}
-		if (*level > 9) *level = 9;
-		p->level = *level;
-		p->numThreads = nthreads;
-		LzmaEncProps_Normalize(p);
+		lzma_set_props(p, *level, nthreads);
 		slab_cache_add(p->litprob_sz);
 	}
 	if (*level > 9) *level = 9;
-	*data = p;
+	ld = (lzma_data_t *)slab_alloc(NULL, sizeof (lzma_data_t));
+	if (ld == NULL)
+		return (1);
+	ld->props = p;
+	ld->prime = NULL;
+	ld->prime_len = 0;
+	*data = ld;
 	return (0);
 }
 
@@ -143,10 +216,25 @@ lzma_deinit(void **data)
 		slab_release(NULL, p);
 		p = NULL;
 	}
+	if (*data)
+		slab_release(NULL, *data);
 	*data = NULL;
 	return (0);
 }
 
+/*
+ * Set the window the next lzma_compress() or lzma_decompress() call on this
+ * thread's data is primed with. A zero length disables priming.
+ */
+void
+lzma_prime(void *data, uchar_t *buf, uint64_t len)
+{
+	lzma_data_t *ld = (lzma_data_t *)data;
+
+	ld->prime = buf;
+	ld->prime_len = len;
+}
+
 static void
 lzerr(int err, int cmp)
 {
@@ -204,7 +292,8 @@ lzma_compress(void *src, uint64_t srclen, void *dst,
 	SizeT props_len = LZMA_PROPS_SIZE;
 	SRes res;
 	Byte *_dst;
-	CLzmaEncProps *props = (CLzmaEncProps *)data;
+	lzma_data_t *ld = (lzma_data_t *)data;
+	CLzmaEncProps *props = ld->props;
 	SizeT dlen;
 
 	if (*dstlen < LZMA_PROPS_SIZE) {
@@ -219,8 +308,14 @@ lzma_compress(void *src, uint64_t srclen, void *dst,
 	_dst = (Byte *)dst;
 	*dstlen -= LZMA_PROPS_SIZE;
 	dlen = *dstlen;
-	res = LzmaEncode(_dst + LZMA_PROPS_SIZE, &dlen, (const uchar_t *)src, srclen,
-	    props, (uchar_t *)_dst, &props_len, 0, NULL, &g_Alloc, &g_Alloc);
+	if (ld->prime_len > 0) {
+		res = LzmaEncodePrimed(_dst + LZMA_PROPS_SIZE, &dlen, ld->prime,
+		    ld->prime_len, (const uchar_t *)src, srclen, props, (uchar_t *)_dst,
+		    &props_len, &g_Alloc, &g_Alloc);
+	} else {
+		res = LzmaEncode(_dst + LZMA_PROPS_SIZE, &dlen, (const uchar_t *)src, srclen,
+		    props, (uchar_t *)_dst, &props_len, 0, NULL, &g_Alloc, &g_Alloc);
+	}
 	*dstlen = dlen;
 
 	if (res != 0) {
@@ -232,6 +327,60 @@ lzma_compress(void *src, uint64_t srclen, void *dst,
 	return (0);
 }
 
+/*
+ * Decode a segment produced by a primed encoder. The decoder dictionary is a
+ * flat buffer holding the priming window followed by the output so that
+ * matches can reach back into the window.
+ */
+static int
+lzma_decompress_primed(const uchar_t *src, SizeT srclen, const uchar_t *props,
+	void *dst, uint64_t *dstlen, lzma_data_t *ld)
+{
+	CLzmaDec dec;
+	ELzmaStatus status;
+	uchar_t *dic;
+	SizeT dlen;
+	SRes res;
+
+	dic = (uchar_t *)slab_alloc(NULL, ld->prime_len + *dstlen);
+	if (dic == NULL) {
+		lzerr(SZ_ERROR_MEM, 0);
+		return (-1);
+	}
+	LzmaDec_Construct(&dec);
+	res = LzmaDec_AllocateProbs(&dec, props, LZMA_PROPS_SIZE, &g_Alloc);
+	if (res != SZ_OK) {
+		slab_release(NULL, dic);
+		lzerr(res, 0);
+		return (-1);
+	}
+	memcpy(dic, ld->prime, ld->prime_len);
+	dec.dic = dic;
+	dec.dicBufSize = ld->prime_len + *dstlen;
+	LzmaDec_Init(&dec);
+	dec.dicPos = ld->prime_len;
+	dec.processedPos = (UInt32)ld->prime_len;
+	if (dec.processedPos >= dec.prop.dicSize)
+		dec.checkDicSize = dec.prop.dicSize;
+
+	res = LzmaDec_DecodeToDic(&dec, dec.dicBufSize, src, &srclen, LZMA_FINISH_ANY,
+	    &status);
+	if (res == SZ_OK && status == LZMA_STATUS_NEEDS_MORE_INPUT)
+		res = SZ_ERROR_INPUT_EOF;
+	dlen = dec.dicPos - ld->prime_len;
+	LzmaDec_FreeProbs(&dec, &g_Alloc);
+	if (res != SZ_OK) {
+		slab_release(NULL, dic);
+		*dstlen = dlen;
+		lzerr(res, 0);
+		return (-1);
+	}
+	memcpy(dst, dic + ld->prime_len, dlen);
+	slab_release(NULL, dic);
+	*dstlen = dlen;
+	return (0);
+}
+
 int
 lzma_decompress(void *src, uint64_t srclen, void *dst,
 	uint64_t *dstlen, int level, uchar_t chdr, int btype, void *data)
@@ -246,6 +395,10 @@ lzma_decompress(void *src, uint64_t srclen, void *dst,
 	_src = (uchar_t *)src + LZMA_PROPS_SIZE;
 	dlen = *dstlen;
 
+	if (data != NULL && ((lzma_data_t *)data)->prime_len > 0)
+		return (lzma_decompress_primed(_src, _srclen, (uchar_t *)src, dst, dstlen,
+		    (lzma_data_t *)data));
+
 	if ((res = LzmaDecode((uchar_t *)dst, &dlen, _src, &_srclen,
 	    (uchar_t *)src, LZMA_PROPS_SIZE, LZMA_FINISH_ANY,
 	    &status, &g_Alloc)) != SZ_OK) {
@@ -257,3 +410,183 @@ lzma_decompress(void *src, uint64_t srclen, void *dst,
 	return (0);
 }
 
+
+/*
+ * lzmaMtX splits a chunk into sub-blocks that are LZMA compressed independently
+ * and in parallel on the shared worker pool. Decompression of the sub-blocks
+ * is parallel as well.
+ *
+ * lzmaMtX compressed segment format
+ * ---------------------------------
+ * Offset Size Description
+ *  0     1   Number of sub-blocks N
+ *  1     8   Total uncompressed size (big endian)
+ *  9     8   Uncompressed sub-block size, the last one holds the rest (big endian)
+ * 17     8*N Compressed size of each sub-block (big endian)
+ *  ..        N LZMA compressed segments in the format of lzma_compress()
+ */
+struct lzma_mtx_task {
+	uchar_t *src;
+	uint64_t srclen;
+	uchar_t *dst;
+	uint64_t dstlen;
+	CLzmaEncProps props;
+	int rv;
+};
+
+static void
+lzma_mtx_enc_task(void *arg)
+{
+	struct lzma_mtx_task *t = (struct lzma_mtx_task *)arg;
+	SizeT props_len = LZMA_PROPS_SIZE;
+	SizeT dlen;
+	SRes res;
+
+	t->rv = -1;
+	if (t->dstlen <= LZMA_PROPS_SIZE)
+		return;
+	dlen = t->dstlen - LZMA_PROPS_SIZE;
+	res = LzmaEncode(t->dst + LZMA_PROPS_SIZE, &dlen, t->src, t->srclen, &(t->props),
+	    t->dst, &props_len, 0, NULL, &g_Alloc, &g_Alloc);
+	if (res != 0) {
+		lzerr(res, 1);
+		return;
+	}
+	t->dstlen = dlen + LZMA_PROPS_SIZE;
+	t->rv = 0;
+}
+
+static void
+lzma_mtx_dec_task(void *arg)
+{
+	struct lzma_mtx_task *t = (struct lzma_mtx_task *)arg;
+	uint64_t dlen;
+
+	dlen = t->dstlen;
+	t->rv = lzma_decompress(t->src, t->srclen, t->dst, &dlen, 0, 0, 0, NULL);
+	if (t->rv == 0 && dlen != t->dstlen) {
+		lzerr(SZ_ERROR_DATA, 0);
+		t->rv = -1;
+	}
+}
+
+int
+lzma_mtx_compress(void *src, uint64_t srclen, void *dst,
+	uint64_t *dstlen, int level, uchar_t chdr, int btype, void *data)
+{
+	CLzmaEncProps *props = ((lzma_data_t *)data)->props;
+	struct lzma_mtx_task tasks[LZMA_MTX_MAX_BLKS];
+	uchar_t *_dst = (uchar_t *)dst;
+	uint64_t blksz, hdrsz, avail, pos, dpos, nblks, i;
+	UInt32 dict;
+
+	if (PC_SUBTYPE(btype) == TYPE_COMPRESSED_ZPAQ || srclen == 0)
+		return (-1);
+
+	nblks = props->numThreads;
+	if (nblks > srclen / LZMA_MTX_MIN_BLK)
+		nblks = srclen / LZMA_MTX_MIN_BLK;
+	if (nblks > LZMA_MTX_MAX_BLKS)
+		nblks = LZMA_MTX_MAX_BLKS;
+	if (nblks < 1)
+		nblks = 1;
+	blksz = (srclen + nblks - 1) / nblks;
+	nblks = (srclen + blksz - 1) / blksz;
+	hdrsz = LZMA_MTX_HDR_SZ(nblks);
+	if (*dstlen <= hdrsz) {
+		lzerr(SZ_ERROR_DESTLEN, 1);
+		return (-1);
+	}
+
+	/*
+	 * Each sub-block is compressed into its own share of the output buffer,
+	 * proportional to its size. The results are packed together afterwards.
+	 * A single threaded match finder is used per sub-block and the dictionary
+	 * need not be larger than the sub-block.
+	 */
+	avail = *dstlen - hdrsz;
+	dict = 1 << 12;
+	while (dict < blksz && dict < (1U << 30))
+		dict <<= 1;
+	pos = 0;
+	dpos = hdrsz;
+	for (i = 0; i < nblks; i++) {
+		struct lzma_mtx_task *t = &tasks[i];
+
+		t->src = (uchar_t *)src + pos;
+		t->srclen = (srclen - pos < blksz ? srclen - pos : blksz);
+		t->dst = _dst + dpos;
+		if (i == nblks - 1)
+			t->dstlen = *dstlen - dpos;
+		else
+			t->dstlen = (uint64_t)((double)avail * t->srclen / srclen);
+		t->props = *props;
+		t->props.level = level;
+		t->props.numThreads = 1;
+		if (t->props.dictSize > dict)
+			t->props.dictSize = dict;
+		pos += t->srclen;
+		dpos += t->dstlen;
+	}
+	wpool_run(mtx_wpool, lzma_mtx_enc_task, tasks, sizeof (struct lzma_mtx_task), nblks);
+
+	_dst[0] = nblks;
+	U64_P(_dst + 1) = htonll(srclen);
+	U64_P(_dst + 9) = htonll(blksz);
+	dpos = hdrsz;
+	for (i = 0; i < nblks; i++) {
+		if (tasks[i].rv != 0)
+			return (-1);
+		U64_P(_dst + 17 + i * 8) = htonll(tasks[i].dstlen);
+		if (tasks[i].dst != _dst + dpos)
+			memmove(_dst + dpos, tasks[i].dst, tasks[i].dstlen);
+		dpos += tasks[i].dstlen;
+	}
+	*dstlen = dpos;
+	return (0);
+}
+
+int
+lzma_mtx_decompress(void *src, uint64_t srclen, void *dst,
+	uint64_t *dstlen, int level, uchar_t chdr, int btype, void *data)
+{
+	struct lzma_mtx_task tasks[LZMA_MTX_MAX_BLKS];
+	uchar_t *_src = (uchar_t *)src;
+	uint64_t nblks, hdrsz, total, blksz, pos, spos, i;
+
+	if (srclen < LZMA_MTX_HDR_SZ(1))
+		goto bad;
+	nblks = _src[0];
+	hdrsz = LZMA_MTX_HDR_SZ(nblks);
+	if (nblks < 1 || nblks > LZMA_MTX_MAX_BLKS || srclen < hdrsz)
+		goto bad;
+	total = ntohll(U64_P(_src + 1));
+	blksz = ntohll(U64_P(_src + 9));
+	if (total > *dstlen || blksz == 0 || (total + blksz - 1) / blksz != nblks)
+		goto bad;
+
+	pos = 0;
+	spos = hdrsz;
+	for (i = 0; i < nblks; i++) {
+		struct lzma_mtx_task *t = &tasks[i];
+
+		t->srclen = ntohll(U64_P(_src + 17 + i * 8));
+		if (t->srclen <= LZMA_PROPS_SIZE || t->srclen > srclen - spos)
+			goto bad;
+		t->src = _src + spos;
+		t->dst = (uchar_t *)dst + pos;
+		t->dstlen = (total - pos < blksz ? total - pos : blksz);
+		spos += t->srclen;
+		pos += t->dstlen;
+	}
+	wpool_run(mtx_wpool, lzma_mtx_dec_task, tasks, sizeof (struct lzma_mtx_task), nblks);
+	for (i = 0; i < nblks; i++) {
+		if (tasks[i].rv != 0)
+			return (-1);
+	}
+	*dstlen = total;
+	return (0);
+bad:
+	lzerr(SZ_ERROR_DATA, 0);
+	return (-1);
+}
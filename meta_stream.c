@@ -43,11 +43,63 @@
 
 #define	METADATA_CHUNK_SIZE	(3 * 1024 * 1024)
 
-extern int bzip2_compress(void *src, uint64_t srclen, void *dst, uint64_t *dstlen,
-               int level, uchar_t chdr, int btype, void *data);
-extern int bzip2_decompress(void *src, uint64_t srclen, void *dst, uint64_t *dstlen,
-		 int level, uchar_t chdr, int btype, void *data);
-extern void bzip2_props(algo_props_t *data, int level, uint64_t chunksize);
+/*
+ * When compressing, the archiver copies metadata into a single-producer single-
+ * consumer ring. Each message is stored as a 64-bit length followed by the data
+ * padded to 8 bytes, so records never split their length field across the wrap.
+ * The metadata thread is only woken once a batch of data is pending.
+ */
+#define	META_RING_SZ		(1024 * 1024)
+#define	META_RING_MASK		(META_RING_SZ - 1)
+#define	META_RING_BATCH		(META_RING_SZ / 4)
+#define	META_RING_ALIGN(x)	(((x) + 7) & ~((uint64_t)7))
+
+/*
+ * Metadata chunks are compressed in batches of up to META_NSLOTS chunks in
+ * parallel and then written out in order.
+ */
+#define	META_NSLOTS		4
+
+/*
+ * Codecs usable for the metadata stream, indexed by the codec id stored in the
+ * chunk flag. Codecs whose decoder depends on the compression level use a fixed
+ * level since the archive level is not known to the metadata decoder.
+ */
+struct meta_codec {
+	const char *name;
+	int level;
+	init_func_ptr init;
+	compress_func_ptr compress;
+	compress_func_ptr decompress;
+	props_func_ptr props;
+	deinit_func_ptr deinit;
+};
+
+static struct meta_codec meta_codecs[META_CODEC_MASK + 1] = {
+	{"bzip2", -1, bzip2_init, bzip2_compress, bzip2_decompress, bzip2_props, NULL},
+	{"lz4", 1, lz4_init, lz4_compress, lz4_decompress, lz4_props, lz4_deinit},
+#ifdef ENABLE_PC_LIBBSC
+	{"libbsc", 6, libbsc_init, libbsc_compress, libbsc_decompress, libbsc_props,
+	    libbsc_deinit},
+#else
+	{NULL, 0, NULL, NULL, NULL, NULL, NULL},
+#endif
+	{"ppmd", 5, ppmd_init, ppmd_compress, ppmd_decompress, ppmd_props, ppmd_deinit}
+};
+
+/*
+ * A metadata chunk being accumulated or compressed.
+ */
+struct meta_slot {
+	meta_ctx_t *mctx;
+	uchar_t *frombuf, *tobuf;
+	uint64_t frompos, dstlen;
+	uchar_t checksum[CKSUM_MAX_BYTES];
+	void *codec_dat;
+	int comp_level, id;
+	int rv;
+	mac_ctx_t chunk_hmac;
+};
 
 enum {
 	SRC_CHANNEL = 0,
@@ -57,42 +109,57 @@ enum {
 struct _meta_ctx {
 	int meta_pipes[2];
 	pc_ctx_t *pctx;
+	uchar_t *ring;
+	uint64_t ring_head, ring_tail;
+	int prod_waiting, cons_waiting;
+	int src_closed, sink_state;
+	pthread_mutex_t ring_lock;
+	pthread_cond_t ring_data_cv, ring_space_cv;
 	pthread_t meta_thread;
 	uchar_t *frombuf, *tobuf;
 	uint64_t frompos, topos, tosize;
 	uchar_t checksum[CKSUM_MAX_BYTES];
-	void *bzip2_dat;
+	void *codec_dat[META_CODEC_MASK + 1];
+	int codec_level[META_CODEC_MASK + 1];
 	int comp_level, id;
 	int comp_fd;
+	int file_version;
 	int running;
 	int delta2_nstrides;
 	int do_compress;
 	mac_ctx_t chunk_hmac;
 	algo_props_t props;
+	struct meta_codec *codec;
+	int codec_id;
+	struct meta_slot slots[META_NSLOTS];
+	int nslots, cur;
+	wpool_t *wpool;
 };
 
-static int
-compress_and_write(meta_ctx_t *mctx)
+/*
+ * Compress one metadata chunk into its output buffer and fill in the header.
+ * This runs on the metadata worker pool.
+ */
+static void
+compress_slot(void *dat)
 {
+	struct meta_slot *slot = (struct meta_slot *)dat;
+	meta_ctx_t *mctx = slot->mctx;
 	pc_ctx_t *pctx = mctx->pctx;
 	uchar_t type;
 	uchar_t *comp_chunk, *tobuf;
 	int rv;
 	uint64_t dstlen;
-	int64_t wbytes;
 
-	/*
-	 * Increment metadata chunk id. Useful when encrypting (CTR Mode).
-	 */
-	mctx->id++;
+	slot->rv = 0;
 
 	/*
 	 * Plain checksum if not encrypting.
 	 * This place will hold HMAC if encrypting.
 	 */
 	if (!pctx->encrypt_type) {
-		compute_checksum(mctx->checksum, pctx->cksum, mctx->frombuf,
-		    mctx->frompos, 0, 1);
+		compute_checksum(slot->checksum, pctx->cksum, slot->frombuf,
+		    slot->frompos, 0, 1);
 	}
 
 	type = 0;
@@ -102,46 +169,38 @@ compress_and_write(meta_ctx_t *mctx)
 	 * always big-endian format. The next value is the real compressed
 	 * chunk size.
 	 */
-	tobuf = mctx->tobuf;
+	tobuf = slot->tobuf;
 	U64_P(tobuf) = htonll(METADATA_INDICATOR);
-	U64_P(tobuf + 16) = LE64(mctx->frompos); // Record original length
+	U64_P(tobuf + 16) = LE64(slot->frompos); // Record original length
 	comp_chunk = tobuf + METADATA_HDR_SZ;
-	dstlen = mctx->frompos;
+	dstlen = slot->frompos;
 
 	/*
 	 * Apply Delta2 filter.
 	 */
-	rv = delta2_encode(mctx->frombuf, mctx->frompos, comp_chunk, &dstlen,
+	rv = delta2_encode(slot->frombuf, slot->frompos, comp_chunk, &dstlen,
 	    mctx->props.delta2_span, mctx->delta2_nstrides);
 	if (rv != -1) {
-		memcpy(mctx->frombuf, comp_chunk, dstlen);
-		mctx->frompos = dstlen;
+		memcpy(slot->frombuf, comp_chunk, dstlen);
+		slot->frompos = dstlen;
 		type |= PREPROC_TYPE_DELTA2;
 	} else {
-		dstlen = mctx->frompos;
+		dstlen = slot->frompos;
 	}
 
 	/*
-	 * Ok, now compress.
+	 * Ok, now compress. Output that does not shrink is stored as-is so that
+	 * a metadata chunk never exceeds the reader's buffer.
 	 */
-	rv = bzip2_compress(mctx->frombuf, mctx->frompos, comp_chunk, &dstlen, mctx->comp_level,
-	    0, TYPE_BINARY, mctx->bzip2_dat);
+	rv = mctx->codec->compress(slot->frombuf, slot->frompos, comp_chunk, &dstlen,
+	    slot->comp_level, 0, TYPE_BINARY, slot->codec_dat);
 
-	if (rv < 0) {
-		dstlen = mctx->frompos;
-		memcpy(comp_chunk, mctx->frombuf, dstlen);
+	if (rv < 0 || dstlen >= slot->frompos) {
+		dstlen = slot->frompos;
+		memcpy(comp_chunk, slot->frombuf, dstlen);
 	} else {
 		type |= PREPROC_COMPRESSED;
-	}
-
-	if (pctx->encrypt_type) {
-		rv = crypto_buf(&(pctx->crypto_ctx), comp_chunk, comp_chunk, dstlen, mctx->id);
-		if (rv == -1) {
-			pctx->main_cancel = 1;
-			pctx->t_errored = 1;
-			log_msg(LOG_ERR, 0, "Metadata Encrypion failed");
-			return (0);
-		}
+		type |= (mctx->codec_id << META_CODEC_SHIFT);
 	}
 
 	/*
@@ -152,18 +211,29 @@ compress_and_write(meta_ctx_t *mctx)
 	*(tobuf + 24) = type;
 
 	if (!pctx->encrypt_type)
-		serialize_checksum(mctx->checksum, tobuf + 25, pctx->cksum_bytes);
+		serialize_checksum(slot->checksum, tobuf + 25, pctx->cksum_bytes);
 
 	if (pctx->encrypt_type) {
 		uchar_t chash[pctx->mac_bytes];
 		unsigned int hlen;
 		uchar_t *mac_ptr;
 
+		/*
+		 * Encrypt and HMAC the data segment in a single pass.
+		 */
 		mac_ptr = tobuf + 25;
 		memset(mac_ptr, 0, pctx->mac_bytes + CRC32_SIZE);
-		hmac_reinit(&mctx->chunk_hmac);
-		hmac_update(&mctx->chunk_hmac, tobuf, dstlen + METADATA_HDR_SZ);
-		hmac_final(&mctx->chunk_hmac, chash, &hlen);
+		hmac_reinit(&slot->chunk_hmac);
+		hmac_update(&slot->chunk_hmac, tobuf, METADATA_HDR_SZ);
+		rv = crypto_buf_mac(&(pctx->crypto_ctx), &slot->chunk_hmac, comp_chunk, dstlen,
+		    slot->id);
+		if (rv == -1) {
+			pctx->main_cancel = 1;
+			pctx->t_errored = 1;
+			log_msg(LOG_ERR, 0, "Metadata Encrypion failed");
+			return;
+		}
+		hmac_final(&slot->chunk_hmac, chash, &hlen);
 		serialize_checksum(chash, mac_ptr, hlen);
 	} else {
 		uint32_t crc;
@@ -174,28 +244,211 @@ compress_and_write(meta_ctx_t *mctx)
 		crc = lzma_crc32(tobuf, METADATA_HDR_SZ, 0);
 		U32_P(tobuf + 25 + CKSUM_MAX) = LE32(crc);
 	}
+	slot->dstlen = dstlen + METADATA_HDR_SZ; // The 'full' chunk now
+	slot->rv = 1;
+}
+
+/*
+ * Compress all filled slots in parallel and write them out in order.
+ */
+static int
+compress_and_write(meta_ctx_t *mctx)
+{
+	pc_ctx_t *pctx = mctx->pctx;
+	struct meta_slot *slot;
+	int64_t wbytes;
+	int i;
+
+	if (mctx->cur == 0)
+		return (1);
+	wpool_run(mctx->wpool, compress_slot, mctx->slots, sizeof (struct meta_slot),
+	    mctx->cur);
 
 	/*
 	 * All done. Now grab lock and write.
 	 */
-	dstlen += METADATA_HDR_SZ; // The 'full' chunk now
 	pthread_mutex_lock(&pctx->write_mutex);
-	wbytes = Write(mctx->comp_fd, mctx->tobuf, dstlen);
+	for (i = 0; i < mctx->cur; i++) {
+		slot = &mctx->slots[i];
+		if (!slot->rv) {
+			pthread_mutex_unlock(&pctx->write_mutex);
+			return (0);
+		}
+		wbytes = Write(mctx->comp_fd, slot->tobuf, slot->dstlen);
+		if (wbytes != slot->dstlen) {
+			pthread_mutex_unlock(&pctx->write_mutex);
+			log_msg(LOG_ERR, 1, "Metadata Write (expected: %" PRIu64
+			    ", written: %" PRId64 ") : ", slot->dstlen, wbytes);
+			pctx->main_cancel = 1;
+			pctx->t_errored = 1;
+			return (0);
+		}
+		slot->frompos = 0;
+	}
 	pthread_mutex_unlock(&pctx->write_mutex);
-	if (wbytes != dstlen) {
-		log_msg(LOG_ERR, 1, "Metadata Write (expected: %" PRIu64 ", written: %" PRId64 ") : ",
-			dstlen, wbytes);
-		pctx->main_cancel = 1;
-		pctx->t_errored = 1;
-		return (0);
+	mctx->cur = 0;
+	return (1);
+}
+
+/*
+ * The current slot is full. Give it the next chunk id, which is used as the
+ * nonce when encrypting (CTR Mode), and move on to the next slot. Once all
+ * slots are full they are compressed and written.
+ */
+static int
+slot_done(meta_ctx_t *mctx)
+{
+	mctx->id++;
+	mctx->slots[mctx->cur].id = mctx->id;
+	mctx->cur++;
+	if (mctx->cur == mctx->nslots)
+		return (compress_and_write(mctx));
+	return (1);
+}
+
+/*
+ * Ring helpers. Head and tail are running byte counts written only by the producer
+ * and the consumer respectively. A side that has to wait announces it through its
+ * waiting flag before re-checking the counts under the lock, and the other side
+ * only takes the lock to signal when it sees that flag.
+ */
+static void
+ring_wake(meta_ctx_t *mctx, int *waiting, pthread_cond_t *cv)
+{
+	if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&mctx->ring_lock);
+		pthread_cond_signal(cv);
+		pthread_mutex_unlock(&mctx->ring_lock);
+	}
+}
+
+/*
+ * Producer: return the free space in the ring, waiting if it is full. Returns 0
+ * if the metadata thread has stopped reading.
+ */
+static uint64_t
+ring_wait_space(meta_ctx_t *mctx, uint64_t head)
+{
+	uint64_t tail;
+
+	for (;;) {
+		tail = __atomic_load_n(&mctx->ring_tail, __ATOMIC_ACQUIRE);
+		if (head - tail < META_RING_SZ)
+			return (META_RING_SZ - (head - tail));
+		pthread_mutex_lock(&mctx->ring_lock);
+		__atomic_store_n(&mctx->prod_waiting, 1, __ATOMIC_SEQ_CST);
+		tail = __atomic_load_n(&mctx->ring_tail, __ATOMIC_SEQ_CST);
+		if (head - tail == META_RING_SZ && !mctx->sink_state)
+			pthread_cond_wait(&mctx->ring_space_cv, &mctx->ring_lock);
+		__atomic_store_n(&mctx->prod_waiting, 0, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&mctx->ring_lock);
+		if (__atomic_load_n(&mctx->sink_state, __ATOMIC_ACQUIRE))
+			return (0);
+	}
+}
+
+/*
+ * Consumer: return the number of bytes available in the ring. If there is nothing
+ * to read, wait for a batch to accumulate or for the producer to finish. Returns 0
+ * only when the producer has finished and the ring is drained.
+ */
+static uint64_t
+ring_wait_data(meta_ctx_t *mctx, uint64_t tail)
+{
+	uint64_t head;
+
+	for (;;) {
+		head = __atomic_load_n(&mctx->ring_head, __ATOMIC_ACQUIRE);
+		if (head != tail)
+			return (head - tail);
+		if (__atomic_load_n(&mctx->src_closed, __ATOMIC_ACQUIRE)) {
+			head = __atomic_load_n(&mctx->ring_head, __ATOMIC_ACQUIRE);
+			return (head - tail);
+		}
+		pthread_mutex_lock(&mctx->ring_lock);
+		__atomic_store_n(&mctx->cons_waiting, 1, __ATOMIC_SEQ_CST);
+		head = __atomic_load_n(&mctx->ring_head, __ATOMIC_SEQ_CST);
+		if (head - tail < META_RING_BATCH && !mctx->src_closed)
+			pthread_cond_wait(&mctx->ring_data_cv, &mctx->ring_lock);
+		__atomic_store_n(&mctx->cons_waiting, 0, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&mctx->ring_lock);
 	}
+}
+
+static void
+ring_consumed(meta_ctx_t *mctx, uint64_t tail)
+{
+	__atomic_store_n(&mctx->ring_tail, tail, __ATOMIC_SEQ_CST);
+	ring_wake(mctx, &mctx->prod_waiting, &mctx->ring_space_cv);
+}
+
+/*
+ * Publish produced data and wake the metadata thread once a batch is pending.
+ */
+static void
+ring_produced(meta_ctx_t *mctx, uint64_t head)
+{
+	__atomic_store_n(&mctx->ring_head, head, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&mctx->cons_waiting, __ATOMIC_SEQ_CST) &&
+	    head - __atomic_load_n(&mctx->ring_tail, __ATOMIC_ACQUIRE) >= META_RING_BATCH)
+		ring_wake(mctx, &mctx->cons_waiting, &mctx->ring_data_cv);
+}
+
+/*
+ * Metadata thread is exiting, release a producer that may be waiting for space.
+ */
+static void
+ring_sink_done(meta_ctx_t *mctx, int state)
+{
+	pthread_mutex_lock(&mctx->ring_lock);
+	__atomic_store_n(&mctx->sink_state, state, __ATOMIC_SEQ_CST);
+	pthread_cond_signal(&mctx->ring_space_cv);
+	pthread_mutex_unlock(&mctx->ring_lock);
+}
 
+/*
+ * Copy a metadata buffer into the ring. The archiver only waits here if the
+ * ring is full.
+ */
+static int
+ring_put(meta_ctx_t *mctx, const uchar_t *buf, uint64_t len)
+{
+	uint64_t head, space, n, rem, cp;
+
+	if (__atomic_load_n(&mctx->sink_state, __ATOMIC_ACQUIRE) < 0)
+		return (-1);
+	head = mctx->ring_head;
+	if (ring_wait_space(mctx, head) == 0)
+		return (mctx->sink_state < 0 ? -1 : 0);
+	U64_P(mctx->ring + (head & META_RING_MASK)) = len;
+	head += 8;
+
+	rem = META_RING_ALIGN(len);
+	while (rem > 0) {
+		space = ring_wait_space(mctx, head);
+		if (space == 0)
+			return (mctx->sink_state < 0 ? -1 : 0);
+		n = META_RING_SZ - (head & META_RING_MASK);
+		if (n > space) n = space;
+		if (n > rem) n = rem;
+		cp = (n > len ? len : n);
+		memcpy(mctx->ring + (head & META_RING_MASK), buf, cp);
+		buf += cp;
+		len -= cp;
+		rem -= n;
+		head += n;
+		ring_produced(mctx, head);
+	}
+	if (mctx->ring_head != head)
+		ring_produced(mctx, head);
 	return (1);
 }
 
 void
 meta_ctx_close_sink_channel(meta_ctx_t *mctx)
 {
+	if (mctx->do_compress)
+		return;
 	if (mctx->meta_pipes[SINK_CHANNEL]) {
 		close(mctx->meta_pipes[SINK_CHANNEL]);
 		mctx->meta_pipes[SINK_CHANNEL] = 0;
@@ -205,76 +458,123 @@ meta_ctx_close_sink_channel(meta_ctx_t *mctx)
 void
 meta_ctx_close_src_channel(meta_ctx_t *mctx)
 {
+	if (mctx->do_compress) {
+		pthread_mutex_lock(&mctx->ring_lock);
+		__atomic_store_n(&mctx->src_closed, 1, __ATOMIC_SEQ_CST);
+		pthread_cond_signal(&mctx->ring_data_cv);
+		pthread_mutex_unlock(&mctx->ring_lock);
+		return;
+	}
 	if (mctx->meta_pipes[SRC_CHANNEL]) {
 		close(mctx->meta_pipes[SRC_CHANNEL]);
 		mctx->meta_pipes[SRC_CHANNEL] = 0;
 	}
 }
 
+/*
+ * Copy len bytes out of the ring starting at running offset tail, waiting for
+ * the producer as needed. Space is released as each piece is copied, so that
+ * a message larger than the ring can still pass through it. Returns the new
+ * tail or 0 if the ring ended early.
+ */
+static uint64_t
+ring_get(meta_ctx_t *mctx, uint64_t tail, uchar_t *buf, uint64_t len)
+{
+	uint64_t avail, n;
+
+	while (len > 0) {
+		avail = ring_wait_data(mctx, tail);
+		if (avail == 0)
+			return (0);
+		n = META_RING_SZ - (tail & META_RING_MASK);
+		if (n > avail) n = avail;
+		if (n > len) n = len;
+		memcpy(buf, mctx->ring + (tail & META_RING_MASK), n);
+		buf += n;
+		len -= n;
+		tail += n;
+		ring_consumed(mctx, tail);
+	}
+	return (tail);
+}
+
 /*
  * Accumulate metadata into a memory buffer. Once the buffer gets filled or
- * data stream ends, the buffer is compressed and written out.
+ * data stream ends, the buffer is compressed and written out. Metadata is
+ * taken from the ring one message at a time, a message is never split across
+ * metadata chunks.
  */
 static void *
 metadata_compress(void *dat)
 {
 	meta_ctx_t *mctx = (meta_ctx_t *)dat;
-	meta_msg_t *msgp;
-	int ack;
+	struct meta_slot *slot;
+	uint64_t tail, len, ntail;
 
 	mctx->running = 1;
 	mctx->id = -1;
-	while (Read(mctx->meta_pipes[SINK_CHANNEL], &msgp, sizeof (msgp)) == sizeof (msgp)) {
-		ack = 0;
-		if (mctx->frompos + msgp->len > METADATA_CHUNK_SIZE) {
+	mctx->cur = 0;
+	tail = 0;
+	while (ring_wait_data(mctx, tail) > 0) {
+		len = U64_P(mctx->ring + (tail & META_RING_MASK));
+		tail += 8;
+		if (len > METADATA_CHUNK_SIZE) {
+			log_msg(LOG_ERR, 0, "Metadata record of %" PRIu64 " bytes is too large.",
+			    len);
+			ring_sink_done(mctx, -1);
+			return (NULL);
+		}
+		slot = &mctx->slots[mctx->cur];
+		if (slot->frompos + len > METADATA_CHUNK_SIZE) {
 			/*
-			 * Accumulating the metadata block will overflow buffer. Compress
-			 * and write the current buffer and then copy the new data into it.
+			 * Accumulating the metadata block will overflow buffer. Queue
+			 * the current buffer for compression and copy the new data into
+			 * the next one.
 			 */
-			if (!compress_and_write(mctx)) {
-				Write(mctx->meta_pipes[SINK_CHANNEL], &ack, sizeof (ack));
+			if (!slot_done(mctx)) {
+				ring_sink_done(mctx, -1);
 				return (NULL);
 			}
-			mctx->frompos = 0;
-			memcpy(mctx->frombuf, msgp->buf, msgp->len);
-			mctx->frompos = msgp->len;
+			slot = &mctx->slots[mctx->cur];
+		}
+
+		/*
+		 * Copy the message into the buffer. Its space in the ring is released
+		 * while copying, the padding is released here.
+		 */
+		ntail = ring_get(mctx, tail, slot->frombuf + slot->frompos, len);
+		if (len > 0 && ntail == 0)
+			break;
+		slot->frompos += len;
+		tail += META_RING_ALIGN(len);
+		ring_consumed(mctx, tail);
 
-		} else if (mctx->frompos + msgp->len == METADATA_CHUNK_SIZE) {
+		if (slot->frompos == METADATA_CHUNK_SIZE) {
 			/*
-			 * Accumulating the metadata block fills the buffer. Fill it then
-			 * compress and write the buffer.
+			 * Accumulating the metadata block fills the buffer. Queue it
+			 * for compression.
 			 */
-			memcpy(mctx->frombuf + mctx->frompos, msgp->buf, msgp->len);
-			mctx->frompos += msgp->len;
-			if (!compress_and_write(mctx)) {
-				Write(mctx->meta_pipes[SINK_CHANNEL], &ack, sizeof (ack));
+			if (!slot_done(mctx)) {
+				ring_sink_done(mctx, -1);
 				return (NULL);
 			}
-			mctx->frompos = 0;
-		} else {
-			/*
-			 * Accumulate the metadata block into the buffer for future
-			 * compression.
-			 */
-			memcpy(mctx->frombuf + mctx->frompos, msgp->buf, msgp->len);
-			mctx->frompos += msgp->len;
 		}
-		ack = 1;
-		Write(mctx->meta_pipes[SINK_CHANNEL], &ack, sizeof (ack));
 	}
 	mctx->running = 0;
 
 	/*
-	 * Flush any accumulated data in the buffer.
+	 * Flush any accumulated data in the buffers.
 	 */
-	if (mctx->frompos) {
-		if (!compress_and_write(mctx)) {
-			ack = 0;
-			Write(mctx->meta_pipes[SINK_CHANNEL], &ack, sizeof (ack));
-			return (NULL);
-		}
-		mctx->frompos = 0;
+	if (mctx->slots[mctx->cur].frompos) {
+		mctx->id++;
+		mctx->slots[mctx->cur].id = mctx->id;
+		mctx->cur++;
+	}
+	if (!compress_and_write(mctx)) {
+		ring_sink_done(mctx, -1);
+		return (NULL);
 	}
+	ring_sink_done(mctx, 1);
 	return (NULL);
 }
 
@@ -297,7 +597,8 @@ decompress_data(meta_ctx_t *mctx)
 
 	/*
 	 * If this was encrypted:
-	 * Verify HMAC first before anything else and then decrypt compressed data.
+	 * Verify HMAC and decrypt compressed data in a single pass. The decrypted
+	 * data is not used unless HMAC verification succeeds.
 	 */
 	if (pctx->encrypt_type) {
 		unsigned int len;
@@ -306,14 +607,9 @@ decompress_data(meta_ctx_t *mctx)
 		deserialize_checksum(checksum, cbuf + 25, pctx->mac_bytes);
 		memset(cbuf + 25, 0, pctx->mac_bytes + CRC32_SIZE);
 		hmac_reinit(&mctx->chunk_hmac);
-		hmac_update(&mctx->chunk_hmac, cbuf, len_cmp + METADATA_HDR_SZ);
-		hmac_final(&mctx->chunk_hmac, mctx->checksum, &len);
-		if (memcmp(checksum, mctx->checksum, len) != 0) {
-			log_msg(LOG_ERR, 0, "Metadata chunk %d, HMAC verification failed",
-			    mctx->id);
-			return (0);
-		}
-		rv = crypto_buf(&(pctx->crypto_ctx), cseg, cseg, len_cmp, mctx->id);
+		hmac_update(&mctx->chunk_hmac, cbuf, METADATA_HDR_SZ);
+		rv = crypto_buf_mac(&(pctx->crypto_ctx), &mctx->chunk_hmac, cseg, len_cmp,
+		    mctx->id);
 		if (rv == -1) {
 			/*
 			 * Decryption failure is fatal.
@@ -322,6 +618,12 @@ decompress_data(meta_ctx_t *mctx)
 			    mctx->id);
 			return (0);
 		}
+		hmac_final(&mctx->chunk_hmac, mctx->checksum, &len);
+		if (memcmp(checksum, mctx->checksum, len) != 0) {
+			log_msg(LOG_ERR, 0, "Metadata chunk %d, HMAC verification failed",
+			    mctx->id);
+			return (0);
+		}
 	} else {
 		uint32_t crc1, crc2;
 
@@ -344,8 +646,27 @@ decompress_data(meta_ctx_t *mctx)
 	}
 
 	if (type & PREPROC_COMPRESSED) {
-		rv = bzip2_decompress(cseg, len_cmp, ubuf, &dstlen, mctx->comp_level,
-		    0, TYPE_BINARY, mctx->bzip2_dat);
+		struct meta_codec *codec;
+		int cid;
+
+		cid = META_CODEC(type);
+		codec = &meta_codecs[cid];
+		if (codec->name == NULL) {
+			log_msg(LOG_ERR, 0, "Metadata chunk %d, unsupported codec %d.",
+			    mctx->id, cid);
+			return (0);
+		}
+		if (mctx->codec_dat[cid] == NULL) {
+			mctx->codec_level[cid] = (codec->level < 0 ? pctx->level : codec->level);
+			if (codec->init(&mctx->codec_dat[cid], &mctx->codec_level[cid], 1,
+			    METADATA_CHUNK_SIZE, mctx->file_version, DECOMPRESS) != 0) {
+				log_msg(LOG_ERR, 0, "Metadata chunk %d, %s init failed.",
+				    mctx->id, codec->name);
+				return (0);
+			}
+		}
+		rv = codec->decompress(cseg, len_cmp, ubuf, &dstlen, mctx->codec_level[cid],
+		    0, TYPE_BINARY, mctx->codec_dat[cid]);
 		if (rv == -1) {
 			log_msg(LOG_ERR, 0, "Metadata chunk %d, decompression failed.", mctx->id);
 			return (0);
@@ -500,6 +821,107 @@ metadata_decompress(void *dat)
 	return (NULL);
 }
 
+/*
+ * Look up a metadata codec by name. Returns the codec id or -1 if the codec is
+ * unknown or not built in.
+ */
+int
+meta_codec_id(const char *name)
+{
+	int i;
+
+	for (i = 0; i <= META_CODEC_MASK; i++) {
+		if (meta_codecs[i].name != NULL && strcmp(meta_codecs[i].name, name) == 0)
+			return (i);
+	}
+	return (-1);
+}
+
+static void
+meta_slots_free(meta_ctx_t *mctx)
+{
+	struct meta_slot *slot;
+	int i;
+
+	for (i = 0; i < mctx->nslots; i++) {
+		slot = &mctx->slots[i];
+		if (slot->codec_dat && mctx->codec->deinit)
+			mctx->codec->deinit(&slot->codec_dat);
+		if (slot->chunk_hmac.mac_ctx)
+			hmac_cleanup(&slot->chunk_hmac);
+		slab_free(NULL, slot->frombuf);
+		slab_free(NULL, slot->tobuf);
+	}
+	mctx->nslots = 0;
+	wpool_destroy(mctx->wpool);
+	mctx->wpool = NULL;
+}
+
+/*
+ * Set up the metadata chunk slots and the worker pool that compresses them.
+ * Each slot has its own buffers and codec state. The pool is sized to the
+ * number of slots less one since the metadata thread also runs compression.
+ */
+static int
+meta_slots_init(meta_ctx_t *mctx, int file_version)
+{
+	pc_ctx_t *pctx = mctx->pctx;
+	struct meta_slot *slot;
+	uint64_t tosz;
+	long ncpu;
+	int i, nslots;
+
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	nslots = META_NSLOTS;
+	if (ncpu > 0 && ncpu < nslots)
+		nslots = ncpu;
+
+	mctx->codec_id = pctx->meta_codec;
+	mctx->codec = &meta_codecs[mctx->codec_id];
+	mctx->codec->props(&mctx->props, pctx->level, METADATA_CHUNK_SIZE);
+	tosz = METADATA_CHUNK_SIZE + METADATA_HDR_SZ + zlib_buf_extra(METADATA_CHUNK_SIZE) +
+	    mctx->props.buf_extra;
+
+	mctx->nslots = 0;
+	mctx->wpool = NULL;
+	for (i = 0; i < nslots; i++) {
+		slot = &mctx->slots[i];
+		memset(slot, 0, sizeof (struct meta_slot));
+		slot->mctx = mctx;
+		slot->frombuf = slab_alloc(NULL, METADATA_CHUNK_SIZE + METADATA_HDR_SZ);
+		slot->tobuf = slab_alloc(NULL, tosz);
+		mctx->nslots++;
+		if (!slot->frombuf || !slot->tobuf) {
+			log_msg(LOG_ERR, 1, "Failed to allocate metadata buffer.");
+			meta_slots_free(mctx);
+			return (-1);
+		}
+
+		slot->comp_level = (mctx->codec->level < 0 ? pctx->level : mctx->codec->level);
+		if (mctx->codec->init(&slot->codec_dat, &slot->comp_level, 1,
+		    METADATA_CHUNK_SIZE, file_version, COMPRESS) != 0) {
+			log_msg(LOG_ERR, 0, "Metadata %s init failed.", mctx->codec->name);
+			meta_slots_free(mctx);
+			return (-1);
+		}
+		if (pctx->encrypt_type) {
+			if (hmac_init(&slot->chunk_hmac, pctx->cksum,
+			    &(pctx->crypto_ctx)) == -1) {
+				log_msg(LOG_ERR, 0, "Cannot initialize metadata hmac.");
+				meta_slots_free(mctx);
+				return (-1);
+			}
+		}
+	}
+	mctx->wpool = wpool_create(nslots - 1);
+	if (mctx->wpool == NULL) {
+		log_msg(LOG_ERR, 1, "Unable to create metadata worker pool.");
+		meta_slots_free(mctx);
+		return (-1);
+	}
+	return (0);
+}
+
 /*
  * Create the metadata thread and associated buffers. This writes out compressed
  * metadata chunks into the archive. This is libarchive metadata.
@@ -517,8 +939,50 @@ meta_ctx_create(void *pc, int file_version, int comp_fd)
 		log_msg(LOG_ERR, 1, "Failed to allocate metadata context.");
 		return (NULL);
 	}
+	memset(mctx, 0, sizeof (meta_ctx_t));
 
 	mctx->running = 0;
+	mctx->comp_fd = comp_fd;
+	mctx->file_version = file_version;
+	mctx->frompos = 0;
+	mctx->pctx = pctx;
+	mctx->do_compress = pctx->do_compress;
+	if (pctx->level > 9)
+		mctx->delta2_nstrides = NSTRIDES_EXTRA;
+	else
+		mctx->delta2_nstrides = NSTRIDES_STANDARD;
+
+	/*
+	 * When compressing the archiver copies metadata into the ring. When
+	 * extracting it requests buffers via this socketpair. Memory buffer
+	 * pointers are passed through the socket for speed rather than the contents.
+	 */
+	if (pctx->do_compress) {
+		if (meta_slots_init(mctx, file_version) == -1) {
+			(void) free(mctx);
+			return (NULL);
+		}
+		mctx->ring = slab_alloc(NULL, META_RING_SZ);
+		if (!mctx->ring) {
+			meta_slots_free(mctx);
+			(void) free(mctx);
+			log_msg(LOG_ERR, 1, "Failed to allocate metadata ring.");
+			return (NULL);
+		}
+		pthread_mutex_init(&mctx->ring_lock, NULL);
+		pthread_cond_init(&mctx->ring_data_cv, NULL);
+		pthread_cond_init(&mctx->ring_space_cv, NULL);
+		if (pthread_create(&(mctx->meta_thread), NULL, metadata_compress,
+		    (void *)mctx) != 0) {
+			meta_slots_free(mctx);
+			slab_free(NULL, mctx->ring);
+			(void) free(mctx);
+			log_msg(LOG_ERR, 1, "Unable to create metadata thread.");
+			return (NULL);
+		}
+		return (mctx);
+	}
+
 	if (pctx->encrypt_type) {
 		if (hmac_init(&mctx->chunk_hmac, pctx->cksum,
 		    &(pctx->crypto_ctx)) == -1) {
@@ -528,8 +992,6 @@ meta_ctx_create(void *pc, int file_version, int comp_fd)
 		}
 	}
 
-	mctx->comp_fd = comp_fd;
-	mctx->frompos = 0;
 	mctx->frombuf = slab_alloc(NULL, METADATA_CHUNK_SIZE + METADATA_HDR_SZ);
 	if (!mctx->frombuf) {
 		(void) free(mctx);
@@ -545,11 +1007,6 @@ meta_ctx_create(void *pc, int file_version, int comp_fd)
 		return (NULL);
 	}
 
-	/*
-	 * The archiver passes metadata via this socketpair. Memory buffer pointers
-	 * are passed through the socket for speed rather than the contents.
-	 */
-	mctx->pctx = pctx;
 	if (socketpair(AF_UNIX, SOCK_STREAM, 0, mctx->meta_pipes) == -1) {
 		(void) free(mctx->frombuf);
 		(void) free(mctx->tobuf);
@@ -558,52 +1015,21 @@ meta_ctx_create(void *pc, int file_version, int comp_fd)
 		return (NULL);
 	}
 
-	if (pctx->level > 9)
-		mctx->delta2_nstrides = NSTRIDES_EXTRA;
-	else
-		mctx->delta2_nstrides = NSTRIDES_STANDARD;
-	if (pctx->do_compress) {
-		int rv;
-
-		mctx->comp_level = pctx->level;
-		rv = bzip2_init(&mctx->bzip2_dat, &mctx->comp_level, 1, METADATA_CHUNK_SIZE,
-		    file_version, COMPRESS);
-		bzip2_props(&mctx->props, pctx->level, METADATA_CHUNK_SIZE);
-		if (rv != 0 || pthread_create(&(mctx->meta_thread), NULL, metadata_compress,
-		    (void *)mctx) != 0) {
-			(void) close(mctx->meta_pipes[0]);
-			(void) close(mctx->meta_pipes[1]);
-			(void) free(mctx->frombuf);
-			(void) free(mctx->tobuf);
-			(void) free(mctx);
-			if (rv == 0)
-				log_msg(LOG_ERR, 0, "Lzma init failed.");
-			else
-				log_msg(LOG_ERR, 1, "Unable to create metadata thread.");
-			return (NULL);
-		}
-	} else {
-		int rv;
-
-		mctx->comp_level = pctx->level;
-		rv = bzip2_init(&mctx->bzip2_dat, &mctx->comp_level, 1, METADATA_CHUNK_SIZE,
-		    file_version, DECOMPRESS);
-		if (rv != 0 || pthread_create(&(mctx->meta_thread), NULL, metadata_decompress,
-		    (void *)mctx) != 0) {
-			(void) close(mctx->meta_pipes[0]);
-			(void) close(mctx->meta_pipes[1]);
-			(void) free(mctx->frombuf);
-			(void) free(mctx->tobuf);
-			(void) free(mctx);
-			if (rv == 0)
-				log_msg(LOG_ERR, 0, "Lzma init failed.");
-			else
-				log_msg(LOG_ERR, 1, "Unable to create metadata thread.");
-			return (NULL);
-		}
+	/*
+	 * Decoders are set up on first use based on the codec recorded in each
+	 * metadata chunk.
+	 */
+	if (pthread_create(&(mctx->meta_thread), NULL, metadata_decompress,
+	    (void *)mctx) != 0) {
+		(void) close(mctx->meta_pipes[0]);
+		(void) close(mctx->meta_pipes[1]);
+		(void) free(mctx->frombuf);
+		(void) free(mctx->tobuf);
+		(void) free(mctx);
+		log_msg(LOG_ERR, 1, "Unable to create metadata thread.");
+		return (NULL);
 	}
 
-	mctx->do_compress = pctx->do_compress;
 	return (mctx);
 }
 
@@ -613,6 +1039,9 @@ meta_ctx_send(meta_ctx_t *mctx, const void **buf, size_t *len)
 	int ack;
 	meta_msg_t msg, *msgp;
 
+	if (mctx->do_compress)
+		return (ring_put(mctx, (const uchar_t *)*buf, *len));
+
 	/*
 	 * Write the message buffer to the pipe.
 	 */
@@ -651,6 +1080,21 @@ meta_ctx_done(meta_ctx_t *mctx)
 	if (!mctx->do_compress)
 		close(mctx->comp_fd);
 	pthread_join(mctx->meta_thread, NULL);
+	if (mctx->do_compress) {
+		pthread_cond_destroy(&mctx->ring_space_cv);
+		pthread_cond_destroy(&mctx->ring_data_cv);
+		pthread_mutex_destroy(&mctx->ring_lock);
+		slab_free(NULL, mctx->ring);
+		mctx->ring = NULL;
+		meta_slots_free(mctx);
+	} else {
+		int i;
+
+		for (i = 0; i <= META_CODEC_MASK; i++) {
+			if (mctx->codec_dat[i] && meta_codecs[i].deinit)
+				meta_codecs[i].deinit(&mctx->codec_dat[i]);
+		}
+	}
 	return (0);
 }
 
@@ -48,6 +48,18 @@ extern "C" {
 #define CRC32_SIZE		4
 #define	METADATA_HDR_SZ		(8 * 3 + 1 + CKSUM_MAX + CRC32_SIZE)
 
+/*
+ * Codec used for a compressed metadata chunk, stored in bits 5-6 of the chunk
+ * flag. Zero is bzip2 which was the only metadata codec in older archives.
+ */
+#define	META_CODEC_BZIP2	0
+#define	META_CODEC_LZ4		1
+#define	META_CODEC_LIBBSC	2
+#define	META_CODEC_PPMD		3
+#define	META_CODEC_SHIFT	5
+#define	META_CODEC_MASK		3
+#define	META_CODEC(x)		(((x) >> META_CODEC_SHIFT) & META_CODEC_MASK)
+
 typedef struct _meta_ctx meta_ctx_t;
 
 typedef struct _meta_msg {
@@ -60,6 +72,7 @@ int meta_ctx_send(meta_ctx_t *mctx, const void **buf, size_t *len);
 int meta_ctx_done(meta_ctx_t *mctx);
 void meta_ctx_close_sink_channel(meta_ctx_t *mctx);
 void meta_ctx_close_src_channel(meta_ctx_t *mctx);
+int meta_codec_id(const char *name);
 
 #ifdef	__cplusplus
 }
@@ -55,6 +55,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <pc_archive.h>
+#include "prefetch.h"
 #include <filters/dispack/dis.hpp>
 #include "filters/dict/DictFilter.h"
 
@@ -110,6 +111,10 @@ usage(pc_ctx_t *pctx)
 "       -t <number>\n"
 "                Sets the number of compression threads. Default: core count.\n"
 "       -T       Disable separate metadata stream.\n"
+"       -Q <algorithm>\n"
+"                Metadata stream algorithm: bzip2 (default), lz4, libbsc or ppmd.\n"
+"       -R <speed>\n"
+"                Adapt modes: keep throughput above <speed> bytes/sec (k, m, g suffix).\n"
 "       -S <chunk checksum>\n"
 "                The chunk verification checksum. Default: BLAKE256. Others are: CRC64, SHA256,\n"
 "                SHA512, KECCAK256, KECCAK512, BLAKE256, BLAKE512.\n"
@@ -154,6 +159,11 @@ usage(pc_ctx_t *pctx)
 "                 extracted files are restored. Default if omitted: Current directory.\n\n",
 	    UTILITY_VERSION, LICENSE_STRING, pctx->exec_name, pctx->exec_name, pctx->exec_name);
 	fprintf(stderr,
+"    Solid Mode\n"
+"    ----------\n"
+"       -W        Prime each chunk's compressor with the tail of the previous chunk to\n"
+"                 improve compression with small chunks. Only for zlib, lzma and lzmaMt.\n"
+"                 Decompression of such files is serialized across chunks.\n\n"
 "    Encryption\n"
 "    ----------\n"
 "       -e <ALGO> Encrypt chunks with the given encrption algorithm. The ALGO parameter\n"
@@ -192,6 +202,82 @@ show_compression_stats(pc_ctx_t *pctx)
 	}
 }
 
+/*
+ * Create the shared worker pool used for intra-chunk parallelism. The pool is
+ * sized to the CPUs left over after one thread per chunk worker, so the total
+ * thread count stays within the number of online CPUs. With as many chunk
+ * workers as CPUs the pool has no threads and batches run in the submitting
+ * chunk thread. Libbsc runs its parallel sections with OpenMP and gets the
+ * same leftover CPUs as its thread budget.
+ */
+static void
+create_worker_pool(pc_ctx_t *pctx)
+{
+	long nworkers;
+
+	nworkers = sysconf(_SC_NPROCESSORS_ONLN) - pctx->nthreads;
+	if (nworkers < 0)
+		nworkers = 0;
+	pctx->wpool = wpool_create(nworkers);
+	set_checksum_wpool(pctx->wpool);
+	lzma_set_wpool(pctx->wpool);
+#ifndef _MPLV2_LICENSE_
+	lzp_set_wpool(pctx->wpool);
+#endif
+#ifdef ENABLE_PC_LIBBSC
+	libbsc_set_threads(nworkers, pctx->nthreads);
+#endif
+}
+
+static void
+destroy_worker_pool(pc_ctx_t *pctx)
+{
+	set_checksum_wpool(NULL);
+	lzma_set_wpool(NULL);
+#ifndef _MPLV2_LICENSE_
+	lzp_set_wpool(NULL);
+#endif
+	wpool_destroy(pctx->wpool);
+	pctx->wpool = NULL;
+}
+
+/*
+ * Check whether chunk data is worth compressing. Already compressed media and
+ * encrypted blobs often have no recognizable type, so a quick sampling entropy
+ * estimate is used to store such data as-is instead of running the full codec
+ * only to discard the result. Text is never skipped.
+ */
+static int
+chunk_incompressible(struct cmp_data *tdat, uchar_t *buf, uint64_t len)
+{
+	int rv;
+	DEBUG_STAT_EN(double strt, en);
+
+	if (PC_TYPE(tdat->btype) & TYPE_TEXT)
+		return (0);
+	DEBUG_STAT_EN(strt = get_wtime_millis());
+	rv = analyze_incompressible(buf, len);
+	DEBUG_STAT_EN(en = get_wtime_millis());
+	DEBUG_STAT_EN(if (rv) fprintf(stderr, "Chunk incompressible, estimated in %.3f ms\n",
+	    en - strt));
+	return (rv);
+}
+
+/*
+ * Preprocessing stages alternate between two buffers. Each stage reads the data
+ * from the current buffer and writes its output into the free one, after which
+ * the roles are switched. So no stage has to copy its result back and the final
+ * codec reads from wherever the last stage left the data.
+ */
+typedef struct {
+	uchar_t *buf[2];
+	int cur;
+} buf_chain_t;
+
+#define	BC_CUR(bc)	((bc)->buf[(bc)->cur])
+#define	BC_FREE(bc)	((bc)->buf[(bc)->cur ^ 1])
+#define	BC_SWAP(bc)	((bc)->cur ^= 1)
+
 /*
  * Wrapper functions to pre-process the buffer and then call the main compression routine.
  *
@@ -201,27 +287,35 @@ show_compression_stats(pc_ctx_t *pctx)
  * It is possible for a buffer to be only pre-processed and not compressed by the final
  * algorithm if the final one fails to compress for some reason. However the vice versa
  * is not allowed.
+ *
+ * The stages use src and the area after the flag byte in dst as a buffer chain. If the
+ * data ends up in dst and alt is given, the final codec writes into alt instead of
+ * copying the data back to src. Alt must be a free area as large as dst, typically in
+ * the buffer holding src, and *in_alt is set when the result was placed there.
  */
 static int
 preproc_compress(pc_ctx_t *pctx, compress_func_ptr cmp_func, void *src, uint64_t srclen,
-    void *dst, uint64_t *dstlen, int level, uchar_t chdr, int btype, void *data,
-    algo_props_t *props, int interesting)
+    void *dst, void *alt, int *in_alt, uint64_t *dstlen, int level, uchar_t chdr, int btype,
+    void *data, algo_props_t *props, int interesting)
 {
-	uchar_t *dest = (uchar_t *)dst, type = 0;
+	uchar_t *dest = (uchar_t *)dst, *out, type = 0;
 	int result;
 	uint64_t _dstlen, fromlen;
-	uchar_t *from, *to;
+	uchar_t *from;
+	buf_chain_t bc;
 	int stype, analyzed;
 	analyzer_ctx_t actx;
 	DEBUG_STAT_EN(double strt, en);
 
 	_dstlen = *dstlen;
-	from = src;
-	to = dst;
+	bc.buf[0] = (uchar_t *)src;
+	bc.buf[1] = dest + 1;
+	bc.cur = 0;
 	fromlen = srclen;
 	result = 0;
 	stype = PC_SUBTYPE(btype);
 	analyzed = 0;
+	*in_alt = 0;
 
 	if (btype == TYPE_UNKNOWN || stype == TYPE_ARCHIVE_TAR || stype == TYPE_PDF ||
 	    PC_TYPE(btype) & TYPE_TEXT || interesting) {
@@ -239,14 +333,8 @@ preproc_compress(pc_ctx_t *pctx, compress_func_ptr cmp_func, void *src, uint64_t
 	if (pctx->exe_preprocess) {
 		if (stype == TYPE_EXE32 || stype == TYPE_EXE64 ||
 		    stype == TYPE_ARCHIVE_AR || stype == TYPE_EXE32_PE) {
-			_dstlen = fromlen;
-			memcpy(to, from, fromlen);
-			if (Forward_E89(to, fromlen) == 0) {
-				uchar_t *tmp;
-				tmp = from;
-				from = to;
-				to = tmp;
-				fromlen = _dstlen;
+			if (Forward_E89_copy(BC_CUR(&bc), BC_FREE(&bc), fromlen) == 0) {
+				BC_SWAP(&bc);
 				type |= PREPROC_TYPE_E8E9;
 			}
 		}
@@ -263,16 +351,14 @@ preproc_compress(pc_ctx_t *pctx, compress_func_ptr cmp_func, void *src, uint64_t
 		if (analyzed)
 			b_type = PC_TYPE(actx.one_pct.btype);
 		else
-			b_type = analyze_buffer_simple(from, fromlen);
+			b_type = analyze_buffer_simple(BC_CUR(&bc), fromlen);
 
 		if (PC_TYPE(b_type) & TYPE_TEXT) {
 			_dstlen = fromlen;
-			result = dict_encode(from, fromlen, to, &_dstlen, (stype == TYPE_DNA_SEQ));
+			result = dict_encode(BC_CUR(&bc), fromlen, BC_FREE(&bc), &_dstlen,
+			    (stype == TYPE_DNA_SEQ));
 			if (result != -1) {
-				uchar_t *tmp;
-				tmp = from;
-				from = to;
-				to = tmp;
+				BC_SWAP(&bc);
 				fromlen = _dstlen;
 				type |= PREPROC_TYPE_DICT;
 			}
@@ -290,13 +376,11 @@ preproc_compress(pc_ctx_t *pctx, compress_func_ptr cmp_func, void *src, uint64_t
 
 		if (!(PC_TYPE(b_type) & TYPE_BINARY)) {
 			hashsize = lzp_hash_size(level);
-			result = lzp_compress((const uchar_t *)from, to, fromlen,
-					      hashsize, LZP_DEFAULT_LZPMINLEN, 0);
+			result = lzp_compress((const uchar_t *)BC_CUR(&bc), BC_FREE(&bc), fromlen,
+					      hashsize, LZP_DEFAULT_LZPMINLEN,
+					      LZP_FEATURE_MULTITHREADING);
 			if (result >= 0 && result < srclen) {
-				uchar_t *tmp;
-				tmp = from;
-				from = to;
-				to = tmp;
+				BC_SWAP(&bc);
 				fromlen = result;
 				type |= PREPROC_TYPE_LZP;
 			}
@@ -315,14 +399,11 @@ preproc_compress(pc_ctx_t *pctx, compress_func_ptr cmp_func, void *src, uint64_t
 
 		if (!(PC_TYPE(b_type) & TYPE_TEXT)) {
 			_dstlen = fromlen;
-			result = delta2_encode((uchar_t *)from, fromlen, to,
+			result = delta2_encode(BC_CUR(&bc), fromlen, BC_FREE(&bc),
 					       &_dstlen, props->delta2_span,
 					       pctx->delta2_nstrides);
 			if (result != -1) {
-				uchar_t *tmp;
-				tmp = from;
-				from = to;
-				to = tmp;
+				BC_SWAP(&bc);
 				fromlen = _dstlen;
 				type |= PREPROC_TYPE_DELTA2;
 			}
@@ -330,27 +411,34 @@ preproc_compress(pc_ctx_t *pctx, compress_func_ptr cmp_func, void *src, uint64_t
 	}
 
 	/*
-	 * Check which is the resulting buffer. If Encoded data is already sitting
-	 * in src buffer then a memcpy() is not needed.
-	 * Note that from,to ptrs are swapped after every encoding stage. So if
-	 * from == dst, it means that encoded data is in dst.
+	 * Encoded data sitting in src is compressed into dst as usual. If it is in
+	 * dst then the codec writes into alt, and only when there is no alt the data
+	 * is copied back to src.
 	 */
-	if (from == dst) {
-		memcpy(src, dst, fromlen);
+	from = BC_CUR(&bc);
+	out = dest;
+	if (bc.cur == 1) {
+		if (alt) {
+			out = (uchar_t *)alt;
+		} else {
+			memcpy(src, from, fromlen);
+			from = (uchar_t *)src;
+		}
 	}
 	srclen = fromlen;
 
-	*dest = type;
-	U64_P(dest + 1) = htonll(srclen);
+	*out = type;
+	U64_P(out + 1) = htonll(srclen);
 	_dstlen = srclen;
 	DEBUG_STAT_EN(strt = get_wtime_millis());
-	result = cmp_func(src, srclen, dest+9, &_dstlen, level, chdr,
+	result = cmp_func(from, srclen, out+9, &_dstlen, level, chdr,
 	    btype, data);
 	DEBUG_STAT_EN(en = get_wtime_millis());
 
 	if (result > -1 && _dstlen < srclen) {
-		*dest |= PREPROC_COMPRESSED;
+		*out |= PREPROC_COMPRESSED;
 		*dstlen = _dstlen + 9;
+		*in_alt = (out != dest);
 		DEBUG_STAT_EN(fprintf(stderr, "Chunk compression speed %.3f MB/s\n",
 		    get_mb_s(srclen, strt, en)));
 	} else {
@@ -360,10 +448,13 @@ preproc_compress(pc_ctx_t *pctx, compress_func_ptr cmp_func, void *src, uint64_t
 		 * type flags will be non-zero. In that case we still indicate a success
 		 * result so that decompression will reverse the pre-processing. The
 		 * type flags will indicate that compression was not done and the
-		 * decompress routine will not be called.
+		 * decompress routine will not be called. The data is already in place
+		 * after the flag byte if the last stage left it in dst.
 		 */
 		if (type > 0) {
-			memcpy(dest+1, src, srclen);
+			if (from != dest + 1)
+				memcpy(dest+1, from, srclen);
+			*dest = type;
 			*dstlen = srclen + 1;
 			result = 0;
 		} else {
@@ -426,7 +517,8 @@ preproc_decompress(pc_ctx_t *pctx, compress_func_ptr dec_func, void *src, uint64
 		int64_t result;
 		hashsize = lzp_hash_size(level);
 		result = lzp_decompress((const uchar_t *)src, (uchar_t *)dst, srclen,
-					hashsize, LZP_DEFAULT_LZPMINLEN, 0);
+					hashsize, LZP_DEFAULT_LZPMINLEN,
+					LZP_FEATURE_MULTITHREADING);
 		if (result > 0) {
 			memcpy(src, dst, result);
 			srclen = result;
@@ -485,6 +577,36 @@ preproc_decompress(pc_ctx_t *pctx, compress_func_ptr dec_func, void *src, uint64
 	return (0);
 }
 
+/*
+ * Copy up to solid_window bytes from the end of a chunk into a priming window
+ * buffer and return the window length.
+ */
+static uint64_t
+solid_copy_tail(pc_ctx_t *pctx, uchar_t *dst, uchar_t *buf, uint64_t len)
+{
+	if (len > pctx->solid_window) {
+		buf += len - pctx->solid_window;
+		len = pctx->solid_window;
+	}
+	if (len > 0)
+		memcpy(dst, buf, len);
+	return (len);
+}
+
+/*
+ * Solid mode decompression: hand the tail of this chunk's data to the thread
+ * that decompresses the next chunk. An empty window is passed on error so that
+ * the next thread does not wait forever.
+ */
+static void
+solid_pass_window(pc_ctx_t *pctx, struct cmp_data *tdat, uchar_t *buf, uint64_t len)
+{
+	struct cmp_data *nxt = tdat->solid_next;
+
+	nxt->prime_len = solid_copy_tail(pctx, nxt->prime, buf, len);
+	Sem_Post(&nxt->prime_sem);
+}
+
 /*
  * This routine is called in multiple threads. Calls the decompression handler
  * as encoded in the file header. For adaptive mode the handler adapt_decompress()
@@ -503,9 +625,11 @@ perform_decompress(void *dat)
 	uchar_t HDR;
 	uchar_t *cseg;
 	pc_ctx_t *pctx;
+	int primed;
 
 	pctx = tdat->pctx;
 redo:
+	primed = 0;
 	Sem_Wait(&tdat->start_sem);
 	if (pctx->main_cancel)
 		return (NULL);
@@ -539,7 +663,9 @@ redo:
 
 	/*
 	 * If this was encrypted:
-	 * Verify HMAC first before anything else and then decrypt compressed data.
+	 * Verify HMAC and decrypt compressed data in a single pass. The decrypted
+	 * data is not touched before the HMAC has been verified. Encryption
+	 * algorithm should not change the size and encryption is in-place.
 	 */
 	if (pctx->encrypt_type) {
 		unsigned int len;
@@ -552,7 +678,19 @@ redo:
 		memset(tdat->compressed_chunk + pctx->cksum_bytes, 0, pctx->mac_bytes);
 		hmac_reinit(&tdat->chunk_hmac);
 		hmac_update(&tdat->chunk_hmac, (uchar_t *)&tdat->len_cmp_be, sizeof (tdat->len_cmp_be));
-		hmac_update(&tdat->chunk_hmac, tdat->compressed_chunk, tdat->rbytes);
+		hmac_update(&tdat->chunk_hmac, tdat->compressed_chunk, tdat->rbytes - tdat->len_cmp);
+		rv = crypto_buf_mac(&(pctx->crypto_ctx), &tdat->chunk_hmac, cseg, tdat->len_cmp,
+		    tdat->id);
+		if (rv == -1) {
+			/*
+			 * Decryption failure is fatal.
+			 */
+			log_msg(LOG_ERR, 0, "Chunk %d, Decryption failed", tdat->id);
+			pctx->main_cancel = 1;
+			tdat->len_cmp = 0;
+			Sem_Post(&tdat->cmp_done_sem);
+			return (NULL);
+		}
 		if (HDR & CHSIZE_MASK) {
 			uchar_t *rseg;
 			rseg = tdat->compressed_chunk + tdat->rbytes;
@@ -571,28 +709,8 @@ redo:
 			return (NULL);
 		}
 		DEBUG_STAT_EN(en = get_wtime_millis());
-		DEBUG_STAT_EN(fprintf(stderr, "HMAC Verification speed %.3f MB/s",
+		DEBUG_STAT_EN(fprintf(stderr, "HMAC Verification + Decryption speed %.3f MB/s\n",
 			      get_mb_s(tdat->rbytes + sizeof (tdat->len_cmp_be), strt, en)));
-
-		/*
-		 * Encryption algorithm should not change the size and
-		 * encryption is in-place.
-		 */
-		DEBUG_STAT_EN(strt = get_wtime_millis());
-		rv = crypto_buf(&(pctx->crypto_ctx), cseg, cseg, tdat->len_cmp, tdat->id);
-		if (rv == -1) {
-			/*
-			 * Decryption failure is fatal.
-			 */
-			log_msg(LOG_ERR, 0, "Chunk %d, Decryption failed", tdat->id);
-			pctx->main_cancel = 1;
-			tdat->len_cmp = 0;
-			Sem_Post(&tdat->cmp_done_sem);
-			return (NULL);
-		}
-		DEBUG_STAT_EN(en = get_wtime_millis());
-		DEBUG_STAT_EN(fprintf(stderr, "Decryption speed %.3f MB/s\n",
-			      get_mb_s(tdat->len_cmp, strt, en)));
 	} else if (pctx->mac_bytes > 0) {
 		/*
 		 * Verify header CRC32 in non-crypto mode.
@@ -629,6 +747,20 @@ redo:
 		deserialize_checksum(tdat->checksum, tdat->compressed_chunk, pctx->cksum_bytes);
 	}
 
+	/*
+	 * In solid mode wait for the previous chunk's tail and prime the decoder
+	 * with it. Chunk decompression is serialized by this.
+	 */
+	if (pctx->solid_mode) {
+		Sem_Wait(&tdat->prime_sem);
+		primed = 1;
+		if (unlikely(tdat->cancel) || pctx->main_cancel) {
+			tdat->len_cmp = 0;
+			goto cont;
+		}
+		pctx->_prime_func(tdat->data, tdat->prime, tdat->prime_len);
+	}
+
 	if ((pctx->enable_rabin_scan || pctx->enable_fixed_scan || pctx->enable_rabin_global) &&
 	    (HDR & CHUNK_FLAG_DEDUP)) {
 		uchar_t *cmpbuf, *ubuf;
@@ -750,6 +882,15 @@ redo:
 		}
 	}
 
+	/*
+	 * The chunk data is complete, the next chunk can start decompressing
+	 * while the checksum is verified.
+	 */
+	if (primed) {
+		solid_pass_window(pctx, tdat, tdat->uncompressed_chunk, _chunksize);
+		primed = 0;
+	}
+
 	if (!pctx->encrypt_type) {
 		/*
 		 * Re-compute checksum of original uncompressed chunk.
@@ -767,6 +908,8 @@ redo:
 	}
 
 cont:
+	if (primed)
+		solid_pass_window(pctx, tdat, NULL, 0);
 	Sem_Post(&tdat->cmp_done_sem);
 	if (!pctx->t_errored)
 		goto redo;
@@ -825,11 +968,15 @@ start_decompress(pc_ctx_t *pctx, const char *filename, char *to_filename)
 	struct cmp_data **dary, *tdat;
 	pthread_t writer_thr;
 	algo_props_t props;
+	prefetch_ctx_t *pf;
+	pf_chunk_t chunk;
+	int rv;
 
 	err = 0;
 	flags = 0;
 	thread = 0;
 	dary = NULL;
+	pf = NULL;
 	init_algo_props(&props);
 
 	/*
@@ -913,12 +1060,22 @@ start_decompress(pc_ctx_t *pctx, const char *filename, char *to_filename)
 		err = 1;
 		goto uncomp_done;
 	}
-	if (version < VERSION-4) {
+	if (version < VERSION-5) {
 		log_msg(LOG_ERR, 0, "Unsupported version: %d", version);
 		err = 1;
 		goto uncomp_done;
 	}
 
+	/*
+	 * Tree hashed single chunk checksums and solid mode appeared in version 11.
+	 * Older files with these flags set are corrupt.
+	 */
+	if (version < 11 && (flags & (FLAG_TREE_HASH | FLAG_SOLID))) {
+		log_msg(LOG_ERR, 0, "Invalid flags 0x%x for version %d", flags, version);
+		err = 1;
+		goto uncomp_done;
+	}
+
 	/*
 	 * First check for archive mode. In that case the to_filename must be a directory.
 	 */
@@ -1039,6 +1196,19 @@ start_decompress(pc_ctx_t *pctx, const char *filename, char *to_filename)
 		}
 	}
 
+	if (flags & FLAG_SOLID) {
+		if (pctx->_prime_func == NULL || props.solid_window == 0) {
+			log_msg(LOG_ERR, 0, "Solid mode is not supported for algorithm %s.",
+			    algorithm);
+			err = 1;
+			goto uncomp_done;
+		}
+		pctx->solid_mode = 1;
+		pctx->solid_window = props.solid_window;
+		if (pctx->solid_window > chunksize)
+			pctx->solid_window = chunksize;
+	}
+
 	dedupe_flag = RABIN_DEDUPE_SEGMENTED; // Silence the compiler
 	if (flags & FLAG_DEDUP) {
 		pctx->enable_rabin_scan = 1;
@@ -1372,7 +1542,7 @@ start_decompress(pc_ctx_t *pctx, const char *filename, char *to_filename)
 			/*
 			 * Finally create the metadata context.
 			 */
-			pctx->meta_ctx = meta_ctx_create(pctx, VERSION, compfd2);
+			pctx->meta_ctx = meta_ctx_create(pctx, version, compfd2);
 			if (pctx->meta_ctx == NULL) {
 				close(compfd2);
 				UNCOMP_BAIL;
@@ -1434,11 +1604,28 @@ start_decompress(pc_ctx_t *pctx, const char *filename, char *to_filename)
 		pctx->temp_mmap_len = chunksize;
 	}
 
+	/*
+	 * Each thread holds a compressed and an uncompressed chunk buffer and the
+	 * prefetch stage keeps PF_QUEUE_DEPTH more compressed buffers. Use fewer
+	 * threads if all of that does not fit in free memory.
+	 */
+	if (pctx->nthreads > 1) {
+		my_sysinfo msys_info;
+		uint64_t pfmem;
+
+		get_sys_limits(&msys_info);
+		pfmem = prefetch_mem(compressed_chunksize);
+		while (pctx->nthreads > 1 && pfmem + (uint64_t)pctx->nthreads * 2 *
+		    compressed_chunksize > (uint64_t)msys_info.freeram)
+			pctx->nthreads--;
+	}
+
 	if (pctx->nthreads * props.nthreads > 1)
 		log_msg(LOG_INFO, 0, "Scaling to %d threads", pctx->nthreads * props.nthreads);
 	else
 		log_msg(LOG_INFO, 0, "Scaling to 1 thread");
 	nprocs = pctx->nthreads;
+	create_worker_pool(pctx);
 	slab_cache_add(compressed_chunksize);
 	slab_cache_add(chunksize);
 	slab_cache_add(sizeof (struct cmp_data));
@@ -1460,12 +1647,17 @@ start_decompress(pc_ctx_t *pctx, const char *filename, char *to_filename)
 		tdat->cancel = 0;
 		tdat->decompressing = 1;
 		if (props.is_single_chunk) {
-			tdat->cksum_mt = 1;
-			if (version == 6) {
-				tdat->cksum_mt = 2; // Indicate old format parallel hash
+			if (flags & FLAG_TREE_HASH) {
+				tdat->cksum_mt = CKSUM_MT_TREE;
+			} else {
+				tdat->cksum_mt = CKSUM_MT_PAR;
+				if (version == 6) {
+					// Indicate old format parallel hash
+					tdat->cksum_mt = CKSUM_MT_PAR_OLD;
+				}
 			}
 		} else {
-			tdat->cksum_mt = 0;
+			tdat->cksum_mt = CKSUM_MT_NONE;
 		}
 		tdat->level = level;
 		tdat->data = NULL;
@@ -1474,6 +1666,16 @@ start_decompress(pc_ctx_t *pctx, const char *filename, char *to_filename)
 		Sem_Init(&(tdat->cmp_done_sem), 0, 0);
 		Sem_Init(&(tdat->write_done_sem), 0, 1);
 		Sem_Init(&(tdat->index_sem), 0, 0);
+		Sem_Init(&(tdat->prime_sem), 0, 0);
+		tdat->prime = NULL;
+		tdat->prime_len = 0;
+		if (pctx->solid_mode) {
+			tdat->prime = (uchar_t *)slab_alloc(NULL, pctx->solid_window);
+			if (!tdat->prime) {
+				log_msg(LOG_ERR, 0, "1: Out of memory");
+				UNCOMP_BAIL;
+			}
+		}
 
 		if (pctx->_init_func) {
 			if (pctx->_init_func(&(tdat->data), &(tdat->level), props.nthreads, chunksize,
@@ -1538,6 +1740,19 @@ start_decompress(pc_ctx_t *pctx, const char *filename, char *to_filename)
 	if (nprocs > 0)
 		Sem_Post(&(dary[0]->index_sem));
 
+	/*
+	 * In solid mode each thread receives its priming window from the thread
+	 * handling the previous chunk. The first chunk has an empty window.
+	 */
+	if (pctx->solid_mode) {
+		for (i = 0; i < nprocs; i++) {
+			tdat = dary[i];
+			tdat->solid_next = dary[(i + 1) % nprocs];
+		}
+		if (nprocs > 0)
+			Sem_Post(&(dary[0]->prime_sem));
+	}
+
 	if (pctx->encrypt_type) {
 		/* Erase encryption key bytes stored as a plain array. No longer reqd. */
 		crypto_clean_pkey(&(pctx->crypto_ctx));
@@ -1558,18 +1773,26 @@ start_decompress(pc_ctx_t *pctx, const char *filename, char *to_filename)
 
 	/*
 	 * Now read from the compressed file in variable compressed chunk size.
-	 * First the size is read from the chunk header and then as many bytes +
-	 * checksum size are read and passed to decompression thread.
-	 * Chunk sequencing is ensured.
+	 * The prefetch stage reads the size from the chunk header and then as
+	 * many bytes + checksum size ahead of the workers. Chunks are handed to
+	 * decompression threads in order. Chunk sequencing is ensured.
 	 */
 	pctx->chunk_num = 0;
 	np = 0;
 	bail = 0;
-	if (nprocs == 0)
+	if (nprocs == 0) {
 		bail = 1;
+	} else {
+		rv = prefetch_create(&pf, pctx, compfd, chunksize, compressed_chunksize);
+		if (rv == PF_ERR_NOMEM) {
+			log_msg(LOG_ERR, 0, "Out of memory for chunk prefetch.");
+			UNCOMP_BAIL;
+		} else if (rv != PF_CHUNK_OK) {
+			log_msg(LOG_ERR, 0, "Failed to start chunk prefetch.");
+			UNCOMP_BAIL;
+		}
+	}
 	while (!bail) {
-		int64_t rb;
-
 		if (pctx->main_cancel) break;
 		for (p = 0; p < nprocs; p++) {
 			np = p;
@@ -1579,60 +1802,38 @@ start_decompress(pc_ctx_t *pctx, const char *filename, char *to_filename)
 			tdat->id = pctx->chunk_num;
 			if (tdat->rctx) tdat->rctx->id = tdat->id;
 
-redo:
 			/*
-			 * First read length of compressed chunk.
+			 * Get the next chunk from the prefetch stage. Metadata chunks
+			 * have already been skipped.
 			 */
-			rb = Read(compfd, &tdat->len_cmp, sizeof (tdat->len_cmp));
-			if (rb != sizeof (tdat->len_cmp)) {
-				if (rb < 0) log_msg(LOG_ERR, 1, "Read: ");
-				else
-					log_msg(LOG_ERR, 0, "Incomplete chunk %d header,"
-					    "file corrupt", pctx->chunk_num);
-				UNCOMP_BAIL;
+			rv = prefetch_get(pf, &chunk);
+			if (rv == PF_EOF) {
+				bail = 1;
+				break;
 			}
-			tdat->len_cmp_be = tdat->len_cmp; // Needed for HMAC
-			tdat->len_cmp = htonll(tdat->len_cmp);
-
-			/*
-			 * Check for ridiculous length.
-			 */
-			if (tdat->len_cmp > chunksize + 256) {
+			switch (rv) {
+			case PF_CHUNK_OK:
+				break;
+			case PF_ERR_READ:
+				errno = chunk.err;
+				log_msg(LOG_ERR, 1, "Read: ");
+				UNCOMP_BAIL;
+			case PF_ERR_HDR:
+				log_msg(LOG_ERR, 0, "Incomplete chunk %d header,"
+				    "file corrupt", pctx->chunk_num);
+				UNCOMP_BAIL;
+			case PF_ERR_LEN:
 				log_msg(LOG_ERR, 0, "Compressed length too big for chunk: %d",
 				    pctx->chunk_num);
 				UNCOMP_BAIL;
-			}
-
-			/*
-			 * Zero compressed len means end of file.
-			 */
-			if (tdat->len_cmp == 0) {
-				bail = 1;
-				break;
-
-			} else if (tdat->len_cmp == METADATA_INDICATOR) {
-				if (!pctx->meta_stream) {
-					log_msg(LOG_ERR, 0, "Invalid chunk %d length: %" PRIu64 "\n",
-						pctx->chunk_num, tdat->len_cmp);
-					UNCOMP_BAIL;
-				}
-				/*
-				 * If compressed length indicates a metadata chunk. Read it's length
-				 * and skip the chunk.
-				 */
-				rb = Read(compfd, &tdat->len_cmp_be, sizeof (tdat->len_cmp_be));
-				if (rb != sizeof (tdat->len_cmp_be)) {
-					if (rb < 0) log_msg(LOG_ERR, 1, "Read: ");
-					else
-						log_msg(LOG_ERR, 0, "Incomplete chunk %d header,"
-							"file corrupt", pctx->chunk_num);
-					UNCOMP_BAIL;
-				}
-
-				/*
-				 * We will be reading and skipping this chunk next.
-				 */
-				tdat->len_cmp_be = LE64(tdat->len_cmp_be);
+			case PF_ERR_META:
+				log_msg(LOG_ERR, 0, "Invalid chunk %d length: %" PRIu64 "\n",
+					pctx->chunk_num, chunk.len_cmp);
+				UNCOMP_BAIL;
+			default:
+				log_msg(LOG_ERR, 0, "Incomplete chunk %d, file corrupt.",
+				    pctx->chunk_num);
+				UNCOMP_BAIL;
 			}
 
 			/*
@@ -1642,60 +1843,35 @@ redo:
 			 * decompression allows to avoid allocating per-thread chunks which will
 			 * never be used. This can happen if chunk count < thread count.
 			 */
-			if (!tdat->compressed_chunk && tdat->len_cmp != METADATA_INDICATOR) {
+			if (!tdat->compressed_chunk) {
 				tdat->compressed_chunk = (uchar_t *)slab_alloc(NULL,
 				    compressed_chunksize);
 				tdat->uncompressed_chunk = (uchar_t *)slab_alloc(NULL,
 				    compressed_chunksize);
 				if (!tdat->compressed_chunk || !tdat->uncompressed_chunk) {
+					prefetch_release(pf, chunk.buf);
 					log_msg(LOG_ERR, 0, "2: Out of memory");
 					UNCOMP_BAIL;
 				}
 				tdat->cmp_seg = tdat->uncompressed_chunk;
 			}
 
-			if (tdat->len_cmp != METADATA_INDICATOR) {
-				if (tdat->len_cmp > pctx->largest_chunk)
-					pctx->largest_chunk = tdat->len_cmp;
-				if (tdat->len_cmp < pctx->smallest_chunk)
-					pctx->smallest_chunk = tdat->len_cmp;
-				pctx->avg_chunk += tdat->len_cmp;
-
-				/*
-				 * Now read compressed chunk including the checksum. This is
-				 * a seek if it is just a listing operation. No data is
-				 * processed in that case.
-				 */
-				rb = tdat->len_cmp + pctx->cksum_bytes + pctx->mac_bytes +
-				    CHUNK_FLAG_SZ;
-				tdat->rbytes = Read(compfd, tdat->compressed_chunk, rb);
-			} else {
-				off_t cpos = lseek(compfd, 0, SEEK_CUR);
-
-				 /* Two values already read */
-				rb = tdat->len_cmp_be + METADATA_HDR_SZ - 16;
-				tdat->rbytes = lseek(compfd, rb, SEEK_CUR);
-				if (tdat->rbytes > 0)
-					tdat->rbytes = tdat->rbytes - cpos;
-			}
-			if (pctx->main_cancel) break;
-			if (tdat->rbytes < rb) {
-				if (tdat->rbytes < 0) {
-					log_msg(LOG_ERR, 1, "Read: ");
-					UNCOMP_BAIL;
-				} else {
-					log_msg(LOG_ERR, 0, "Incomplete chunk %d, file corrupt.",
-					    pctx->chunk_num);
-					UNCOMP_BAIL;
-				}
-			}
-
 			/*
-			 * If we just skipped a metadata chunk, redo the read to go to the next one.
+			 * Swap the prefetched chunk buffer in and hand the worker's
+			 * previous buffer back to the prefetch stage.
 			 */
-			if (tdat->len_cmp == METADATA_INDICATOR) {
-				goto redo;
-			}
+			prefetch_release(pf, tdat->compressed_chunk);
+			tdat->compressed_chunk = chunk.buf;
+			tdat->len_cmp = chunk.len_cmp;
+			tdat->len_cmp_be = chunk.len_cmp_be;
+			tdat->rbytes = chunk.rbytes;
+
+			if (tdat->len_cmp > pctx->largest_chunk)
+				pctx->largest_chunk = tdat->len_cmp;
+			if (tdat->len_cmp < pctx->smallest_chunk)
+				pctx->smallest_chunk = tdat->len_cmp;
+			pctx->avg_chunk += tdat->len_cmp;
+			if (pctx->main_cancel) break;
 			Sem_Post(&tdat->start_sem);
 			++(pctx->chunk_num);
 		}
@@ -1717,11 +1893,14 @@ uncomp_done:
 			tdat->len_cmp = 0;
 			Sem_Post(&tdat->start_sem);
 			Sem_Post(&tdat->cmp_done_sem);
+			Sem_Post(&tdat->prime_sem);
 			pthread_join(tdat->thr, NULL);
 		}
 		if (thread == 2)
 			pthread_join(writer_thr, NULL);
 	}
+	prefetch_destroy(pf);
+	destroy_worker_pool(pctx);
 
 	/*
 	 * Ownership and mode of target should be same as original.
@@ -1743,10 +1922,13 @@ uncomp_done:
 			if ((pctx->enable_rabin_scan || pctx->enable_fixed_scan)) {
 				destroy_dedupe_context(dary[i]->rctx);
 			}
+			if (dary[i]->prime)
+				slab_release(NULL, dary[i]->prime);
 			Sem_Destroy(&(dary[i]->start_sem));
 			Sem_Destroy(&(dary[i]->cmp_done_sem));
 			Sem_Destroy(&(dary[i]->write_done_sem));
 			Sem_Destroy(&(dary[i]->index_sem));
+			Sem_Destroy(&(dary[i]->prime_sem));
 
 			slab_release(NULL, dary[i]);
 		}
@@ -1781,9 +1963,9 @@ static void *
 perform_compress(void *dat) {
 	struct cmp_data *tdat = (struct cmp_data *)dat;
 	typeof (tdat->chunksize) _chunksize, len_cmp, dedupe_index_sz, index_size_cmp;
-	int type, rv;
-	uchar_t *compressed_chunk;
-	int64_t rbytes;
+	int type, rv, in_alt;
+	uchar_t *compressed_chunk, *tmp;
+	int64_t rbytes, hdr_off;
 	pc_ctx_t *pctx;
 
 	pctx = tdat->pctx;
@@ -1796,9 +1978,15 @@ redo:
 	}
 
 	compressed_chunk = tdat->compressed_chunk + CHUNK_FLAG_SZ;
+	hdr_off = compressed_chunk - tdat->cmp_seg;
 	rbytes = tdat->rbytes;
 	dedupe_index_sz = 0;
 	type = COMPRESSED;
+	in_alt = 0;
+
+	/* Prime the encoder with the previous chunk's tail in solid mode. */
+	if (pctx->solid_mode)
+		pctx->_prime_func(tdat->data, tdat->prime, tdat->prime_len);
 
 	/* Perform Dedup if enabled. */
 	if ((pctx->enable_rabin_scan || pctx->enable_fixed_scan)) {
@@ -1822,7 +2010,15 @@ redo:
 						  NULL, tdat->cksum_mt);
 		tdat->rbytes = rb;
 		if (!rctx->valid) {
-			memcpy(tdat->uncompressed_chunk, tdat->cmp_seg, rbytes);
+			/*
+			 * Both buffers are of the same size so switch them instead of
+			 * copying the data into uncompressed_chunk.
+			 */
+			tmp = tdat->cmp_seg;
+			tdat->cmp_seg = tdat->uncompressed_chunk;
+			tdat->uncompressed_chunk = tmp;
+			tdat->compressed_chunk = tdat->cmp_seg + hdr_off - CHUNK_FLAG_SZ;
+			compressed_chunk = tdat->compressed_chunk + CHUNK_FLAG_SZ;
 			tdat->rbytes = rbytes;
 		}
 	} else {
@@ -1885,11 +2081,30 @@ plain_index:
 		/* Compress data chunk. */
 		if (_chunksize == 0) {
 			rv = -1;
+		} else if (chunk_incompressible(tdat, tdat->uncompressed_chunk + dedupe_index_sz,
+		    _chunksize)) {
+			rv = -1;
 		} else if (pctx->preprocess_mode) {
 			rv = preproc_compress(pctx, tdat->compress,
 			    tdat->uncompressed_chunk + dedupe_index_sz, _chunksize,
-			    compressed_chunk + index_size_cmp, &_chunksize, tdat->level, 0,
-			    tdat->btype, tdat->data, tdat->props, tdat->interesting);
+			    compressed_chunk + index_size_cmp,
+			    tdat->uncompressed_chunk + hdr_off + index_size_cmp, &in_alt,
+			    &_chunksize, tdat->level, 0, tdat->btype, tdat->data, tdat->props,
+			    tdat->interesting);
+
+			/*
+			 * The result was placed in uncompressed_chunk at the same offset
+			 * as in cmp_seg. Bring over the header and index and switch.
+			 */
+			if (in_alt) {
+				memcpy(tdat->uncompressed_chunk + hdr_off, compressed_chunk,
+				    index_size_cmp);
+				tmp = tdat->cmp_seg;
+				tdat->cmp_seg = tdat->uncompressed_chunk;
+				tdat->uncompressed_chunk = tmp;
+				tdat->compressed_chunk = tdat->cmp_seg + hdr_off - CHUNK_FLAG_SZ;
+				compressed_chunk = tdat->compressed_chunk + CHUNK_FLAG_SZ;
+			}
 		} else {
 			DEBUG_STAT_EN(double strt, en);
 
@@ -1902,8 +2117,11 @@ plain_index:
 					      get_mb_s(_chunksize, strt, en)));
 		}
 
-		/* Can't compress data just retain as-is. */
-		if (rv < 0 || _chunksize >= o_chunksize) {
+		/*
+		 * Can't compress data just retain as-is. A result moved over from
+		 * uncompressed_chunk is kept since the raw data is gone by then.
+		 */
+		if (rv < 0 || (_chunksize >= o_chunksize && !in_alt)) {
 			_chunksize = o_chunksize;
 			type = UNCOMPRESSED;
 			memcpy(compressed_chunk + index_size_cmp,
@@ -1914,10 +2132,20 @@ plain_index:
 		_chunksize += index_size_cmp;
 	} else {
 		_chunksize = tdat->rbytes;
-		if (pctx->preprocess_mode) {
+		if (chunk_incompressible(tdat, tdat->uncompressed_chunk, tdat->rbytes)) {
+			rv = -1;
+		} else if (pctx->preprocess_mode) {
 			rv = preproc_compress(pctx, tdat->compress, tdat->uncompressed_chunk,
-			    tdat->rbytes, compressed_chunk, &_chunksize, tdat->level, 0,
-			    tdat->btype, tdat->data, tdat->props, tdat->interesting);
+			    tdat->rbytes, compressed_chunk, tdat->uncompressed_chunk + hdr_off,
+			    &in_alt, &_chunksize, tdat->level, 0, tdat->btype, tdat->data,
+			    tdat->props, tdat->interesting);
+			if (in_alt) {
+				tmp = tdat->cmp_seg;
+				tdat->cmp_seg = tdat->uncompressed_chunk;
+				tdat->uncompressed_chunk = tmp;
+				tdat->compressed_chunk = tdat->cmp_seg + hdr_off - CHUNK_FLAG_SZ;
+				compressed_chunk = tdat->compressed_chunk + CHUNK_FLAG_SZ;
+			}
 		} else {
 			DEBUG_STAT_EN(double strt, en);
 
@@ -1952,35 +2180,6 @@ plain_index:
 		if (rv < 0) rv = COMPRESS_NONE;
 	}
 
-	/*
-	 * Now perform encryption on the compressed data, if requested.
-	 */
-	if (pctx->encrypt_type) {
-		int ret;
-		DEBUG_STAT_EN(double strt, en);
-
-		/*
-		 * Encryption algorithm must not change the size and
-		 * encryption is in-place.
-		 */
-		DEBUG_STAT_EN(strt = get_wtime_millis());
-		ret = crypto_buf(&(pctx->crypto_ctx), compressed_chunk, compressed_chunk,
-			tdat->len_cmp, tdat->id);
-		if (ret == -1) {
-			/*
-			 * Encryption failure is fatal.
-			 */
-			pctx->main_cancel = 1;
-			tdat->len_cmp = 0;
-			pctx->t_errored = 1;
-			Sem_Post(&tdat->cmp_done_sem);
-			return (0);
-		}
-		DEBUG_STAT_EN(en = get_wtime_millis());
-		DEBUG_STAT_EN(fprintf(stderr, "Encryption speed %.3f MB/s\n",
-			      get_mb_s(tdat->len_cmp, strt, en)));
-	}
-
 	if ((pctx->enable_rabin_scan || pctx->enable_fixed_scan) && tdat->rctx->valid) {
 		type |= CHUNK_FLAG_DEDUP;
 	}
@@ -2024,24 +2223,45 @@ plain_index:
 	*(tdat->compressed_chunk) = type;
 
 	/*
-	 * If encrypting, compute HMAC for full chunk including header.
+	 * If encrypting, encrypt the compressed data and compute HMAC for full chunk
+	 * including header. Encryption and HMAC are done in a single pass over the
+	 * data. Encryption algorithm must not change the size and encryption is
+	 * in-place.
 	 */
 	if (pctx->encrypt_type) {
 		uchar_t *mac_ptr;
 		unsigned int hlen;
 		uchar_t chash[pctx->mac_bytes];
+		int64_t dlen;
 		DEBUG_STAT_EN(double strt, en);
 
 		/* Clean out mac_bytes to 0 for stable HMAC. */
 		DEBUG_STAT_EN(strt = get_wtime_millis());
 		mac_ptr = tdat->cmp_seg + sizeof (tdat->len_cmp) + pctx->cksum_bytes;
 		memset(mac_ptr, 0, pctx->mac_bytes);
+		dlen = tdat->len_cmp - rbytes;
+		if (type & CHSIZE_MASK)
+			dlen -= ORIGINAL_CHUNKSZ;
+
 		hmac_reinit(&tdat->chunk_hmac);
-		hmac_update(&tdat->chunk_hmac, tdat->cmp_seg, tdat->len_cmp);
+		hmac_update(&tdat->chunk_hmac, tdat->cmp_seg, rbytes);
+		if (crypto_buf_mac(&(pctx->crypto_ctx), &tdat->chunk_hmac, compressed_chunk,
+		    dlen, tdat->id) == -1) {
+			/*
+			 * Encryption failure is fatal.
+			 */
+			pctx->main_cancel = 1;
+			tdat->len_cmp = 0;
+			pctx->t_errored = 1;
+			Sem_Post(&tdat->cmp_done_sem);
+			return (0);
+		}
+		if (type & CHSIZE_MASK)
+			hmac_update(&tdat->chunk_hmac, compressed_chunk + dlen, ORIGINAL_CHUNKSZ);
 		hmac_final(&tdat->chunk_hmac, chash, &hlen);
 		serialize_checksum(chash, mac_ptr, hlen);
 		DEBUG_STAT_EN(en = get_wtime_millis());
-		DEBUG_STAT_EN(fprintf(stderr, "HMAC Computation speed %.3f MB/s\n",
+		DEBUG_STAT_EN(fprintf(stderr, "Encryption + HMAC speed %.3f MB/s\n",
 			      get_mb_s(tdat->len_cmp, strt, en)));
 	} else {
 		/*
@@ -2141,7 +2361,8 @@ start_compress(pc_ctx_t *pctx, const char *filename, uint64_t chunksize, int lev
 	uint32_t i, nprocs, np, p, dedupe_flag;
 	struct cmp_data **dary = NULL, *tdat;
 	pthread_t writer_thr;
-	uchar_t *cread_buf, *pos;
+	uchar_t *cread_buf, *pos, *solid_tail;
+	uint64_t solid_tail_len;
 	dedupe_context_t *rctx;
 	algo_props_t props;
 	my_sysinfo msys_info;
@@ -2150,6 +2371,8 @@ start_compress(pc_ctx_t *pctx, const char *filename, uint64_t chunksize, int lev
 	props.cksum = pctx->cksum;
 	props.buf_extra = 0;
 	cread_buf = NULL;
+	solid_tail = NULL;
+	solid_tail_len = 0;
 	pctx->btype = TYPE_UNKNOWN;
 	flags = 0;
 	sbuf.st_size = 0;
@@ -2227,13 +2450,10 @@ start_compress(pc_ctx_t *pctx, const char *filename, uint64_t chunksize, int lev
 	rctx = NULL;
 
 	/*
-	 * Get number of lCPUs. When archiving with advanced filters, we use one less
-	 * lCPU to reduce threads due to increased memory requirements.
+	 * Get number of lCPUs. Memory used by the advanced filters is accounted
+	 * for by their budget below, so the thread count is not reduced for them.
 	 */
 	nprocs = (uint32_t)sysconf(_SC_NPROCESSORS_ONLN);
-	if (pctx->archive_mode && (pctx->enable_packjpg || pctx->enable_wavpack)) {
-		nprocs = nprocs > 1 ? nprocs-1:nprocs;
-	}
 
 	if (pctx->nthreads > 0 && pctx->nthreads < nprocs)
 		nprocs = pctx->nthreads;
@@ -2284,7 +2504,7 @@ start_compress(pc_ctx_t *pctx, const char *filename, uint64_t chunksize, int lev
 			pctx->nthreads = 1;
 			single_chunk = 1;
 			props.is_single_chunk = 1;
-			flags |= FLAG_SINGLE_CHUNK;
+			flags |= (FLAG_SINGLE_CHUNK | FLAG_TREE_HASH);
 
 			/*
 			 * Disable deduplication if file is too small.
@@ -2426,6 +2646,27 @@ start_compress(pc_ctx_t *pctx, const char *filename, uint64_t chunksize, int lev
 		}
 	}
 
+	/*
+	 * In solid mode each chunk's encoder is primed with up to solid_window
+	 * bytes from the end of the previous chunk. Nothing to do for a single
+	 * chunk.
+	 */
+	if (pctx->solid_mode) {
+		if (single_chunk) {
+			pctx->solid_mode = 0;
+		} else {
+			pctx->solid_window = props.solid_window;
+			if (pctx->solid_window > chunksize)
+				pctx->solid_window = chunksize;
+			solid_tail = (uchar_t *)slab_alloc(NULL, pctx->solid_window);
+			if (!solid_tail) {
+				log_msg(LOG_ERR, 0, "3: Out of memory");
+				COMP_BAIL;
+			}
+			flags |= FLAG_SOLID;
+		}
+	}
+
 	if (pctx->enable_rabin_scan || pctx->enable_fixed_scan || pctx->enable_rabin_global) {
 		if (pctx->enable_rabin_global) {
 			flags |= (FLAG_DEDUP | FLAG_DEDUP_FIXED);
@@ -2454,11 +2695,14 @@ start_compress(pc_ctx_t *pctx, const char *filename, uint64_t chunksize, int lev
 		flags |= pctx->encrypt_type;
 
 	set_threadcounts(&props, &(pctx->nthreads), nprocs, COMPRESS_THREADS);
+	if (pctx->adapt_mode)
+		adapt_set_target_speed(pctx->target_speed, pctx->nthreads);
 	if (pctx->nthreads * props.nthreads > 1)
 		log_msg(LOG_INFO, 0, "Scaling to %d threads", pctx->nthreads * props.nthreads);
 	else
 		log_msg(LOG_INFO, 0, "Scaling to 1 thread");
 	nprocs = pctx->nthreads;
+	create_worker_pool(pctx);
 	dary = (struct cmp_data **)slab_calloc(NULL, nprocs, sizeof (struct cmp_data *));
 	cread_buf = (uchar_t *)slab_alloc(NULL, compressed_chunksize);
 	if (!cread_buf) {
@@ -2475,6 +2719,8 @@ start_compress(pc_ctx_t *pctx, const char *filename, uint64_t chunksize, int lev
 		tdat = dary[i];
 		tdat->pctx = pctx;
 		tdat->cmp_seg = NULL;
+		tdat->prime = NULL;
+		tdat->prime_len = 0;
 		tdat->chunksize = chunksize;
 		tdat->compress = pctx->_compress_func;
 		tdat->decompress = pctx->_decompress_func;
@@ -2500,12 +2746,19 @@ start_compress(pc_ctx_t *pctx, const char *filename, uint64_t chunksize, int lev
 			log_msg(LOG_ERR, 0, "5: Out of memory");
 			COMP_BAIL;
 		}
+		if (pctx->solid_mode) {
+			tdat->prime = (uchar_t *)slab_alloc(NULL, pctx->solid_window);
+			if (!tdat->prime) {
+				log_msg(LOG_ERR, 0, "5: Out of memory");
+				COMP_BAIL;
+			}
+		}
 		tdat->cancel = 0;
 		tdat->decompressing = 0;
 		if (single_chunk)
-			tdat->cksum_mt = 1;
+			tdat->cksum_mt = CKSUM_MT_TREE;
 		else
-			tdat->cksum_mt = 0;
+			tdat->cksum_mt = CKSUM_MT_NONE;
 		tdat->level = level;
 		tdat->data = NULL;
 		tdat->rctx = NULL;
@@ -2551,17 +2804,19 @@ start_compress(pc_ctx_t *pctx, const char *filename, uint64_t chunksize, int lev
 	/*
 	 * initialize Dedupe Context here after all other allocations so that index size can be
 	 * correctly computed based on free memory. The freeram got here is adjusted amount.
-	 * When archiving, filter scratch buffer is taken into account.
+	 * When archiving, the filter memory budget is taken into account.
 	 */
 	get_sys_limits(&msys_info);
 
 	if (pctx->enable_packjpg || pctx->enable_wavpack) {
-		if (FILTER_SCRATCH_SIZE_MAX >= msys_info.freeram ||
-		    msys_info.freeram - FILTER_SCRATCH_SIZE_MAX < FILTER_SCRATCH_SIZE_MAX) {
+		uint64_t budget = filter_mem_budget();
+
+		if (budget >= msys_info.freeram ||
+		    msys_info.freeram - budget < budget) {
 			log_msg(LOG_WARN, 0, "Not enough memory. Disabling advanced filters.");
 			disable_all_filters();
 		} else {
-			msys_info.freeram -= FILTER_SCRATCH_SIZE_MAX;
+			msys_info.freeram -= budget;
 		}
 	}
 
@@ -2793,6 +3048,24 @@ start_compress(pc_ctx_t *pctx, const char *filename, uint64_t chunksize, int lev
 				}
 			}
 
+			/*
+			 * In solid mode the chunk is primed with the tail of the
+			 * previous chunk and its own tail is kept for the next one.
+			 */
+			if (pctx->solid_mode) {
+				tmp = tdat->prime;
+				tdat->prime = solid_tail;
+				tdat->prime_len = solid_tail_len;
+				solid_tail = tmp;
+				if (pctx->enable_rabin_scan || pctx->enable_fixed_scan ||
+				    pctx->enable_rabin_global)
+					tmp = tdat->cmp_seg;
+				else
+					tmp = tdat->uncompressed_chunk;
+				solid_tail_len = solid_copy_tail(pctx, solid_tail, tmp,
+				    tdat->rbytes);
+			}
+
 			/* Signal the compression thread to start */
 			Sem_Post(&tdat->start_sem);
 			++(pctx->chunk_num);
@@ -2862,6 +3135,7 @@ comp_done:
 		if (thread == 2)
 			pthread_join(writer_thr, NULL);
 	}
+	destroy_worker_pool(pctx);
 
 	if (err) {
 		if (compfd != -1 && !pctx->pipe_mode && !pctx->pipe_out) {
@@ -2919,6 +3193,8 @@ comp_done:
 			}
 			if (pctx->_deinit_func)
 				pctx->_deinit_func(&(dary[i]->data));
+			if (dary[i]->prime)
+				slab_release(NULL, dary[i]->prime);
 			Sem_Destroy(&(dary[i]->start_sem));
 			Sem_Destroy(&(dary[i]->cmp_done_sem));
 			Sem_Destroy(&(dary[i]->write_done_sem));
@@ -2931,6 +3207,8 @@ comp_done:
 	if (pctx->enable_rabin_split) destroy_dedupe_context(rctx);
 	if (cread_buf != (uchar_t *)1)
 		slab_release(NULL, cread_buf);
+	if (solid_tail)
+		slab_release(NULL, solid_tail);
 	if (!pctx->pipe_mode) {
 		if (compfd != -1) close(compfd);
 	}
@@ -2966,6 +3244,7 @@ init_algo(pc_ctx_t *pctx, const char *algo, int bail)
 	/* Copy given string into known length buffer to avoid memcmp() overruns. */
 	strncpy(algorithm, algo, 8);
 	pctx->_props_func = NULL;
+	pctx->_prime_func = NULL;
 	if (memcmp(algorithm, "zlib", 4) == 0) {
 		pctx->_compress_func = zlib_compress;
 		pctx->_decompress_func = zlib_decompress;
@@ -2973,6 +3252,17 @@ init_algo(pc_ctx_t *pctx, const char *algo, int bail)
 		pctx->_deinit_func = zlib_deinit;
 		pctx->_stats_func = zlib_stats;
 		pctx->_props_func = zlib_props;
+		pctx->_prime_func = zlib_prime;
+		rv = 0;
+
+	/* lzmaMtX and lzmaMt ordering of the checks matter here. */
+	} else if (memcmp(algorithm, "lzmaMtX", 7) == 0) {
+		pctx->_compress_func = lzma_mtx_compress;
+		pctx->_decompress_func = lzma_mtx_decompress;
+		pctx->_init_func = lzma_init;
+		pctx->_deinit_func = lzma_deinit;
+		pctx->_stats_func = lzma_stats;
+		pctx->_props_func = lzma_mtx_props;
 		rv = 0;
 
 	} else if (memcmp(algorithm, "lzmaMt", 6) == 0) {
@@ -2982,6 +3272,7 @@ init_algo(pc_ctx_t *pctx, const char *algo, int bail)
 		pctx->_deinit_func = lzma_deinit;
 		pctx->_stats_func = lzma_stats;
 		pctx->_props_func = lzma_mt_props;
+		pctx->_prime_func = lzma_prime;
 		rv = 0;
 
 	} else if (memcmp(algorithm, "lzma", 4) == 0) {
@@ -2991,6 +3282,7 @@ init_algo(pc_ctx_t *pctx, const char *algo, int bail)
 		pctx->_deinit_func = lzma_deinit;
 		pctx->_stats_func = lzma_stats;
 		pctx->_props_func = lzma_props;
+		pctx->_prime_func = lzma_prime;
 		rv = 0;
 
 	} else if (memcmp(algorithm, "bzip2", 5) == 0) {
@@ -3069,6 +3361,16 @@ init_algo(pc_ctx_t *pctx, const char *algo, int bail)
 		pctx->_stats_func = libbsc_stats;
 		pctx->_props_func = libbsc_props;
 		rv = 0;
+#endif
+#ifdef ENABLE_PC_ZSTD
+	} else if (memcmp(algorithm, "zstd", 4) == 0) {
+		pctx->_compress_func = zstd_compress;
+		pctx->_decompress_func = zstd_decompress;
+		pctx->_init_func = zstd_init;
+		pctx->_deinit_func = zstd_deinit;
+		pctx->_stats_func = zstd_stats;
+		pctx->_props_func = zstd_props;
+		rv = 0;
 #endif
 	}
 
@@ -3085,6 +3387,8 @@ create_pc_context(void)
 
 	slab_init();
 	init_pcompress();
+	analyzer_module_init(&proc_info);
+	transpose_module_init(&proc_info);
 	init_archive_mod();
 
 	memset(ctx, 0, sizeof (pc_ctx_t));
@@ -3154,7 +3458,7 @@ init_pc_context(pc_ctx_t *pctx, int argc, char *argv[])
 	ff.exe_preprocess = 0;
 
 	pthread_mutex_lock(&opt_parse);
-	while ((opt = getopt(argc, argv, "dc:s:l:pt:MCDGEe:w:LPS:B:Fk:avmKjxiTn")) != -1) {
+	while ((opt = getopt(argc, argv, "dc:s:l:pt:MCDGEe:w:LPS:B:Fk:avmKjxiTnR:WQ:")) != -1) {
 		int ovr;
 		int64_t chunksize;
 
@@ -3338,6 +3642,30 @@ init_pc_context(pc_ctx_t *pctx, int argc, char *argv[])
 			pctx->enable_archive_sort = -1;
 			break;
 
+		    case 'R':
+			ovr = parse_numeric(&(pctx->target_speed), optarg);
+			if (ovr == 1) {
+				log_msg(LOG_ERR, 0, "Target speed too large %s", optarg);
+				return (1);
+
+			} else if (ovr == 2 || pctx->target_speed <= 0) {
+				log_msg(LOG_ERR, 0, "Invalid number %s", optarg);
+				return (1);
+			}
+			break;
+
+		    case 'W':
+			pctx->solid_mode = 1;
+			break;
+
+		    case 'Q':
+			pctx->meta_codec = meta_codec_id(optarg);
+			if (pctx->meta_codec == -1) {
+				log_msg(LOG_ERR, 0, "Invalid metadata algorithm %s", optarg);
+				return (1);
+			}
+			break;
+
 		    case '?':
 		    default:
 			return (2);
@@ -3370,6 +3698,22 @@ init_pc_context(pc_ctx_t *pctx, int argc, char *argv[])
 		init_algo(pctx, pctx->algo, 1);
 	}
 
+	if (pctx->target_speed > 0 && pctx->do_compress && !pctx->adapt_mode) {
+		log_msg(LOG_ERR, 0, "Target speed (-R) needs the adapt or adapt2 algorithm.");
+		return (1);
+	}
+
+	if (pctx->solid_mode && pctx->do_compress) {
+		if (pctx->_prime_func == NULL) {
+			log_msg(LOG_ERR, 0, "Solid mode (-W) needs the zlib, lzma or lzmaMt algorithm.");
+			return (1);
+		}
+		if (pctx->enable_rabin_global) {
+			log_msg(LOG_ERR, 0, "Solid mode (-W) cannot be used with global dedupe (-G).");
+			return (1);
+		}
+	}
+
 	if (pctx->level == -1 && pctx->do_compress) {
 		if (memcmp(pctx->algo, "lz4", 3) == 0) {
 			pctx->level = 1;
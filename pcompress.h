@@ -36,17 +36,20 @@ extern "C" {
 
 #include <rabin_dedup.h>
 #include <crypto_utils.h>
+#include <wpool.h>
 #include <filters/analyzer/analyzer.h>
 #include <meta_stream.h>
 
 #define	CHUNK_FLAG_SZ	1
 #define	ALGO_SZ		8
 #define	MIN_CHUNK	2048
-#define	VERSION		10
+#define	VERSION		11
 #define	FLAG_DEDUP	1
 #define	FLAG_DEDUP_FIXED	2
 #define	FLAG_SINGLE_CHUNK	4
 #define FLAG_META_STREAM	4096
+#define	FLAG_TREE_HASH	8192
+#define	FLAG_SOLID	16384
 #define	FLAG_ARCHIVE	2048
 #define	UTILITY_VERSION	"3.1"
 #define	MASK_CRYPTO_ALG	0x30
@@ -96,6 +99,11 @@ extern "C" {
  * fastest algo at our disposal for these cases.
  */
 #define	ADAPT_COMPRESS_LZ4	5
+/*
+ * Zstd, when built in, takes over the incompressible fallback above and binary data
+ * in adapt mode.
+ */
+#define	ADAPT_COMPRESS_ZSTD	6
 #define	CHDR_ALGO_MASK	7
 #define	CHDR_ALGO(x) (((x)>>4) & CHDR_ALGO_MASK)
 
@@ -106,6 +114,8 @@ extern int zlib_compress(void *src, uint64_t srclen, void *dst,
 	uint64_t *destlen, int level, uchar_t chdr, int btype, void *data);
 extern int lzma_compress(void *src, uint64_t srclen, void *dst,
 	uint64_t *destlen, int level, uchar_t chdr, int btype, void *data);
+extern int lzma_mtx_compress(void *src, uint64_t srclen, void *dst,
+	uint64_t *dstlen, int level, uchar_t chdr, int btype, void *data);
 extern int bzip2_compress(void *src, uint64_t srclen, void *dst,
 	uint64_t *destlen, int level, uchar_t chdr, int btype, void *data);
 extern int adapt_compress(void *src, uint64_t srclen, void *dst,
@@ -123,6 +133,8 @@ extern int zlib_decompress(void *src, uint64_t srclen, void *dst,
 	uint64_t *dstlen, int level, uchar_t chdr, int btype, void *data);
 extern int lzma_decompress(void *src, uint64_t srclen, void *dst,
 	uint64_t *dstlen, int level, uchar_t chdr, int btype, void *data);
+extern int lzma_mtx_decompress(void *src, uint64_t srclen, void *dst,
+	uint64_t *dstlen, int level, uchar_t chdr, int btype, void *data);
 extern int bzip2_decompress(void *src, uint64_t srclen, void *dst,
 	uint64_t *dstlen, int level, uchar_t chdr, int btype, void *data);
 extern int adapt_decompress(void *src, uint64_t srclen, void *dst,
@@ -155,9 +167,12 @@ extern int lz4_init(void **data, int *level, int nthreads, uint64_t chunksize,
 extern int none_init(void **data, int *level, int nthreads, uint64_t chunksize,
 		     int file_version, compress_op_t op);
 extern void adapt_set_analyzer_ctx(void *data, analyzer_ctx_t *actx);
+extern void adapt_set_target_speed(uint64_t speed, int nworkers);
 
 extern void lzma_props(algo_props_t *data, int level, uint64_t chunksize);
 extern void lzma_mt_props(algo_props_t *data, int level, uint64_t chunksize);
+extern void lzma_mtx_props(algo_props_t *data, int level, uint64_t chunksize);
+extern void lzma_set_wpool(wpool_t *wp);
 extern void lz4_props(algo_props_t *data, int level, uint64_t chunksize);
 extern void zlib_props(algo_props_t *data, int level, uint64_t chunksize);
 extern void ppmd_props(algo_props_t *data, int level, uint64_t chunksize);
@@ -183,6 +198,9 @@ extern void lz_fx_stats(int show);
 extern void lz4_stats(int show);
 extern void none_stats(int show);
 
+extern void zlib_prime(void *data, uchar_t *buf, uint64_t len);
+extern void lzma_prime(void *data, uchar_t *buf, uint64_t len);
+
 #ifdef ENABLE_PC_LIBBSC
 extern int libbsc_compress(void *src, uint64_t srclen, void *dst,
 	uint64_t *dstlen, int level, uchar_t chdr, int btype, void *data);
@@ -193,6 +211,20 @@ extern int libbsc_init(void **data, int *level, int nthreads, uint64_t chunksize
 extern void libbsc_props(algo_props_t *data, int level, uint64_t chunksize);
 extern int libbsc_deinit(void **data);
 extern void libbsc_stats(int show);
+extern void libbsc_set_threads(int spare, int nchunk);
+#endif
+
+#ifdef ENABLE_PC_ZSTD
+extern int zstd_compress(void *src, uint64_t srclen, void *dst,
+	uint64_t *dstlen, int level, uchar_t chdr, int btype, void *data);
+extern int zstd_decompress(void *src, uint64_t srclen, void *dst,
+	uint64_t *dstlen, int level, uchar_t chdr, int btype, void *data);
+extern int zstd_init(void **data, int *level, int nthreads, uint64_t chunksize,
+	int file_version, compress_op_t op);
+extern void zstd_props(algo_props_t *data, int level, uint64_t chunksize);
+extern int zstd_deinit(void **data);
+extern void zstd_stats(int show);
+extern int zstd_buf_extra(uint64_t buflen);
 #endif
 
 typedef struct pc_ctx {
@@ -202,6 +234,7 @@ typedef struct pc_ctx {
 	deinit_func_ptr _deinit_func;
 	stats_func_ptr _stats_func;
 	props_func_ptr _props_func;
+	prime_func_ptr _prime_func;
 
 	int inited;
 	int main_cancel;
@@ -230,6 +263,10 @@ typedef struct pc_ctx {
 	int no_overwrite_newer;
 	int advanced_opts;
 	int meta_stream;
+	int meta_codec;
+	int64_t target_speed;
+	int solid_mode;
+	uint64_t solid_window;
 
 	/*
 	 * Archiving related context data.
@@ -276,6 +313,7 @@ typedef struct pc_ctx {
 	int user_pw_len;
 	char *pwd_file, *f_name;
 	meta_ctx_t *meta_ctx;
+	wpool_t *wpool;
 } pc_ctx_t;
 
 /*
@@ -300,6 +338,10 @@ struct cmp_data {
 	Sem_t cmp_done_sem;
 	Sem_t write_done_sem;
 	Sem_t index_sem;
+	Sem_t prime_sem;
+	uchar_t *prime;
+	uint64_t prime_len;
+	struct cmp_data *solid_next;
 	void *data;
 	pthread_t thr;
 	mac_ctx_t chunk_hmac;
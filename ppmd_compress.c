@@ -24,6 +24,7 @@
  */
 
 #include <stdio.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <strings.h>
 #include <utils.h>
@@ -62,16 +63,41 @@ static ISzAlloc g_Alloc = {
 	NULL
 };
 
+/*
+ * Touch every page of a freshly allocated model arena, so that the page faults
+ * are taken once up front instead of while the model grows.
+ */
+static void
+ppmd_prefault(Byte *base, uint64_t len)
+{
+	uint64_t i;
+	long pgsz;
+
+	pgsz = sysconf(_SC_PAGE_SIZE);
+	if (pgsz <= 0)
+		pgsz = 4096;
+	for (i = 0; i < len; i += pgsz)
+		base[i] = 0;
+}
+
+/*
+ * Allocate the model arena. The arena is kept across chunks until ppmd_deinit(),
+ * so this only allocates on first use. Ppmd8_Init() at the start of every chunk
+ * restarts the model within the existing arena.
+ */
 int
 ppmd_alloc(void *data)
 {
 	CPpmd8 *_ppmd = (CPpmd8 *)data;
 
+	if (_ppmd->Base != 0 && _ppmd->Size == ppmd8_mem_sz[_ppmd->Order])
+		return (0);
 	if (!Ppmd8_Alloc(_ppmd, ppmd8_mem_sz[_ppmd->Order], &g_Alloc)) {
 		log_msg(LOG_ERR, 0, "PPMD: Out of memory.\n");
 		return (-1);
 	}
 	Ppmd8_Construct(_ppmd);
+	ppmd_prefault(_ppmd->Base, _ppmd->AlignOffset + _ppmd->Size);
 	return (0);
 }
 
@@ -0,0 +1,477 @@
+/*
+ * This file is a part of Pcompress, a chunked parallel multi-
+ * algorithm lossless compression and decompression program.
+ *
+ * Copyright (C) 2012-2013 Moinak Ghosh. All rights reserved.
+ * Use is subject to license terms.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ * moinakg@belenix.org, http://moinakg.wordpress.com/
+ */
+
+/*
+ * Read-ahead stage for decompression. A separate thread reads the compressed
+ * file through a large buffer, parses chunk headers, skips metadata chunks and
+ * queues complete chunks ahead of the decompression workers. This keeps the
+ * next few chunks in memory while the main thread waits for workers to finish,
+ * so slow or high-latency storage no longer stalls the pipeline between chunks.
+ *
+ * Chunk buffers circulate between this stage and the workers. The consumer
+ * swaps a prefetched buffer into the worker's compressed_chunk slot and hands
+ * the worker's previous buffer back via prefetch_release(), so no data is
+ * copied beyond the header parsing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include "pcompress.h"
+#include "utils/utils.h"
+#include "allocator.h"
+#include "meta_stream.h"
+#include "prefetch.h"
+
+struct _prefetch_ctx {
+	pc_ctx_t *pctx;
+	int fd, seekable;
+	uint64_t chunksize, bufsize;
+
+	/*
+	 * Read-ahead buffer and file position of the end of data read so far.
+	 */
+	uchar_t *rabuf;
+	uint64_t rapos, ralen;
+	uint64_t fpos, adv_end, adv_win;
+
+	/*
+	 * Free chunk buffers and ring of ready chunks.
+	 */
+	uchar_t *free_bufs[PF_QUEUE_DEPTH];
+	uchar_t *inflight;
+	int nfree;
+	pf_chunk_t q[PF_QUEUE_DEPTH];
+	int qhead, qcount;
+	int done, cancel;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cv;
+	pthread_t thr;
+};
+
+/*
+ * Tell the kernel about the file region we will be reading next. Advice is
+ * issued in large steps to keep the syscall count low.
+ */
+static void
+pf_advise(prefetch_ctx_t *pf)
+{
+	if (!pf->seekable)
+		return;
+	if (pf->fpos + pf->adv_win / 2 < pf->adv_end)
+		return;
+#ifdef	POSIX_FADV_WILLNEED
+	(void) posix_fadvise(pf->fd, pf->fpos, pf->adv_win, POSIX_FADV_WILLNEED);
+#endif
+	pf->adv_end = pf->fpos + pf->adv_win;
+}
+
+/*
+ * Blocking I/O is the only place where the prefetch thread may be cancelled.
+ */
+static int64_t
+pf_sysread(prefetch_ctx_t *pf, uchar_t *buf, uint64_t len, int full)
+{
+	int64_t rb;
+
+	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+	if (full) {
+		rb = Read(pf->fd, buf, len);
+	} else {
+		do {
+			rb = read(pf->fd, buf, len);
+		} while (rb < 0 && errno == EINTR);
+	}
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	if (rb > 0) {
+		pf->fpos += rb;
+		pf_advise(pf);
+	}
+	return (rb);
+}
+
+/*
+ * Copy the next len bytes of the stream into dst. Large requests that exceed
+ * what is buffered are read directly into dst. Returns the number of bytes
+ * copied which is less than len only at end of file, or -1 on error.
+ */
+static int64_t
+pf_read(prefetch_ctx_t *pf, uchar_t *dst, uint64_t len)
+{
+	uint64_t got, k;
+	int64_t rb;
+
+	got = 0;
+	while (got < len) {
+		if (pf->rapos == pf->ralen) {
+			if (len - got >= PF_RABUF_SZ) {
+				rb = pf_sysread(pf, dst + got, len - got, 1);
+				if (rb < 0)
+					return (-1);
+				return (got + rb);
+			}
+			rb = pf_sysread(pf, pf->rabuf, PF_RABUF_SZ, 0);
+			if (rb < 0)
+				return (-1);
+			if (rb == 0)
+				break;
+			pf->rapos = 0;
+			pf->ralen = rb;
+		}
+		k = pf->ralen - pf->rapos;
+		if (k > len - got)
+			k = len - got;
+		memcpy(dst + got, pf->rabuf + pf->rapos, k);
+		pf->rapos += k;
+		got += k;
+	}
+	return (got);
+}
+
+/*
+ * Skip len bytes of the stream. Seekable input is skipped with lseek(),
+ * otherwise the bytes are read and discarded.
+ */
+static int64_t
+pf_skip(prefetch_ctx_t *pf, uint64_t len)
+{
+	uint64_t k, got;
+	int64_t rb;
+
+	k = pf->ralen - pf->rapos;
+	if (k > len)
+		k = len;
+	pf->rapos += k;
+	got = k;
+	if (got == len)
+		return (got);
+
+	if (pf->seekable) {
+		off_t cpos, npos;
+
+		cpos = lseek(pf->fd, 0, SEEK_CUR);
+		npos = lseek(pf->fd, len - got, SEEK_CUR);
+		if (cpos < 0 || npos < 0)
+			return (-1);
+		pf->fpos += npos - cpos;
+		pf_advise(pf);
+		return (got + (npos - cpos));
+	}
+	while (got < len) {
+		k = len - got;
+		if (k > PF_RABUF_SZ)
+			k = PF_RABUF_SZ;
+		rb = pf_sysread(pf, pf->rabuf, k, 1);
+		if (rb < 0)
+			return (-1);
+		got += rb;
+		if (rb < k)
+			break;
+	}
+	return (got);
+}
+
+/*
+ * Queue a parsed chunk for the consumer. Called with the lock held.
+ */
+static void
+pf_enqueue(prefetch_ctx_t *pf, pf_chunk_t *chunk)
+{
+	pf->q[(pf->qhead + pf->qcount) % PF_QUEUE_DEPTH] = *chunk;
+	pf->qcount++;
+	if (chunk->status != PF_CHUNK_OK)
+		pf->done = 1;
+	pthread_cond_broadcast(&pf->cv);
+}
+
+/*
+ * Parse one chunk header and read the chunk into buf. Metadata chunks are
+ * skipped. This mirrors the checks done by the original inline reader.
+ */
+static void
+pf_read_chunk(prefetch_ctx_t *pf, pf_chunk_t *chunk, uchar_t *buf)
+{
+	pc_ctx_t *pctx = pf->pctx;
+	int64_t rb;
+
+	chunk->buf = NULL;
+	chunk->err = 0;
+	for (;;) {
+		rb = pf_read(pf, (uchar_t *)&chunk->len_cmp, sizeof (chunk->len_cmp));
+		if (rb != sizeof (chunk->len_cmp)) {
+			chunk->err = errno;
+			chunk->status = (rb < 0 ? PF_ERR_READ:PF_ERR_HDR);
+			return;
+		}
+		chunk->len_cmp_be = chunk->len_cmp; // Needed for HMAC
+		chunk->len_cmp = htonll(chunk->len_cmp);
+
+		/*
+		 * Check for ridiculous length.
+		 */
+		if (chunk->len_cmp > pf->chunksize + 256) {
+			chunk->status = PF_ERR_LEN;
+			return;
+		}
+
+		/*
+		 * Zero compressed len means end of file.
+		 */
+		if (chunk->len_cmp == 0) {
+			chunk->status = PF_EOF;
+			return;
+		}
+		if (chunk->len_cmp != METADATA_INDICATOR)
+			break;
+
+		if (!pctx->meta_stream) {
+			chunk->status = PF_ERR_META;
+			return;
+		}
+
+		/*
+		 * Metadata chunk. Read it's length and skip the chunk.
+		 */
+		rb = pf_read(pf, (uchar_t *)&chunk->len_cmp_be, sizeof (chunk->len_cmp_be));
+		if (rb != sizeof (chunk->len_cmp_be)) {
+			chunk->err = errno;
+			chunk->status = (rb < 0 ? PF_ERR_READ:PF_ERR_HDR);
+			return;
+		}
+		chunk->len_cmp_be = LE64(chunk->len_cmp_be);
+
+		/* Two values already read */
+		rb = chunk->len_cmp_be + METADATA_HDR_SZ - 16;
+		if (pf_skip(pf, rb) != rb) {
+			chunk->err = errno;
+			chunk->status = PF_ERR_DATA;
+			return;
+		}
+	}
+
+	/*
+	 * Now read compressed chunk including the checksum.
+	 */
+	rb = chunk->len_cmp + pctx->cksum_bytes + pctx->mac_bytes + CHUNK_FLAG_SZ;
+	chunk->rbytes = pf_read(pf, buf, rb);
+	if (chunk->rbytes < rb) {
+		chunk->err = errno;
+		chunk->status = (chunk->rbytes < 0 ? PF_ERR_READ:PF_ERR_DATA);
+		return;
+	}
+	chunk->buf = buf;
+	chunk->status = PF_CHUNK_OK;
+}
+
+static void *
+prefetch_thread(void *dat)
+{
+	prefetch_ctx_t *pf = (prefetch_ctx_t *)dat;
+	pf_chunk_t chunk;
+	uchar_t *buf;
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	for (;;) {
+		pthread_mutex_lock(&pf->lock);
+		while (!pf->cancel && (pf->nfree == 0 || pf->qcount == PF_QUEUE_DEPTH))
+			pthread_cond_wait(&pf->cv, &pf->lock);
+		if (pf->cancel) {
+			pthread_mutex_unlock(&pf->lock);
+			break;
+		}
+		buf = pf->free_bufs[--(pf->nfree)];
+		pf->inflight = buf;
+		pthread_mutex_unlock(&pf->lock);
+
+		pf_read_chunk(pf, &chunk, buf);
+
+		pthread_mutex_lock(&pf->lock);
+		pf->inflight = NULL;
+		if (chunk.buf == NULL)
+			pf->free_bufs[(pf->nfree)++] = buf;
+		pf_enqueue(pf, &chunk);
+		pthread_mutex_unlock(&pf->lock);
+		if (chunk.status != PF_CHUNK_OK)
+			break;
+	}
+	return (NULL);
+}
+
+/*
+ * Memory held by the prefetch stage for the given chunk buffer size.
+ */
+uint64_t
+prefetch_mem(uint64_t bufsize)
+{
+	return (PF_QUEUE_DEPTH * bufsize + PF_RABUF_SZ);
+}
+
+/*
+ * Start prefetching chunks from the current position of fd. The bufsize
+ * parameter is the allocation size of a compressed chunk buffer. Returns
+ * PF_ERR_NOMEM if the buffers cannot be allocated and PF_ERR_THREAD if the
+ * prefetch thread cannot be started. Fewer than PF_QUEUE_DEPTH chunk buffers
+ * are used if memory is short.
+ */
+int
+prefetch_create(prefetch_ctx_t **pfp, void *pc, int fd, uint64_t chunksize,
+    uint64_t bufsize)
+{
+	prefetch_ctx_t *pf;
+	struct stat sbuf;
+	int i;
+
+	*pfp = NULL;
+	pf = (prefetch_ctx_t *)slab_calloc(NULL, 1, sizeof (prefetch_ctx_t));
+	if (pf == NULL)
+		return (PF_ERR_NOMEM);
+	pf->pctx = (pc_ctx_t *)pc;
+	pf->fd = fd;
+	pf->chunksize = chunksize;
+	pf->bufsize = bufsize;
+	pf->rabuf = (uchar_t *)slab_alloc(NULL, PF_RABUF_SZ);
+	if (pf->rabuf == NULL) {
+		slab_release(NULL, pf);
+		return (PF_ERR_NOMEM);
+	}
+	for (i = 0; i < PF_QUEUE_DEPTH; i++) {
+		pf->free_bufs[i] = (uchar_t *)slab_alloc(NULL, bufsize);
+		if (pf->free_bufs[i] == NULL)
+			break;
+		pf->nfree++;
+	}
+	if (pf->nfree == 0) {
+		slab_release(NULL, pf->rabuf);
+		slab_release(NULL, pf);
+		return (PF_ERR_NOMEM);
+	}
+
+	/*
+	 * For regular files tell the kernel that we read sequentially and ask
+	 * for readahead covering all the chunks we are going to queue.
+	 */
+	if (fstat(fd, &sbuf) == 0 && S_ISREG(sbuf.st_mode)) {
+		off_t cpos = lseek(fd, 0, SEEK_CUR);
+
+		if (cpos >= 0) {
+			pf->seekable = 1;
+			pf->fpos = cpos;
+			pf->adv_end = cpos;
+			pf->adv_win = PF_RABUF_SZ + PF_QUEUE_DEPTH * bufsize;
+#ifdef	POSIX_FADV_SEQUENTIAL
+			(void) posix_fadvise(fd, cpos, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+			pf_advise(pf);
+		}
+	}
+
+	pthread_mutex_init(&pf->lock, NULL);
+	pthread_cond_init(&pf->cv, NULL);
+	if (pthread_create(&pf->thr, NULL, prefetch_thread, pf) != 0) {
+		pthread_mutex_destroy(&pf->lock);
+		pthread_cond_destroy(&pf->cv);
+		for (i = 0; i < pf->nfree; i++)
+			slab_release(NULL, pf->free_bufs[i]);
+		slab_release(NULL, pf->rabuf);
+		slab_release(NULL, pf);
+		return (PF_ERR_THREAD);
+	}
+	*pfp = pf;
+	return (PF_CHUNK_OK);
+}
+
+/*
+ * Wait for and return the next chunk. On PF_CHUNK_OK the caller owns
+ * chunk->buf and must give a buffer of the same size back with
+ * prefetch_release() to keep the read-ahead going.
+ */
+int
+prefetch_get(prefetch_ctx_t *pf, pf_chunk_t *chunk)
+{
+	pthread_mutex_lock(&pf->lock);
+	while (pf->qcount == 0)
+		pthread_cond_wait(&pf->cv, &pf->lock);
+	*chunk = pf->q[pf->qhead];
+
+	/*
+	 * Terminal entries stay in the queue so that they are returned again.
+	 */
+	if (chunk->status == PF_CHUNK_OK) {
+		pf->qhead = (pf->qhead + 1) % PF_QUEUE_DEPTH;
+		pf->qcount--;
+		pthread_cond_broadcast(&pf->cv);
+	}
+	pthread_mutex_unlock(&pf->lock);
+	return (chunk->status);
+}
+
+void
+prefetch_release(prefetch_ctx_t *pf, uchar_t *buf)
+{
+	pthread_mutex_lock(&pf->lock);
+	pf->free_bufs[(pf->nfree)++] = buf;
+	pthread_cond_broadcast(&pf->cv);
+	pthread_mutex_unlock(&pf->lock);
+}
+
+/*
+ * Stop the prefetch thread and free all buffers owned by this stage. The
+ * thread may be blocked reading from a pipe so it is cancelled.
+ */
+void
+prefetch_destroy(prefetch_ctx_t *pf)
+{
+	int i;
+
+	if (pf == NULL)
+		return;
+	pthread_mutex_lock(&pf->lock);
+	pf->cancel = 1;
+	pthread_cond_broadcast(&pf->cv);
+	pthread_mutex_unlock(&pf->lock);
+	pthread_cancel(pf->thr);
+	pthread_join(pf->thr, NULL);
+
+	for (i = 0; i < pf->qcount; i++) {
+		pf_chunk_t *c = &pf->q[(pf->qhead + i) % PF_QUEUE_DEPTH];
+
+		if (c->buf)
+			slab_release(NULL, c->buf);
+	}
+	for (i = 0; i < pf->nfree; i++)
+		slab_release(NULL, pf->free_bufs[i]);
+	if (pf->inflight)
+		slab_release(NULL, pf->inflight);
+	pthread_mutex_destroy(&pf->lock);
+	pthread_cond_destroy(&pf->cv);
+	slab_release(NULL, pf->rabuf);
+	slab_release(NULL, pf);
+}
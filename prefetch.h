@@ -0,0 +1,79 @@
+/*
+ * This file is a part of Pcompress, a chunked parallel multi-
+ * algorithm lossless compression and decompression program.
+ *
+ * Copyright (C) 2012-2013 Moinak Ghosh. All rights reserved.
+ * Use is subject to license terms.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ * moinakg@belenix.org, http://moinakg.wordpress.com/
+ */
+
+#ifndef	_PREFETCH_H
+#define	_PREFETCH_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * Number of chunks read ahead of the decompression workers and the size of the
+ * read-ahead buffer from which chunk headers are parsed.
+ */
+#define	PF_QUEUE_DEPTH	2
+#define	PF_RABUF_SZ	(4 * 1024 * 1024)
+
+/*
+ * Status of a prefetched chunk. The last two are only returned by
+ * prefetch_create().
+ */
+#define	PF_CHUNK_OK	0
+#define	PF_EOF		1
+#define	PF_ERR_READ	-1
+#define	PF_ERR_HDR	-2
+#define	PF_ERR_LEN	-3
+#define	PF_ERR_META	-4
+#define	PF_ERR_DATA	-5
+#define	PF_ERR_NOMEM	-6
+#define	PF_ERR_THREAD	-7
+
+typedef struct _prefetch_ctx prefetch_ctx_t;
+
+/*
+ * A chunk read ahead from the compressed file. The buffer holds the chunk
+ * checksum, MAC, flag byte and data, that is everything after the 64-bit
+ * compressed length. On a read error err holds the errno value.
+ */
+typedef struct {
+	uchar_t *buf;
+	uint64_t len_cmp, len_cmp_be;
+	int64_t rbytes;
+	int status;
+	int err;
+} pf_chunk_t;
+
+int prefetch_create(prefetch_ctx_t **pfp, void *pc, int fd, uint64_t chunksize,
+    uint64_t bufsize);
+uint64_t prefetch_mem(uint64_t bufsize);
+int prefetch_get(prefetch_ctx_t *pf, pf_chunk_t *chunk);
+void prefetch_release(prefetch_ctx_t *pf, uchar_t *buf);
+void prefetch_destroy(prefetch_ctx_t *pf);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif
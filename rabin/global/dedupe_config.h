@@ -53,8 +53,8 @@ typedef enum {
 struct seg_map_fd {
 	int fd;
 	void *mapping;
-	uint64_t cache_offset;
-	uint32_t len;
+	uint64_t cache_offset; // File offset of the start of the mapping window
+	uint64_t len;
 };
 
 typedef struct {
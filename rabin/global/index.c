@@ -377,65 +377,136 @@ db_segcache_pos(archive_config_t *cfg, int tid)
 }
 
 /*
- * Mmap the requested segment metadata array.
+ * Segment metadata is accessed through a per-thread mapping window that is much
+ * larger than a single segment entry. Lookups are done in ascending offset order
+ * so consecutive matches usually fall within the current window and the cost of
+ * mmap/munmap and the associated TLB shootdowns is paid once per window instead
+ * of once per segment.
  */
-int
-db_segcache_map(archive_config_t *cfg, int tid, uint32_t *blknum, uint64_t *offset, uchar_t **blocks)
+#define	SEGCACHE_WINDOW_SZ	(8UL * 1024 * 1024)
+
+static inline int
+segcache_in_window(struct seg_map_fd *sm, uint64_t offset, uint64_t len)
 {
-	uchar_t *mapbuf, *hdr;
-	int fd, dummy;
-	uint32_t len, adj;
-	uint64_t pos;
+	return (sm->mapping != NULL && offset >= sm->cache_offset &&
+	    offset + len <= sm->cache_offset + sm->len);
+}
 
-	/*
-	 * If same mapping is re-attempted just return the pointer into the
-	 * existing mapping.
-	 */
-	adj = *offset % cfg->pagesize;
-	if (*offset == cfg->seg_fd_r[tid].cache_offset && cfg->seg_fd_r[tid].mapping) {
-		hdr = (uchar_t *)(cfg->seg_fd_r[tid].mapping) + adj;
-		*blknum = U32_P(hdr);
-		*offset = U64_P(hdr + 4);
-		*blocks = hdr + SEGCACHE_HDR_SZ;
-		return (0);
-	}
+/*
+ * Map a fresh window beginning at the page containing offset. The window never
+ * extends beyond the current end of the segment cache file since touching pages
+ * past EOF would result in SIGBUS.
+ */
+static int
+segcache_map_window(archive_config_t *cfg, int tid, uint64_t offset, uint64_t minlen)
+{
+	struct seg_map_fd *sm;
+	uint64_t start, len, pos;
+	uchar_t *mapbuf;
 
-	/*
-	 * Ensure previous mapping is removed.
-	 */
+	sm = &(cfg->seg_fd_r[tid]);
 	db_segcache_unmap(cfg, tid);
-	fd = cfg->seg_fd_r[tid].fd;
-	if (lseek(fd, *offset, SEEK_SET) != *offset) {
+
+	start = offset - (offset % cfg->pagesize);
+	len = SEGCACHE_WINDOW_SZ;
+	if (len < minlen + (offset - start))
+		len = minlen + (offset - start);
+	pos = cfg->segcache_pos;
+	if (start + len > pos)
+		len = pos - start;
+
+	mapbuf = mmap(NULL, len, PROT_READ, MAP_SHARED, sm->fd, start);
+	if (mapbuf == MAP_FAILED) {
 		log_msg(LOG_ERR, 1, " ");
 		return (-1);
 	}
+	sm->mapping = mapbuf;
+	sm->cache_offset = start;
+	sm->len = len;
+	return (0);
+}
+
+static void
+segcache_readahead(archive_config_t *cfg, int tid, uint64_t start, uint64_t end)
+{
+	if (end > cfg->segcache_pos)
+		end = cfg->segcache_pos;
+	if (end > start) {
+#ifdef	POSIX_FADV_WILLNEED
+		(void) posix_fadvise(cfg->seg_fd_r[tid].fd, start, end - start,
+		    POSIX_FADV_WILLNEED);
+#endif
+	}
+}
+
+/*
+ * Issue readahead for a sorted list of segment offsets about to be mapped. Adjacent
+ * and overlapping segment extents are coalesced so that the kernel sees a few
+ * large sequential reads rather than a series of page faults scattered across
+ * the segment cache file.
+ */
+void
+db_segcache_prefetch(archive_config_t *cfg, int tid, uint64_t *offsets, int num)
+{
+	uint64_t start, end, maxlen;
+	int i;
+
+	if (num == 0)
+		return;
+
+	maxlen = cfg->segment_sz * sizeof (global_blockentry_t) + SEGCACHE_HDR_SZ;
+	start = offsets[0];
+	end = start + maxlen;
+	for (i = 1; i < num; i++) {
+		if (offsets[i] <= end) {
+			end = offsets[i] + maxlen;
+			continue;
+		}
+		segcache_readahead(cfg, tid, start, end);
+		start = offsets[i];
+		end = start + maxlen;
+	}
+	segcache_readahead(cfg, tid, start, end);
+}
+
+/*
+ * Map the requested segment metadata array. The returned pointer is valid till
+ * the next call to this function or db_segcache_unmap() for the same thread.
+ */
+int
+db_segcache_map(archive_config_t *cfg, int tid, uint32_t *blknum, uint64_t *offset, uchar_t **blocks)
+{
+	struct seg_map_fd *sm;
+	uchar_t *hdr;
+	uint64_t len;
 
 	/*
-	 * Mmap hdr and blocks. We assume max # of rabin block entries and mmap (unless remaining
-	 * file length is less). The header contains actual number of block entries so mmap-ing
-	 * extra has no consequence other than address space usage.
+	 * Ensure that the header is within the current window. We assume max # of
+	 * rabin block entries when mapping a new window (unless remaining file length
+	 * is less).
 	 */
-	len = cfg->segment_sz * sizeof (global_blockentry_t) + SEGCACHE_HDR_SZ;
-	pos = cfg->segcache_pos;
-	if (pos - *offset < len)
-		len = pos - *offset;
+	sm = &(cfg->seg_fd_r[tid]);
+	if (!segcache_in_window(sm, *offset, SEGCACHE_HDR_SZ)) {
+		len = cfg->segment_sz * sizeof (global_blockentry_t) + SEGCACHE_HDR_SZ;
+		if (segcache_map_window(cfg, tid, *offset, len) == -1)
+			return (-1);
+	}
+	hdr = (uchar_t *)(sm->mapping) + (*offset - sm->cache_offset);
 
-	mapbuf = mmap(NULL, len + adj, PROT_READ, MAP_SHARED, fd, *offset - adj);
-	if (mapbuf == MAP_FAILED) {
-		log_msg(LOG_ERR, 1, " ");
-		return (-1);
+	/*
+	 * The header contains actual number of block entries. Re-map if the
+	 * window does not cover all of them.
+	 */
+	len = U32_P(hdr) * sizeof (global_blockentry_t) + SEGCACHE_HDR_SZ;
+	if (!segcache_in_window(sm, *offset, len)) {
+		if (segcache_map_window(cfg, tid, *offset, len) == -1)
+			return (-1);
+		hdr = (uchar_t *)(sm->mapping) + (*offset - sm->cache_offset);
 	}
 
-	cfg->seg_fd_r[tid].cache_offset = *offset;
-	hdr = mapbuf + adj;
 	*blknum = U32_P(hdr);
 	*offset = U64_P(hdr + 4);
 	*blocks = hdr + SEGCACHE_HDR_SZ;
-	dummy = *(hdr + SEGCACHE_HDR_SZ);
-
-	cfg->seg_fd_r[tid].mapping = mapbuf;
-	cfg->seg_fd_r[tid].len = len + adj;
-
 	return (0);
 }
 
@@ -566,6 +637,7 @@ destroy_global_db_s(archive_config_t *cfg)
 	cleanup_indx(indx);
 	if (cfg->pct_interval > 0) {
 		for (i = 0; i < cfg->nthreads; i++) {
+			db_segcache_unmap(cfg, i);
 			close(cfg->seg_fd_r[i].fd);
 		}
 		free(cfg->seg_fd_r);
@@ -57,6 +57,7 @@ void destroy_global_db_s(archive_config_t *cfg);
 
 int db_segcache_write(archive_config_t *cfg, int tid, uchar_t *buf, uint32_t len, uint32_t blknum, uint64_t file_offset);
 uint64_t db_segcache_pos(archive_config_t *cfg, int tid);
+void db_segcache_prefetch(archive_config_t *cfg, int tid, uint64_t *offsets, int num);
 int db_segcache_map(archive_config_t *cfg, int tid, uint32_t *blknum, uint64_t *offset, uchar_t **blocks);
 int db_segcache_unmap(archive_config_t *cfg, int tid);
 
@@ -785,15 +785,26 @@ process_blocks:
 			uchar_t *g_dedupe_idx, *tgt, *src;
 
 			/*
-			 * First compute all the rabin chunk/block cryptographic hashes.
+			 * First compute all the rabin chunk/block cryptographic hashes. Blocks
+			 * are hashed in batches to allow multi-buffer SIMD digests to process
+			 * several blocks in parallel.
 			 */
 #if defined(_OPENMP)
 #	pragma omp parallel for
 #endif
-			for (i=0; i<blknum; i++) {
-				compute_checksum(ctx->g_blocks[i].cksum,
-					ctx->arc->chunk_cksum_type, buf1+ctx->g_blocks[i].offset,
-					ctx->g_blocks[i].length, 0, 0);
+			for (i=0; i<blknum; i+=CKSUM_MB_BATCH) {
+				uchar_t *ckbufs[CKSUM_MB_BATCH], *bufs[CKSUM_MB_BATCH];
+				uint64_t lens[CKSUM_MB_BATCH];
+				int k, n;
+
+				n = CKSUM_MB_BATCH;
+				if (n > blknum - i) n = blknum - i;
+				for (k=0; k<n; k++) {
+					ckbufs[k] = ctx->g_blocks[i+k].cksum;
+					bufs[k] = buf1 + ctx->g_blocks[i+k].offset;
+					lens[k] = ctx->g_blocks[i+k].length;
+				}
+				compute_checksum_mb(ckbufs, ctx->arc->chunk_cksum_type, bufs, lens, n);
 			}
 
 			/*
@@ -1066,6 +1077,21 @@ process_blocks:
 				 */
 				Sem_Post(ctx->index_sem_next);
 
+				/*
+				 * Kick off readahead for all the matching segments up front so that
+				 * segment cache I/O overlaps with the in-segment dedupe below.
+				 */
+				src = sim_offsets;
+				for (i=0; i<blknum;) {
+					blks = U32_P(src) + i;
+					src += sizeof (blks);
+					sub_i = *src;
+					src++;
+					db_segcache_prefetch(cfg, ctx->id, (uint64_t *)src, sub_i);
+					src += sub_i * cfg->similarity_cksum_sz;
+					i = blks;
+				}
+
 				/*
 				 * Now go through all the matching segments for all the current segments
 				 * and perform actual deduplication.
@@ -133,6 +133,9 @@
 // Mask to extract value from a rabin index entry
 #define	RABIN_INDEX_VALUE (0x3FFFFFFFUL)
 
+// Number of blocks fingerprinted per multi-buffer checksum call
+#define	CKSUM_MB_BATCH	16
+
 /*
  * Types of block similarity.
  */
@@ -5,7 +5,7 @@ echo "#################################################"
 echo "# Simple compress and decompress"
 echo "#################################################"
 
-for algo in lzfx lz4 zlib bzip2 lzma lzmaMt libbsc ppmd adapt adapt2
+for algo in lzfx lz4 zstd zlib bzip2 lzma lzmaMt lzmaMtX libbsc ppmd adapt adapt2
 do
 	../../pcompress 2>&1 | grep $algo > /dev/null
 	[ $? -ne 0 ] && continue
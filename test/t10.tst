@@ -0,0 +1,65 @@
+#
+# Solid mode
+#
+echo "#################################################"
+echo "# Test Solid mode cross-chunk priming"
+echo "#################################################"
+
+for algo in zlib lzma lzmaMt
+do
+	for tf in `cat files.lst`
+	do
+		rm -f ${tf}.*
+		for feat in "-W" "-W -t1" "-W -D" "-W -F" "-W -L -P"
+		do
+			for seg in 1m 3m
+			do
+				cmd="../../pcompress -c ${algo} -l 5 -s ${seg} $feat ${tf}"
+				echo "Running $cmd"
+				eval $cmd
+				if [ $? -ne 0 ]
+				then
+					echo "FATAL: Compression errored."
+					rm -f ${tf}.pz
+					continue
+				fi
+				cmd="../../pcompress -d ${tf}.pz ${tf}.1"
+				echo "Running $cmd"
+				eval $cmd
+				if [ $? -ne 0 ]
+				then
+					echo "FATAL: Decompression errored."
+					rm -f ${tf}.pz ${tf}.1
+					continue
+				fi
+
+				diff ${tf} ${tf}.1 > /dev/null
+				if [ $? -ne 0 ]
+				then
+					echo "FATAL: Decompression was not correct"
+				fi
+				rm -f ${tf}.pz ${tf}.1
+			done
+		done
+	done
+done
+
+for algo in lz4 bzip2 adapt2
+do
+	for tf in `cat files.lst`
+	do
+		cmd="../../pcompress -c ${algo} -l 3 -s 1m -W ${tf}"
+		echo "Running $cmd"
+		eval $cmd
+		if [ $? -eq 0 ]
+		then
+			echo "FATAL: Solid mode was accepted for ${algo}."
+		fi
+		rm -f ${tf}.pz
+		break
+	done
+done
+
+echo "#################################################"
+echo ""
+
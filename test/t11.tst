@@ -0,0 +1,94 @@
+#
+# Archive mode
+#
+echo "#################################################"
+echo "# Test Archive mode and large metadata records"
+echo "#################################################"
+
+rm -rf arcdir arcout arc.pz
+mkdir arcdir
+for tf in `cat files.lst`
+do
+	cp ${tf} arcdir/
+done
+
+#
+# Mix of small files of different types.
+#
+i=0
+while [ $i -lt 200 ]
+do
+	echo "Small text member $i" > arcdir/small$i.txt
+	head -c 3000 ../res/jpg/screen.jpg > arcdir/small$i.jpg
+	i=$((i + 1))
+done
+
+#
+# A member whose extended attributes make up a metadata record larger than
+# the metadata ring buffer.
+#
+bigx=0
+touch arcdir/bigxattr
+if which setfattr > /dev/null 2>&1
+then
+	val=`head -c 40000 /dev/zero | tr '\0' 'a'`
+	bigx=1
+	i=0
+	while [ $i -lt 24 ]
+	do
+		setfattr -n user.big$i -v "$val" arcdir/bigxattr > /dev/null 2>&1
+		if [ $? -ne 0 ]
+		then
+			bigx=0
+			break
+		fi
+		i=$((i + 1))
+	done
+fi
+[ $bigx -eq 0 ] && echo "Large extended attributes not supported, skipping big metadata record."
+
+for algo in lzma adapt2
+do
+	for feat in " " "-n" "-T"
+	do
+		cmd="../../pcompress -a -c ${algo} -l 6 -s 1m $feat arcdir arc"
+		echo "Running $cmd"
+		eval $cmd
+		if [ $? -ne 0 ]
+		then
+			echo "FATAL: Archiving errored."
+			rm -f arc.pz
+			continue
+		fi
+		mkdir arcout
+		cmd="../../pcompress -d -m arc.pz arcout"
+		echo "Running $cmd"
+		eval $cmd
+		if [ $? -ne 0 ]
+		then
+			echo "FATAL: Archive extraction errored."
+			rm -rf arc.pz arcout
+			continue
+		fi
+
+		diff -r arcdir arcout/arcdir > /dev/null
+		if [ $? -ne 0 ]
+		then
+			echo "FATAL: Archive extraction was not correct"
+		fi
+		if [ $bigx -eq 1 ]
+		then
+			getfattr -n user.big23 arcout/arcdir/bigxattr > /dev/null 2>&1
+			if [ $? -ne 0 ]
+			then
+				echo "FATAL: Large metadata record was not restored"
+			fi
+		fi
+		rm -rf arc.pz arcout
+	done
+done
+rm -rf arcdir
+
+echo "#################################################"
+echo ""
+
@@ -0,0 +1,107 @@
+#
+# Metadata stream algorithms
+#
+echo "#################################################"
+echo "# Test metadata stream algorithms"
+echo "#################################################"
+
+rm -rf arcdir rawdir arcout arc.pz
+mkdir arcdir
+for tf in `cat files.lst`
+do
+	cp ${tf} arcdir/
+	break
+done
+
+#
+# Enough small members to fill several metadata chunks so that they are
+# compressed in parallel.
+#
+i=0
+while [ $i -lt 3000 ]
+do
+	echo "Small text member $i" > arcdir/small_member_with_a_longer_name_$i.txt
+	i=$((i + 1))
+done
+
+#
+# A member whose metadata is mostly random extended attribute values. This
+# does not shrink with lz4 and has to be stored raw.
+#
+mkdir rawdir
+touch rawdir/randxattr
+rawx=0
+if which setfattr > /dev/null 2>&1
+then
+	rawx=1
+	i=0
+	while [ $i -lt 24 ]
+	do
+		val=`head -c 40000 /dev/urandom | od -An -vtx1 | tr -d ' \n'`
+		setfattr -n user.rand$i -v "0x${val}" rawdir/randxattr > /dev/null 2>&1
+		if [ $? -ne 0 ]
+		then
+			rawx=0
+			break
+		fi
+		i=$((i + 1))
+	done
+fi
+[ $rawx -eq 0 ] && echo "Large extended attributes not supported, skipping raw metadata chunks."
+
+for mq in lz4 libbsc ppmd
+do
+	../../pcompress -Q ${mq} 2>&1 | grep "Invalid metadata algorithm" > /dev/null
+	[ $? -eq 0 ] && continue
+
+	for src in arcdir rawdir
+	do
+		[ "$src" = "rawdir" -a $rawx -eq 0 ] && continue
+
+		for algo in lzma adapt2
+		do
+			cmd="../../pcompress -a -c ${algo} -l 6 -s 1m -Q ${mq} ${src} arc"
+			echo "Running $cmd"
+			eval $cmd
+			if [ $? -ne 0 ]
+			then
+				echo "FATAL: Archiving errored."
+				rm -f arc.pz
+				continue
+			fi
+			mkdir arcout
+			cmd="../../pcompress -d -m arc.pz arcout"
+			echo "Running $cmd"
+			eval $cmd
+			if [ $? -ne 0 ]
+			then
+				echo "FATAL: Archive extraction errored."
+				rm -rf arc.pz arcout
+				continue
+			fi
+
+			diff -r ${src} arcout/${src} > /dev/null
+			if [ $? -ne 0 ]
+			then
+				echo "FATAL: Archive extraction was not correct"
+			fi
+			if [ "$src" = "rawdir" ]
+			then
+				getfattr -d -e hex -m user. ${src}/randxattr 2> /dev/null | sed 1d > xattr.1
+				getfattr -d -e hex -m user. arcout/${src}/randxattr 2> /dev/null | sed 1d > xattr.2
+				cmp xattr.1 xattr.2 > /dev/null
+				if [ $? -ne 0 ]
+				then
+					echo "FATAL: Raw metadata chunk was not restored"
+				fi
+				rm -f xattr.1 xattr.2
+			fi
+			rm -rf arc.pz arcout
+		done
+	done
+done
+rm -rf arcdir rawdir
+
+echo "#################################################"
+echo ""
+
@@ -0,0 +1,57 @@
+#
+# lzmaMtX
+#
+echo "#################################################"
+echo "# Test lzmaMtX parallel sub-blocks"
+echo "#################################################"
+
+#
+# Sub-blocks are at least 4MB so chunks of 16m and more are split across
+# the threads. A 1m chunk is stored as a single sub-block.
+#
+for level in 6 14
+do
+	for tf in `cat files.lst`
+	do
+		rm -f ${tf}.*
+		for feat in "-t 1" "-t 2" "-t 4" "-t 4 -D"
+		do
+			for seg in 1m 16m 64m
+			do
+				cmd="../../pcompress -c lzmaMtX -l ${level} -s ${seg} $feat ${tf}"
+				echo "Running $cmd"
+				eval $cmd
+				if [ $? -ne 0 ]
+				then
+					echo "FATAL: Compression errored."
+					rm -f ${tf}.pz
+					continue
+				fi
+				for dfeat in " " "-t 1"
+				do
+					cmd="../../pcompress -d $dfeat ${tf}.pz ${tf}.1"
+					echo "Running $cmd"
+					eval $cmd
+					if [ $? -ne 0 ]
+					then
+						echo "FATAL: Decompression errored."
+						rm -f ${tf}.1
+						continue
+					fi
+
+					diff ${tf} ${tf}.1 > /dev/null
+					if [ $? -ne 0 ]
+					then
+						echo "FATAL: Decompression was not correct"
+					fi
+					rm -f ${tf}.1
+				done
+				rm -f ${tf}.pz
+			done
+		done
+	done
+done
+
+echo "#################################################"
+echo ""
+
@@ -0,0 +1,101 @@
+#
+# Zstd
+#
+echo "#################################################"
+echo "# Test Zstd and adaptive modes using Zstd"
+echo "#################################################"
+
+#
+# Zstd is optional and is only tested when it is built in.
+#
+../../pcompress -c zstd 2>&1 | grep "Invalid algorithm" > /dev/null
+if [ $? -eq 0 ]
+then
+	echo "Zstd not built, skipping."
+else
+	for level in 1 3 9 14
+	do
+		for tf in `cat files.lst`
+		do
+			rm -f ${tf}.*
+			for seg in 1m 16m
+			do
+				cmd="../../pcompress -c zstd -l ${level} -s ${seg} ${tf}"
+				echo "Running $cmd"
+				eval $cmd
+				if [ $? -ne 0 ]
+				then
+					echo "FATAL: Compression errored."
+					rm -f ${tf}.pz
+					continue
+				fi
+				cmd="../../pcompress -d ${tf}.pz ${tf}.1"
+				echo "Running $cmd"
+				eval $cmd
+				if [ $? -ne 0 ]
+				then
+					echo "FATAL: Decompression errored."
+					rm -f ${tf}.pz ${tf}.1
+					continue
+				fi
+
+				diff ${tf} ${tf}.1 > /dev/null
+				if [ $? -ne 0 ]
+				then
+					echo "FATAL: Decompression was not correct"
+				fi
+				rm -f ${tf}.pz ${tf}.1
+			done
+		done
+	done
+
+	#
+	# Adapt mode hands binary and incompressible chunks to Zstd when it
+	# is present. The bin.dat file has both.
+	#
+	for tf in `cat files.lst`
+	do
+		echo ${tf} | grep "bin.dat" > /dev/null
+		[ $? -ne 0 ] && continue
+
+		for feat in " " "-R 1g"
+		do
+			cmd="../../pcompress -c adapt -l 6 -s 1m -C $feat ${tf}"
+			echo "Running $cmd"
+			eval $cmd > adapt.log 2>&1
+			if [ $? -ne 0 ]
+			then
+				echo "FATAL: Compression errored."
+				rm -f ${tf}.pz adapt.log
+				continue
+			fi
+			grep "ZSTD chunk count: [1-9]" adapt.log > /dev/null
+			if [ $? -ne 0 ]
+			then
+				echo "FATAL: Adapt mode did not use Zstd"
+			fi
+			rm -f adapt.log
+
+			cmd="../../pcompress -d ${tf}.pz ${tf}.1"
+			echo "Running $cmd"
+			eval $cmd
+			if [ $? -ne 0 ]
+			then
+				echo "FATAL: Decompression errored."
+				rm -f ${tf}.pz ${tf}.1
+				continue
+			fi
+
+			diff ${tf} ${tf}.1 > /dev/null
+			if [ $? -ne 0 ]
+			then
+				echo "FATAL: Decompression was not correct"
+			fi
+			rm -f ${tf}.pz ${tf}.1
+		done
+	done
+fi
+
+echo "#################################################"
+echo ""
+
@@ -3,7 +3,7 @@
 #
 
 clean() {
-	for algo in lzfx lz4 zlib bzip2 lzma lzmaMt libbsc ppmd adapt adapt2
+	for algo in lzfx lz4 zstd zlib bzip2 lzma lzmaMt lzmaMtX libbsc ppmd adapt adapt2
 	do
 		for tf in `cat files.lst`
 		do
@@ -17,7 +17,7 @@ echo "# Compress compressed files"
 echo "#################################################"
 
 clean
-for algo in lzfx lz4 zlib bzip2 lzma lzmaMt libbsc ppmd adapt adapt2
+for algo in lzfx lz4 zstd zlib bzip2 lzma lzmaMt lzmaMtX libbsc ppmd adapt adapt2
 do
 	../../pcompress 2>&1 | grep $algo > /dev/null
 	[ $? -ne 0 ] && continue
@@ -36,7 +36,7 @@ do
 	done
 done
 
-for algo in lzfx lz4 zlib bzip2 lzma lzmaMt libbsc ppmd adapt adapt2
+for algo in lzfx lz4 zstd zlib bzip2 lzma lzmaMt lzmaMtX libbsc ppmd adapt adapt2
 do
 	../../pcompress 2>&1 | grep $algo > /dev/null
 	[ $? -ne 0 ] && continue
@@ -62,6 +62,7 @@
 #define	AVX2_FLAG		(1U << 5)
 #define	XOP_FLAG		0x800
 #define	AES_FLAG		0x2000000
+#define	VAES_FLAG		(1U << 9)
 
 static void
 exec_cpuid(uint32_t *regs)
@@ -147,6 +148,8 @@ cpuid_basic_identify(processor_cap_t *pc)
 	pc->sse_level = 0;
 	pc->sse_sub_level = 0;
 	pc->xop_avail = 0;
+	pc->aes_avail = 0;
+	pc->vaes_avail = 0;
 
 	if (strcmp(raw.vendor_str, "GenuineIntel") == 0) {
 		pc->proc_type = PROC_X64_INTEL;
@@ -185,6 +188,11 @@ cpuid_basic_identify(processor_cap_t *pc)
 
 		if (raw.basic_cpuid[1][2] & AES_FLAG) {
 			pc->aes_avail = 1;
+
+			// VEX encoded 256-bit VAES needs AVX2 as well
+			if (pc->avx_level >= 2 && (raw.basic_cpuid[7][2] & VAES_FLAG)) {
+				pc->vaes_avail = 1;
+			}
 		}
 
 		if (raw.ext_cpuid[1][2] & XOP_FLAG) {
@@ -71,6 +71,7 @@ typedef struct {
 	int avx_level;
 	int xop_avail;
 	int aes_avail;
+	int vaes_avail;
 	proc_type_t proc_type;
 } processor_cap_t;
 
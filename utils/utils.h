@@ -242,6 +242,7 @@ typedef struct {
 	int d_max_threads;
 	int delta2_span;
 	int deltac_min_distance;
+	uint64_t solid_window;
 	cksum_t cksum;
 } algo_props_t;
 
@@ -378,6 +379,12 @@ typedef int (*deinit_func_ptr)(void **data);
 typedef void (*stats_func_ptr)(int show);
 typedef void (*props_func_ptr)(algo_props_t *data, int level, uint64_t chunksize);
 
+/*
+ * Pointer type for the function that sets the priming window used by the next
+ * compress or decompress call in solid mode.
+ */
+typedef void (*prime_func_ptr)(void *data, uchar_t *buf, uint64_t len);
+
 /*
  * Logging definitions.
  */
@@ -0,0 +1,184 @@
+/*
+ * This file is a part of Pcompress, a chunked parallel multi-
+ * algorithm lossless compression and decompression program.
+ *
+ * Copyright (C) 2012-2013 Moinak Ghosh. All rights reserved.
+ * Use is subject to license terms.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ * moinakg@belenix.org, http://moinakg.wordpress.com/
+ */
+
+/*
+ * Simple batch oriented worker pool. Batches are kept in a FIFO list. A
+ * worker picks the next unclaimed task from the oldest batch that still has
+ * work, runs it and marks it done. The submitter of a batch claims tasks from
+ * its own batch as well and then waits for stragglers being run by workers.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "wpool.h"
+
+/*
+ * Claim a task from the first batch that has unclaimed tasks. Called with
+ * the pool lock held.
+ */
+static struct wpool_batch *
+claim_task(wpool_t *wp, int *idx)
+{
+	struct wpool_batch *b;
+
+	for (b = wp->head; b != NULL; b = b->nxt) {
+		if (b->next < b->num) {
+			*idx = b->next++;
+			return (b);
+		}
+	}
+	return (NULL);
+}
+
+/*
+ * Run one claimed task and account for it. Called without the lock held,
+ * returns with the lock held.
+ */
+static void
+run_task(wpool_t *wp, struct wpool_batch *b, int idx)
+{
+	b->func(b->args + (size_t)idx * b->argsz);
+	pthread_mutex_lock(&wp->lock);
+	b->done++;
+	if (b->done == b->num)
+		pthread_cond_signal(&b->done_cv);
+}
+
+static void *
+wpool_worker(void *arg)
+{
+	wpool_t *wp = (wpool_t *)arg;
+	struct wpool_batch *b;
+	int idx;
+
+	pthread_mutex_lock(&wp->lock);
+	for (;;) {
+		while (!wp->shutdown && (b = claim_task(wp, &idx)) == NULL)
+			pthread_cond_wait(&wp->work_cv, &wp->lock);
+		if (wp->shutdown)
+			break;
+		pthread_mutex_unlock(&wp->lock);
+		run_task(wp, b, idx);
+	}
+	pthread_mutex_unlock(&wp->lock);
+	return (NULL);
+}
+
+/*
+ * Create a pool with the given number of worker threads. A pool with zero
+ * workers is valid, all batches are then run by the submitting thread.
+ */
+wpool_t *
+wpool_create(int nthreads)
+{
+	wpool_t *wp;
+	int i;
+
+	if (nthreads < 0)
+		nthreads = 0;
+	wp = (wpool_t *)malloc(sizeof (wpool_t));
+	if (wp == NULL)
+		return (NULL);
+	memset(wp, 0, sizeof (wpool_t));
+	pthread_mutex_init(&wp->lock, NULL);
+	pthread_cond_init(&wp->work_cv, NULL);
+	if (nthreads > 0) {
+		wp->threads = (pthread_t *)malloc(sizeof (pthread_t) * nthreads);
+		if (wp->threads == NULL) {
+			wpool_destroy(wp);
+			return (NULL);
+		}
+	}
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&(wp->threads[i]), NULL, wpool_worker, wp) != 0)
+			break;
+		wp->nthreads++;
+	}
+	return (wp);
+}
+
+void
+wpool_destroy(wpool_t *wp)
+{
+	int i;
+
+	if (wp == NULL)
+		return;
+	pthread_mutex_lock(&wp->lock);
+	wp->shutdown = 1;
+	pthread_cond_broadcast(&wp->work_cv);
+	pthread_mutex_unlock(&wp->lock);
+	for (i = 0; i < wp->nthreads; i++)
+		pthread_join(wp->threads[i], NULL);
+	pthread_cond_destroy(&wp->work_cv);
+	pthread_mutex_destroy(&wp->lock);
+	free(wp->threads);
+	free(wp);
+}
+
+/*
+ * Run func on each of the num argument structures of size argsz in the args
+ * array and return when all of them have completed. If wp is NULL the tasks
+ * are run serially by the caller.
+ */
+void
+wpool_run(wpool_t *wp, wpool_func_t func, void *args, size_t argsz, int num)
+{
+	struct wpool_batch b, **bp;
+	int i, idx;
+
+	if (wp == NULL || wp->nthreads == 0 || num < 2) {
+		for (i = 0; i < num; i++)
+			func((char *)args + (size_t)i * argsz);
+		return;
+	}
+
+	b.func = func;
+	b.args = (char *)args;
+	b.argsz = argsz;
+	b.num = num;
+	b.next = 0;
+	b.done = 0;
+	b.nxt = NULL;
+	pthread_cond_init(&b.done_cv, NULL);
+
+	pthread_mutex_lock(&wp->lock);
+	for (bp = &wp->head; *bp != NULL; bp = &((*bp)->nxt));
+	*bp = &b;
+	pthread_cond_broadcast(&wp->work_cv);
+
+	while (b.next < b.num) {
+		idx = b.next++;
+		pthread_mutex_unlock(&wp->lock);
+		run_task(wp, &b, idx);
+	}
+	while (b.done < b.num)
+		pthread_cond_wait(&b.done_cv, &wp->lock);
+
+	for (bp = &wp->head; *bp != &b; bp = &((*bp)->nxt));
+	*bp = b.nxt;
+	pthread_mutex_unlock(&wp->lock);
+	pthread_cond_destroy(&b.done_cv);
+}
@@ -0,0 +1,71 @@
+/*
+ * This file is a part of Pcompress, a chunked parallel multi-
+ * algorithm lossless compression and decompression program.
+ *
+ * Copyright (C) 2012-2013 Moinak Ghosh. All rights reserved.
+ * Use is subject to license terms.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ * moinakg@belenix.org, http://moinakg.wordpress.com/
+ */
+
+#ifndef	_WPOOL_H
+#define	_WPOOL_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * A small pool of worker threads that executes batches of independent tasks.
+ * The thread calling wpool_run() also executes tasks from its own batch, so
+ * batches can be submitted concurrently by several chunk threads and even
+ * from within a running task without deadlocking. When all workers are busy
+ * the submitting thread simply ends up doing all the work itself.
+ */
+typedef void (*wpool_func_t)(void *arg);
+
+struct wpool_batch {
+	wpool_func_t func;
+	char *args;
+	size_t argsz;
+	int num, next, done;
+	pthread_cond_t done_cv;
+	struct wpool_batch *nxt;
+};
+
+typedef struct {
+	int nthreads;
+	int shutdown;
+	pthread_t *threads;
+	pthread_mutex_t lock;
+	pthread_cond_t work_cv;
+	struct wpool_batch *head;
+} wpool_t;
+
+wpool_t *wpool_create(int nthreads);
+void wpool_destroy(wpool_t *wp);
+void wpool_run(wpool_t *wp, wpool_func_t func, void *args, size_t argsz, int num);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif
@@ -36,6 +36,21 @@
  */
 #define	SINGLE_CALL_MAX (2147483648UL)
 
+/*
+ * Solid mode priming window, the size of the raw deflate window.
+ */
+#define	ZLIB_WINDOW	(32 * 1024)
+
+/*
+ * Per-thread zlib state. The priming window is only used in solid mode and
+ * is set before each chunk.
+ */
+typedef struct {
+	z_stream zs;
+	uchar_t *prime;
+	uint64_t prime_len;
+} zlib_data_t;
+
 static void zerr(int ret, int cmp);
 
 static void *
@@ -59,10 +74,14 @@ int
 zlib_init(void **data, int *level, int nthreads, uint64_t chunksize,
 	  int file_version, compress_op_t op)
 {
+	zlib_data_t *zd;
 	z_stream *zs;
 	int ret;
 
-	zs = (z_stream *)slab_alloc(NULL, sizeof (z_stream));
+	zd = (zlib_data_t *)slab_alloc(NULL, sizeof (zlib_data_t));
+	zd->prime = NULL;
+	zd->prime_len = 0;
+	zs = &(zd->zs);
 	zs->zalloc = slab_alloc_ui;
 	zs->zfree = slab_free;
 	zs->opaque = NULL;
@@ -82,7 +101,7 @@ zlib_init(void **data, int *level, int nthreads, uint64_t chunksize,
 		return (-1);
 	}
 
-	*data = zs;
+	*data = zd;
 	return (0);
 }
 
@@ -95,19 +114,33 @@ void
 zlib_props(algo_props_t *data, int level, uint64_t chunksize) {
 	data->delta2_span = 100;
 	data->deltac_min_distance = EIGHTM;
+	data->solid_window = ZLIB_WINDOW;
 }
 
 int
 zlib_deinit(void **data)
 {
 	if (*data) {
-		z_stream *zs = (z_stream *)(*data);
-		deflateEnd(zs);
+		zlib_data_t *zd = (zlib_data_t *)(*data);
+		deflateEnd(&(zd->zs));
 		slab_free(NULL, *data);
 	}
 	return (0);
 }
 
+/*
+ * Set the window the next zlib_compress() or zlib_decompress() call on this
+ * thread's stream is primed with. A zero length disables priming.
+ */
+void
+zlib_prime(void *data, uchar_t *buf, uint64_t len)
+{
+	zlib_data_t *zd = (zlib_data_t *)data;
+
+	zd->prime = buf;
+	zd->prime_len = len;
+}
+
 static
 void zerr(int ret, int cmp)
 {
@@ -150,7 +183,8 @@ zlib_compress(void *src, uint64_t srclen, void *dst, uint64_t *dstlen,
 	uint64_t _dstlen = *dstlen;
 	uchar_t *dst1 = (uchar_t *)dst;
 	uchar_t *src1 = (uchar_t *)src;
-	z_stream *zs = (z_stream *)data;
+	zlib_data_t *zd = (zlib_data_t *)data;
+	z_stream *zs = &(zd->zs);
 
 	/*
 	 * If the data is known to be compressed then certain types less compressed data
@@ -165,6 +199,13 @@ zlib_compress(void *src, uint64_t srclen, void *dst, uint64_t *dstlen,
 			return (-1);
 		}
 	}
+	if (zd->prime_len > 0) {
+		ret = deflateSetDictionary(zs, zd->prime, zd->prime_len);
+		if (ret != Z_OK) {
+			zerr(ret, 1);
+			return (-1);
+		}
+	}
 	ending = 0;
 	while (_srclen > 0) {
 		if (_srclen > SINGLE_CALL_MAX) {
@@ -226,8 +267,16 @@ zlib_decompress(void *src, uint64_t srclen, void *dst, uint64_t *dstlen,
 	uint64_t _dstlen = *dstlen;
 	uchar_t *dst1 = (uchar_t *)dst;
 	uchar_t *src1 = (uchar_t *)src;
-	z_stream *zs = (z_stream *)data;
+	zlib_data_t *zd = (zlib_data_t *)data;
+	z_stream *zs = &(zd->zs);
 
+	if (zd->prime_len > 0) {
+		err = inflateSetDictionary(zs, zd->prime, zd->prime_len);
+		if (err != Z_OK) {
+			zerr(err, 0);
+			return (-1);
+		}
+	}
 	while (_srclen > 0) {
 		if (_srclen > SINGLE_CALL_MAX) {
 			slen = SINGLE_CALL_MAX;
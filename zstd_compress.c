@@ -0,0 +1,215 @@
+/*
+ * This file is a part of Pcompress, a chunked parallel multi-
+ * algorithm lossless compression and decompression program.
+ *
+ * Copyright (C) 2012-2013 Moinak Ghosh. All rights reserved.
+ * Use is subject to license terms.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ * moinakg@belenix.org, http://moinakg.wordpress.com/
+ *
+ */
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <strings.h>
+#include <string.h>
+#include <utils.h>
+#include <pcompress.h>
+#include <allocator.h>
+#include <zstd.h>
+#include <zstd_errors.h>
+
+/*
+ * Chunks of at least this size are compressed with a window covering the
+ * whole chunk and long distance matching enabled. Smaller chunks fit within
+ * the regular window of the higher levels anyway.
+ */
+#define	ZSTD_LDM_MIN_CHUNK	(16 * 1024 * 1024)
+
+/*
+ * Largest window used. Decompression raises its window limit to this.
+ */
+#define	ZSTD_WLOG_MAX		30
+
+/*
+ * Mapping of Pcompress levels 1 - 14 to Zstd levels. Levels above 19 are
+ * the Zstd "ultra" levels and need a lot more memory.
+ */
+static const int zstd_levels[] = {1, 2, 3, 4, 5, 7, 9, 12, 15, 17, 19, 20, 21, 22};
+
+struct zstd_params {
+	ZSTD_CCtx *cctx;
+	ZSTD_DCtx *dctx;
+};
+
+static int
+zstd_level(int level)
+{
+	if (level < 1) level = 1;
+	if (level > 14) level = 14;
+	return (zstd_levels[level - 1]);
+}
+
+static int
+zstd_wlog(uint64_t chunksize)
+{
+	int wlog = 10;
+
+	while (wlog < ZSTD_WLOG_MAX && ((uint64_t)1 << wlog) < chunksize)
+		wlog++;
+	return (wlog);
+}
+
+static void
+zstd_err(size_t rv)
+{
+	log_msg(LOG_ERR, 0, "Zstd: %s\n", ZSTD_getErrorName(rv));
+}
+
+void
+zstd_stats(int show)
+{
+}
+
+int
+zstd_buf_extra(uint64_t buflen)
+{
+	return (ZSTD_compressBound(buflen) - buflen);
+}
+
+void
+zstd_props(algo_props_t *data, int level, uint64_t chunksize) {
+	data->compress_mt_capable = 0;
+	data->decompress_mt_capable = 0;
+	data->buf_extra = zstd_buf_extra(chunksize);
+	data->delta2_span = 100;
+	if (chunksize >= ZSTD_LDM_MIN_CHUNK)
+		data->deltac_min_distance = (EIGHTM * 16);
+	else
+		data->deltac_min_distance = FOURM;
+}
+
+int
+zstd_init(void **data, int *level, int nthreads, uint64_t chunksize,
+	  int file_version, compress_op_t op)
+{
+	struct zstd_params *zsdat;
+	size_t rv = 0;
+
+	zsdat = (struct zstd_params *)slab_alloc(NULL, sizeof (struct zstd_params));
+	if (zsdat == NULL) {
+		log_msg(LOG_ERR, 0, "Zstd: Out of memory.\n");
+		return (-1);
+	}
+	zsdat->cctx = NULL;
+	zsdat->dctx = NULL;
+
+	if (op == COMPRESS) {
+		zsdat->cctx = ZSTD_createCCtx();
+		if (zsdat->cctx == NULL) {
+			log_msg(LOG_ERR, 0, "Zstd: Out of memory.\n");
+			slab_free(NULL, zsdat);
+			return (-1);
+		}
+
+		/*
+		 * Big chunks get a window spanning the entire chunk along with long
+		 * distance matching so that far apart repeats are still found.
+		 */
+		if (chunksize >= ZSTD_LDM_MIN_CHUNK) {
+			rv = ZSTD_CCtx_setParameter(zsdat->cctx, ZSTD_c_windowLog,
+			    zstd_wlog(chunksize));
+			if (!ZSTD_isError(rv))
+				rv = ZSTD_CCtx_setParameter(zsdat->cctx,
+				    ZSTD_c_enableLongDistanceMatching, 1);
+		}
+	} else {
+		zsdat->dctx = ZSTD_createDCtx();
+		if (zsdat->dctx == NULL) {
+			log_msg(LOG_ERR, 0, "Zstd: Out of memory.\n");
+			slab_free(NULL, zsdat);
+			return (-1);
+		}
+		rv = ZSTD_DCtx_setParameter(zsdat->dctx, ZSTD_d_windowLogMax, ZSTD_WLOG_MAX);
+	}
+	if (ZSTD_isError(rv)) {
+		zstd_err(rv);
+		zstd_deinit((void **)&zsdat);
+		return (-1);
+	}
+	*data = zsdat;
+	return (0);
+}
+
+int
+zstd_deinit(void **data)
+{
+	struct zstd_params *zsdat = (struct zstd_params *)(*data);
+
+	if (zsdat) {
+		if (zsdat->cctx)
+			ZSTD_freeCCtx(zsdat->cctx);
+		if (zsdat->dctx)
+			ZSTD_freeDCtx(zsdat->dctx);
+		slab_free(NULL, zsdat);
+	}
+	*data = NULL;
+	return (0);
+}
+
+int
+zstd_compress(void *src, uint64_t srclen, void *dst, uint64_t *dstlen,
+	      int level, uchar_t chdr, int btype, void *data)
+{
+	struct zstd_params *zsdat = (struct zstd_params *)data;
+	size_t rv;
+
+	/*
+	 * The level is set per call since the adaptive modes use the same context
+	 * at different levels.
+	 */
+	rv = ZSTD_CCtx_setParameter(zsdat->cctx, ZSTD_c_compressionLevel, zstd_level(level));
+	if (ZSTD_isError(rv)) {
+		zstd_err(rv);
+		return (-1);
+	}
+	rv = ZSTD_compress2(zsdat->cctx, dst, *dstlen, src, srclen);
+	if (ZSTD_isError(rv)) {
+		/* Output overflow is not fatal, the chunk is stored uncompressed. */
+		if (ZSTD_getErrorCode(rv) != ZSTD_error_dstSize_tooSmall)
+			zstd_err(rv);
+		return (-1);
+	}
+	*dstlen = rv;
+	return (0);
+}
+
+int
+zstd_decompress(void *src, uint64_t srclen, void *dst, uint64_t *dstlen,
+		int level, uchar_t chdr, int btype, void *data)
+{
+	struct zstd_params *zsdat = (struct zstd_params *)data;
+	size_t rv;
+
+	rv = ZSTD_decompressDCtx(zsdat->dctx, dst, *dstlen, src, srclen);
+	if (ZSTD_isError(rv)) {
+		zstd_err(rv);
+		return (-1);
+	}
+	*dstlen = rv;
+	return (0);
+}